@@ -2,6 +2,10 @@
 
 layout (local_size_x = 256) in;
 
+layout(push_constant) uniform PushConstants{
+    uint numElements;
+};
+
 
 layout(set=0, binding=0) readonly buffer inBuffer{
     int inData[];
@@ -15,6 +19,10 @@ layout(set=0, binding=1) buffer outBuffer{
 
 void main(void) {
     int global_id = int(gl_GlobalInvocationID.x);
+    if (global_id >= numElements)
+    {
+        return;
+    }
 
     outData[global_id] = inData[global_id] * inData[global_id];
 }
@@ -5,6 +5,7 @@
 #include <fstream>
 #include <algorithm>
 #include <iterator>
+#include "../vulkan_compute_shader_studio/CpuCompute.h"
 
 
 using std::vector;
@@ -69,6 +70,7 @@ int main() {
 
     //BUFFERS
     const uint32_t numElements = 10;
+    const uint32_t workgroupSize = 256; // local_size_x in Square.comp.glsl
     const uint32_t bufferSize = numElements * sizeof(int32_t);
 
     //create info used in buffer creation
@@ -159,10 +161,12 @@ int main() {
     vk::DescriptorSetLayout descriptorSetLayout = device.createDescriptorSetLayout(descriptorSetLayoutInfo);
 
     //PIPELINE
-    //Pipeline layout
+    //Pipeline layout, numElements is pushed for the shader's bounds check
+    vk::PushConstantRange pushConstantRange(vk::ShaderStageFlagBits::eCompute, 0, sizeof(uint32_t));
     vk::PipelineLayoutCreateInfo pipelineLayoutCreateInfo(
         vk::PipelineLayoutCreateFlags(),
-        descriptorSetLayout
+        descriptorSetLayout,
+        pushConstantRange
     );
     vk::PipelineLayout pipelineLayout = device.createPipelineLayout(pipelineLayoutCreateInfo);
     vk::PipelineCache pipelineCache = device.createPipelineCache(vk::PipelineCacheCreateInfo());
@@ -216,7 +220,7 @@ int main() {
     vk::CommandBuffer commandBuffer = commandBuffers.front();
 
     //recording commands, dispatch
-    //Here compute shader is run as many times as their are elements written in buffer
+    //Each workgroup runs workgroupSize invocations, launch just enough of them to cover every element
     vk::CommandBufferBeginInfo commandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
     commandBuffer.begin(commandBufferBeginInfo);
     commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, computePipeline);
@@ -225,7 +229,8 @@ int main() {
         0,
         { descriptorSet },
         {});
-    commandBuffer.dispatch(numElements, 1, 1);
+    commandBuffer.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(uint32_t), &numElements);
+    commandBuffer.dispatch((numElements + workgroupSize - 1) / workgroupSize, 1, 1);
     commandBuffer.end();
 
     //submit commandBuffer to queue
@@ -244,12 +249,18 @@ int main() {
     }
     std::cout << std::endl;
 
+    //same kernel on the CPU backend, the results have to be identical
+    vector<int32_t> cpuOut(numElements);
+    ThreadPool threadPool;
+    CpuCompute::square(threadPool, inBufferPtr, cpuOut.data(), numElements);
     device.unmapMemory(inBufferMemory);
 
     for (uint32_t i = 0; i < numElements; ++i) {
         std::cout << outBufferPtr[i] << " ";
     }
     std::cout << std::endl;
+    bool matchesCpu = std::equal(cpuOut.begin(), cpuOut.end(), outBufferPtr);
+    std::cout << (matchesCpu ? "Matches" : "Doesn't match") << " the CPU backend (" << getCpuKernels().name << ")" << std::endl;
     device.unmapMemory(outBufferMemory);
 
     //CLEANUP
@@ -0,0 +1,878 @@
+#include "../vulkan_compute_shader_studio/VkRenderer.h"
+#include "../vulkan_compute_shader_studio/Simulation.h"
+#include "../vulkan_compute_shader_studio/VkRadixSort.h"
+#include "../vulkan_compute_shader_studio/VkReduceScan.h"
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <ctime>
+#include <random>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+#include <limits>
+#include <cmath>
+
+using std::string;
+using std::cout;
+using std::endl;
+
+// Headless sweep of Simulation steps over element counts and workgroup sizes, written as JSON so
+// runs on different commits can be diffed. Works on lavapipe, large counts are skipped when they don't fit.
+// By default the steps run the copy kernel, a bandwidth test; --nbody runs the N-body kernel instead
+// and also reports body-body interactions per second, with a lower default element cap since it's O(N^2).
+// --radix-sort sweeps VkRadixSort over 1M to 64M random keys instead, checks every result against
+// std::sort and reports keys/s for both. --reduce-scan runs VkReduceScan over 1M to 64M int, uint and
+// float values, with subgroup arithmetic and with the shared memory fallback, next to a CPU version on
+// every hardware thread. --cpu-crossover steps the same simulation on the GPU and on the CPU backend from
+// 64 elements up, checks that both end up with the same positions, and reports the largest count at which
+// the CPU is still faster, the value to give --cpu-threshold. Add --nbody for the N-body kernel.
+//
+// simulation_benchmark [--nbody] [--radix-sort | --reduce-scan | --cpu-crossover] [--out file.json] [--max-elements N] [--seconds S] [--shader file.spv]
+
+struct BenchmarkResult
+{
+    uint32_t elements;
+    uint32_t workgroupSize;
+    string skipped; // reason, empty when the configuration ran
+    uint32_t steps;
+    double stepsPerSecond;
+    double bandwidth;       // GB/s, each step reads the positions of one state and writes the next
+    double cpuMsPerStep;    // host time to queue a step
+    double gpuMsPerStep;    // timestamp queries around the dispatch, negative when unavailable
+    double interactionsPerSecond; // N-body only, N^2 per step
+};
+
+struct SortBenchmarkResult
+{
+    uint32_t elements;
+    string skipped;
+    uint32_t sorts;
+    double keysPerSecond;           // host time from submit to sorted, uploads excluded
+    double gpuMsPerSort;            // timestamp queries around the sort, negative when unavailable
+    double referenceKeysPerSecond;  // std::sort on one thread
+    bool matchesReference;
+};
+
+struct ReduceScanBenchmarkResult
+{
+    uint32_t elements;
+    string type;
+    string operation;
+    bool subgroups;
+    string skipped;
+    uint32_t runs;
+    double gpuElementsPerSecond;    // host time from submit to done
+    double gpuMsPerRun;             // timestamp queries around the submission, negative when unavailable
+    double cpuElementsPerSecond;
+    uint32_t cpuThreads;
+    bool matchesReference;
+};
+
+struct CrossoverResult
+{
+    uint32_t elements;
+    double gpuStepsPerSecond;
+    double cpuStepsPerSecond;
+    double maxDifference;   // largest position component difference after the same steps on both
+    bool matches;           // bit for bit for the copy kernel, within rounding for N-body
+};
+
+vk::DeviceSize getDeviceLocalHeapSize(vk::PhysicalDevice physicalDevice)
+{
+    vk::PhysicalDeviceMemoryProperties memoryProperties = physicalDevice.getMemoryProperties();
+    vk::DeviceSize heapSize = 0;
+    for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; ++i)
+    {
+        if (memoryProperties.memoryHeaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal)
+        {
+            heapSize = std::max(heapSize, memoryProperties.memoryHeaps[i].size);
+        }
+    }
+    return heapSize;
+}
+
+BenchmarkResult runConfiguration(VkRenderer& renderer, const char* shaderFileName, uint32_t elements, uint32_t workgroupSize, double targetSeconds, bool nbody)
+{
+    BenchmarkResult result{ elements, workgroupSize };
+    Simulation simulation{ &renderer, shaderFileName, elements, "../vulkan_compute_shader_studio/shaders/particlePopulation.spv",
+        "../vulkan_compute_shader_studio/shaders/spatialHash.spv" };
+    simulation.setWorkgroupSize(workgroupSize);
+    simulation.setCpuThreshold(0);
+    simulation.init();
+
+    // A few steps to warm up and estimate how many fit in the time budget, capped by the profiler's query pairs
+    Simulation::HeadlessTimings warmup = simulation.runHeadless(3);
+    double secondsPerStep = std::max(warmup.seconds / warmup.steps, 1e-6);
+    uint32_t steps = static_cast<uint32_t>(std::min(std::max(targetSeconds / secondsPerStep, 5.0), 256.0));
+
+    renderer.profiler.collect();
+    renderer.profiler.resetGpuStatistics();
+    Simulation::HeadlessTimings timings = simulation.runHeadless(steps);
+    renderer.profiler.collect();
+    VkProfiler::ScopeStatistics gpuStatistics = renderer.profiler.getGpuStatistics("compute dispatch");
+
+    result.steps = timings.steps;
+    result.stepsPerSecond = timings.steps / timings.seconds;
+    result.bandwidth = double(Simulation::getBytesPerStep(elements)) * result.stepsPerSecond / 1e9;
+    result.cpuMsPerStep = timings.submitSeconds * 1000.0 / timings.steps;
+    result.gpuMsPerStep = gpuStatistics.count > 0 ? gpuStatistics.totalMicroseconds / 1000.0 / gpuStatistics.count : -1.0;
+    result.interactionsPerSecond = nbody ? double(elements) * double(elements) * result.stepsPerSecond : 0.0;
+
+    simulation.close();
+    return result;
+}
+
+CrossoverResult runCrossoverConfiguration(VkRenderer& renderer, const char* shaderFileName, uint32_t elements, double targetSeconds, bool nbody)
+{
+    CrossoverResult result{ elements };
+    vector<ParticleField> positions[2];
+    double stepsPerSecond[2];
+    for (uint32_t backend = 0; backend < 2; ++backend)
+    {
+        bool cpu = backend == 1;
+        Simulation simulation{ &renderer, shaderFileName, elements, "../vulkan_compute_shader_studio/shaders/particlePopulation.spv",
+            "../vulkan_compute_shader_studio/shaders/spatialHash.spv" };
+        simulation.setCpuThreshold(cpu ? elements : 0, nbody ? CpuCompute::Kernel::eNBody : CpuCompute::Kernel::eCopy);
+        simulation.init();
+
+        // The same steps from the same initial state on both backends, then the time budget like runConfiguration
+        const uint32_t checkSteps = 4;
+        simulation.runHeadless(checkSteps);
+        positions[backend] = simulation.readPositions();
+        Simulation::HeadlessTimings warmup = simulation.runHeadless(3);
+        double secondsPerStep = std::max(warmup.seconds / warmup.steps, 1e-6);
+        uint32_t steps = static_cast<uint32_t>(std::min(std::max(targetSeconds / secondsPerStep, 5.0), 256.0));
+        Simulation::HeadlessTimings timings = simulation.runHeadless(steps);
+        stepsPerSecond[backend] = timings.steps / timings.seconds;
+        simulation.close();
+    }
+    result.gpuStepsPerSecond = stepsPerSecond[0];
+    result.cpuStepsPerSecond = stepsPerSecond[1];
+
+    // Copies are exact. N-body only agrees within 1e-4 of the largest coordinate: after the first step the
+    // alive lists are packed in a different order, so are the sums, and the GPU's inversesqrt may be a few ulps off.
+    double scale = 1.0;
+    result.maxDifference = 0.0;
+    for (uint32_t i = 0; i < elements; ++i)
+    {
+        for (int component = 0; component < 4; ++component)
+        {
+            scale = std::max(scale, double(std::abs(positions[1][i][component])));
+            result.maxDifference = std::max(result.maxDifference, double(std::abs(positions[0][i][component] - positions[1][i][component])));
+        }
+    }
+    result.matches = nbody ? result.maxDifference <= 1e-4 * scale : result.maxDifference == 0.0;
+    return result;
+}
+
+vector<uint32_t> downloadBuffer(VkRenderer& renderer, vk::Buffer buffer, uint32_t count)
+{
+    // One-off copy into host-visible memory, only used to check results so it just waits on a fence
+    vk::Device device = renderer.mainDevices.device;
+    vk::DeviceSize size = vk::DeviceSize(count) * sizeof(uint32_t);
+    vk::Buffer readbackBuffer = device.createBuffer(vk::BufferCreateInfo(vk::BufferCreateFlags(), size, vk::BufferUsageFlagBits::eTransferDst));
+    Allocation readbackAllocation = renderer.allocator.allocateBuffer(readbackBuffer, MemoryUsage::eReadback);
+    vk::CommandPool commandPool = device.createCommandPool(vk::CommandPoolCreateInfo(vk::CommandPoolCreateFlags(), renderer.queueFamilyIndices.computeFamily));
+    vk::CommandBuffer commandBuffer = device.allocateCommandBuffers(vk::CommandBufferAllocateInfo(commandPool, vk::CommandBufferLevel::ePrimary, 1)).front();
+
+    commandBuffer.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+    commandBuffer.copyBuffer(buffer, readbackBuffer, vk::BufferCopy(0, 0, size));
+    vk::MemoryBarrier hostBarrier(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eHostRead);
+    commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost, vk::DependencyFlags(), hostBarrier, {}, {});
+    commandBuffer.end();
+
+    vk::Fence fence = device.createFence(vk::FenceCreateInfo());
+    renderer.computeQueue.submit(vk::SubmitInfo(0, nullptr, nullptr, 1, &commandBuffer), fence);
+    if (device.waitForFences(fence, VK_TRUE, UINT64_MAX) != vk::Result::eSuccess)
+    {
+        throw std::runtime_error("Failed to wait for the readback copy.");
+    }
+    renderer.allocator.invalidate(readbackAllocation);
+    HostSpan<uint32_t> mapped = readbackAllocation.as<uint32_t>();
+    vector<uint32_t> values(mapped.begin(), mapped.begin() + count);
+
+    device.destroyFence(fence);
+    device.destroyCommandPool(commandPool);
+    device.destroyBuffer(readbackBuffer);
+    renderer.allocator.free(readbackAllocation);
+    return values;
+}
+
+SortBenchmarkResult runSortConfiguration(VkRenderer& renderer, VkRadixSort& radixSort, uint32_t elements, double targetSeconds)
+{
+    SortBenchmarkResult result{ elements };
+    std::mt19937 generator(elements);
+    vector<uint32_t> keys(elements);
+    vector<uint32_t> payloads(elements);
+    for (uint32_t i = 0; i < elements; ++i)
+    {
+        keys[i] = generator();
+        payloads[i] = i;
+    }
+
+    // The payload is the original index, so sorting (key, index) pairs gives exactly the stable order
+    vector<std::pair<uint32_t, uint32_t>> reference(elements);
+    for (uint32_t i = 0; i < elements; ++i)
+    {
+        reference[i] = { keys[i], i };
+    }
+    auto referenceStart = std::chrono::high_resolution_clock::now();
+    std::sort(reference.begin(), reference.end());
+    double referenceSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - referenceStart).count();
+    result.referenceKeysPerSecond = elements / referenceSeconds;
+
+    // Uploaded on the transfer queue and sorted on the compute queue, shared by both families
+    vk::DeviceSize size = vk::DeviceSize(elements) * sizeof(uint32_t);
+    vk::BufferUsageFlags usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eTransferSrc;
+    DeviceBuffer keyBuffer = renderer.createDeviceBuffer(size, usage);
+    DeviceBuffer payloadBuffer = renderer.createDeviceBuffer(size, usage);
+    vk::DescriptorBufferInfo keyInfo(keyBuffer.buffer, 0, size);
+    vk::DescriptorBufferInfo payloadInfo(payloadBuffer.buffer, 0, size);
+    VkStagingRing stagingRing{ &renderer };
+    stagingRing.init();
+
+    // Every sort starts from the unsorted keys again, uploaded and waited for outside the timed part
+    renderer.profiler.collect();
+    renderer.profiler.resetGpuStatistics();
+    double sortSeconds = 0.0;
+    uint32_t maxSorts = 3;
+    for (uint32_t sort = 0; sort < maxSorts; ++sort)
+    {
+        stagingRing.upload(keyBuffer.buffer, 0, keys.data(), size);
+        stagingRing.upload(payloadBuffer.buffer, 0, payloads.data(), size);
+        stagingRing.wait(stagingRing.flush());
+
+        auto sortStart = std::chrono::high_resolution_clock::now();
+        radixSort.wait(radixSort.submit(elements, keyInfo, payloadInfo));
+        sortSeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - sortStart).count();
+        renderer.profiler.collect();
+
+        if (sort == 0)
+        {
+            vector<uint32_t> sortedKeys = downloadBuffer(renderer, keyBuffer.buffer, elements);
+            vector<uint32_t> sortedPayloads = downloadBuffer(renderer, payloadBuffer.buffer, elements);
+            result.matchesReference = true;
+            for (uint32_t i = 0; i < elements && result.matchesReference; ++i)
+            {
+                result.matchesReference = sortedKeys[i] == reference[i].first && sortedPayloads[i] == reference[i].second;
+            }
+            if (!result.matchesReference)
+            {
+                cout << "Radix sort of " << elements << " keys doesn't match std::sort" << endl;
+            }
+            // The first sort also sizes the run to the time budget
+            maxSorts = static_cast<uint32_t>(std::min(std::max(targetSeconds / std::max(sortSeconds, 1e-6), 3.0), 64.0));
+        }
+        result.sorts = sort + 1;
+    }
+    VkProfiler::ScopeStatistics gpuStatistics = renderer.profiler.getGpuStatistics("radix sort");
+    result.keysPerSecond = double(elements) * result.sorts / sortSeconds;
+    result.gpuMsPerSort = gpuStatistics.count > 0 ? gpuStatistics.totalMicroseconds / 1000.0 / gpuStatistics.count : -1.0;
+
+    stagingRing.clean();
+    renderer.destroyDeviceBuffer(keyBuffer);
+    renderer.destroyDeviceBuffer(payloadBuffer);
+    return result;
+}
+
+template<typename T>
+T combineValues(ReduceScanOp op, T a, T b)
+{
+    if (op == ReduceScanOp::eMin) return std::min(a, b);
+    if (op == ReduceScanOp::eMax) return std::max(a, b);
+    // Integer sums wrap around like they do on the GPU
+    if constexpr (std::is_integral<T>::value) return static_cast<T>(uint32_t(a) + uint32_t(b));
+    return a + b;
+}
+
+template<typename T>
+T identityValue(ReduceScanOp op)
+{
+    if (op == ReduceScanOp::eSum) return T(0);
+    if constexpr (std::is_floating_point<T>::value)
+    {
+        return op == ReduceScanOp::eMin ? std::numeric_limits<T>::infinity() : -std::numeric_limits<T>::infinity();
+    }
+    return op == ReduceScanOp::eMin ? std::numeric_limits<T>::max() : std::numeric_limits<T>::lowest();
+}
+
+// The CPU baseline: every hardware thread reduces a chunk, or for scans reduces its chunk, then
+// scans it again offset by the chunks before it
+template<typename T>
+void cpuReduceScan(ReduceScanOp op, bool scan, bool inclusive, const vector<T>& input, vector<T>& output, uint32_t numThreads)
+{
+    size_t chunkSize = (input.size() + numThreads - 1) / numThreads;
+    vector<T> chunkTotals(numThreads, identityValue<T>(op));
+    auto forEachChunk = [&](auto work) {
+        vector<std::thread> threads;
+        for (uint32_t t = 0; t < numThreads; ++t)
+        {
+            size_t first = std::min(input.size(), t * chunkSize);
+            size_t last = std::min(input.size(), first + chunkSize);
+            threads.emplace_back(work, t, first, last);
+        }
+        for (std::thread& thread : threads)
+        {
+            thread.join();
+        }
+    };
+
+    forEachChunk([&](uint32_t t, size_t first, size_t last) {
+        T total = identityValue<T>(op);
+        for (size_t i = first; i < last; ++i)
+        {
+            total = combineValues(op, total, input[i]);
+        }
+        chunkTotals[t] = total;
+    });
+    T running = identityValue<T>(op);
+    for (T& total : chunkTotals)
+    {
+        T chunkTotal = total;
+        total = running;
+        running = combineValues(op, running, chunkTotal);
+    }
+    if (!scan)
+    {
+        output.assign(1, running);
+        return;
+    }
+
+    output.resize(input.size());
+    forEachChunk([&](uint32_t t, size_t first, size_t last) {
+        T prefix = chunkTotals[t];
+        for (size_t i = first; i < last; ++i)
+        {
+            T next = combineValues(op, prefix, input[i]);
+            output[i] = inclusive ? next : prefix;
+            prefix = next;
+        }
+    });
+}
+
+template<typename T>
+bool matchesReference(ReduceScanOp op, bool scan, bool inclusive, const vector<T>& input, const vector<uint32_t>& gpuBits)
+{
+    // Float sums are checked against doubles: neither the GPU tree nor a long sequential float sum is
+    // exact, and the latter drifts much further
+    using Accumulator = typename std::conditional<std::is_floating_point<T>::value, double, T>::type;
+    auto matches = [&](size_t i, Accumulator expected) {
+        T gpuValue;
+        std::memcpy(&gpuValue, &gpuBits[i], sizeof(T));
+        if constexpr (std::is_floating_point<T>::value)
+        {
+            // Equal first, exclusive min and max scans start at infinity
+            return double(gpuValue) == expected || std::abs(double(gpuValue) - expected) <= 1e-4 * std::max(1.0, std::abs(expected));
+        }
+        return gpuValue == expected;
+    };
+
+    Accumulator running = identityValue<Accumulator>(op);
+    for (size_t i = 0; i < input.size(); ++i)
+    {
+        Accumulator next = combineValues<Accumulator>(op, running, Accumulator(input[i]));
+        if (scan && !matches(i, inclusive ? next : running))
+        {
+            return false;
+        }
+        running = next;
+    }
+    return scan || matches(0, running);
+}
+
+template<typename T>
+ReduceScanBenchmarkResult runReduceScanConfiguration(VkRenderer& renderer, VkReduceScan& reduceScan, ReduceScanType type, ReduceScanOp op,
+    bool scan, bool inclusive, const vector<T>& values, vk::Buffer inputBuffer, vk::Buffer outputBuffer, double targetSeconds)
+{
+    uint32_t elements = static_cast<uint32_t>(values.size());
+    ReduceScanBenchmarkResult result{ elements };
+    result.subgroups = reduceScan.usesSubgroups();
+    vk::DescriptorBufferInfo input(inputBuffer, 0, vk::DeviceSize(elements) * sizeof(uint32_t));
+    vk::DescriptorBufferInfo output(outputBuffer, 0, scan ? input.range : sizeof(uint32_t));
+    auto submit = [&]() {
+        return scan ? reduceScan.scan(type, op, inclusive, elements, input, output) : reduceScan.reduce(type, op, elements, input, output);
+    };
+
+    // The first run is checked and sizes the rest to the time budget
+    reduceScan.wait(submit());
+    result.matchesReference = matchesReference(op, scan, inclusive, values, downloadBuffer(renderer, outputBuffer, scan ? elements : 1));
+
+    renderer.profiler.collect();
+    renderer.profiler.resetGpuStatistics();
+    double gpuSeconds = 0.0;
+    uint32_t runs = 3;
+    for (uint32_t run = 0; run < runs; ++run)
+    {
+        auto runStart = std::chrono::high_resolution_clock::now();
+        reduceScan.wait(submit());
+        gpuSeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - runStart).count();
+        renderer.profiler.collect();
+        if (run == 0)
+        {
+            runs = static_cast<uint32_t>(std::min(std::max(targetSeconds / std::max(gpuSeconds, 1e-6), 3.0), 64.0));
+        }
+    }
+    VkProfiler::ScopeStatistics gpuStatistics = renderer.profiler.getGpuStatistics(scan ? "scan" : "reduce");
+    result.runs = runs;
+    result.gpuElementsPerSecond = double(elements) * runs / gpuSeconds;
+    result.gpuMsPerRun = gpuStatistics.count > 0 ? gpuStatistics.totalMicroseconds / 1000.0 / gpuStatistics.count : -1.0;
+
+    result.cpuThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    vector<T> cpuOutput;
+    double cpuSeconds = 0.0;
+    for (uint32_t run = 0; run < 3; ++run)
+    {
+        auto runStart = std::chrono::high_resolution_clock::now();
+        cpuReduceScan(op, scan, inclusive, values, cpuOutput, result.cpuThreads);
+        cpuSeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - runStart).count();
+    }
+    result.cpuElementsPerSecond = double(elements) * 3 / cpuSeconds;
+    return result;
+}
+
+std::ofstream openResults(const string& fileName, vk::PhysicalDevice physicalDevice)
+{
+    vk::PhysicalDeviceProperties properties = physicalDevice.getProperties();
+    std::ofstream file(fileName, std::ios::trunc);
+    if (!file.is_open())
+    {
+        throw std::runtime_error("Can't write the benchmark results to " + fileName);
+    }
+
+    file << "{\n  \"device\": \"" << properties.deviceName << "\",\n";
+    file << "  \"driverVersion\": " << properties.driverVersion << ",\n";
+    file << "  \"apiVersion\": \"" << VK_VERSION_MAJOR(properties.apiVersion) << "." << VK_VERSION_MINOR(properties.apiVersion)
+        << "." << VK_VERSION_PATCH(properties.apiVersion) << "\",\n";
+    file << "  \"timestamp\": " << std::time(nullptr) << ",\n";
+    file << "  \"results\": [";
+    return file;
+}
+
+void writeSortResults(const string& fileName, vk::PhysicalDevice physicalDevice, const vector<SortBenchmarkResult>& results)
+{
+    std::ofstream file = openResults(fileName, physicalDevice);
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const SortBenchmarkResult& result = results[i];
+        file << (i > 0 ? ",\n    " : "\n    ") << "{\"elements\": " << result.elements;
+        if (!result.skipped.empty())
+        {
+            file << ", \"skipped\": \"" << result.skipped << "\"}";
+            continue;
+        }
+        file << ", \"sorts\": " << result.sorts << ", \"keysPerSecond\": " << result.keysPerSecond << ", \"gpuMsPerSort\": ";
+        if (result.gpuMsPerSort >= 0.0)
+        {
+            file << result.gpuMsPerSort;
+        }
+        else
+        {
+            file << "null";
+        }
+        file << ", \"referenceKeysPerSecond\": " << result.referenceKeysPerSecond
+            << ", \"matchesReference\": " << (result.matchesReference ? "true" : "false") << "}";
+    }
+    file << "\n  ]\n}\n";
+}
+
+void writeReduceScanResults(const string& fileName, vk::PhysicalDevice physicalDevice, const vector<ReduceScanBenchmarkResult>& results)
+{
+    std::ofstream file = openResults(fileName, physicalDevice);
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const ReduceScanBenchmarkResult& result = results[i];
+        file << (i > 0 ? ",\n    " : "\n    ") << "{\"elements\": " << result.elements << ", \"type\": \"" << result.type
+            << "\", \"operation\": \"" << result.operation << "\", \"subgroups\": " << (result.subgroups ? "true" : "false");
+        if (!result.skipped.empty())
+        {
+            file << ", \"skipped\": \"" << result.skipped << "\"}";
+            continue;
+        }
+        file << ", \"runs\": " << result.runs << ", \"gpuElementsPerSecond\": " << result.gpuElementsPerSecond << ", \"gpuMsPerRun\": ";
+        if (result.gpuMsPerRun >= 0.0)
+        {
+            file << result.gpuMsPerRun;
+        }
+        else
+        {
+            file << "null";
+        }
+        file << ", \"cpuElementsPerSecond\": " << result.cpuElementsPerSecond << ", \"cpuThreads\": " << result.cpuThreads
+            << ", \"matchesReference\": " << (result.matchesReference ? "true" : "false") << "}";
+    }
+    file << "\n  ]\n}\n";
+}
+
+void writeCrossoverResults(const string& fileName, vk::PhysicalDevice physicalDevice, const vector<CrossoverResult>& results, uint32_t cpuThreads,
+    uint32_t crossover)
+{
+    std::ofstream file = openResults(fileName, physicalDevice);
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const CrossoverResult& result = results[i];
+        file << (i > 0 ? ",\n    " : "\n    ") << "{\"elements\": " << result.elements << ", \"gpuStepsPerSecond\": " << result.gpuStepsPerSecond
+            << ", \"cpuStepsPerSecond\": " << result.cpuStepsPerSecond << ", \"maxDifference\": " << result.maxDifference
+            << ", \"matches\": " << (result.matches ? "true" : "false") << "}";
+    }
+    file << "\n  ],\n  \"cpuSimd\": \"" << getCpuKernels().name << "\",\n  \"cpuThreads\": " << cpuThreads
+        << ",\n  \"cpuThreshold\": " << crossover << "\n}\n";
+}
+
+void writeResults(const string& fileName, vk::PhysicalDevice physicalDevice, const vector<BenchmarkResult>& results)
+{
+    std::ofstream file = openResults(fileName, physicalDevice);
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const BenchmarkResult& result = results[i];
+        file << (i > 0 ? ",\n    " : "\n    ") << "{\"elements\": " << result.elements << ", \"workgroupSize\": " << result.workgroupSize;
+        if (!result.skipped.empty())
+        {
+            file << ", \"skipped\": \"" << result.skipped << "\"}";
+            continue;
+        }
+        file << ", \"steps\": " << result.steps << ", \"stepsPerSecond\": " << result.stepsPerSecond
+            << ", \"bandwidthGBps\": " << result.bandwidth << ", \"cpuMsPerStep\": " << result.cpuMsPerStep << ", \"gpuMsPerStep\": ";
+        if (result.gpuMsPerStep >= 0.0)
+        {
+            file << result.gpuMsPerStep;
+        }
+        else
+        {
+            file << "null";
+        }
+        if (result.interactionsPerSecond > 0.0)
+        {
+            file << ", \"interactionsPerSecond\": " << result.interactionsPerSecond;
+        }
+        file << "}";
+    }
+    file << "\n  ]\n}\n";
+}
+
+int runSortBenchmark(VkRenderer& renderer, const char* shaderFileName, const string& outFileName, uint32_t maxElements,
+    double targetSeconds, vk::DeviceSize heapSize)
+{
+    vk::PhysicalDevice physicalDevice = renderer.mainDevices.physicalDevice;
+    vk::PhysicalDeviceLimits limits = physicalDevice.getProperties().limits;
+    vector<SortBenchmarkResult> results;
+    VkRadixSort radixSort{ &renderer, shaderFileName };
+    // Sized once for the largest count that fits, smaller counts reuse it
+    uint32_t sortCapacity = 0;
+    try
+    {
+        for (uint64_t elements = 1u << 20; elements <= maxElements; elements *= 2)
+        {
+            uint32_t elementCount = static_cast<uint32_t>(elements);
+            SortBenchmarkResult result{ elementCount };
+            if (vk::DeviceSize(elementCount) * sizeof(uint32_t) > limits.maxStorageBufferRange)
+            {
+                result.skipped = "keys larger than maxStorageBufferRange";
+            }
+            // Keys and payloads, the sort's copy of both, and a readback buffer for the check
+            else if (5 * vk::DeviceSize(elementCount) * sizeof(uint32_t) > heapSize / 2)
+            {
+                result.skipped = "buffers larger than half the device-local heap";
+            }
+            else
+            {
+                sortCapacity = elementCount;
+            }
+            results.push_back(result);
+        }
+        if (sortCapacity > 0)
+        {
+            radixSort.init(sortCapacity);
+            cout << "Radix sort with workgroups of " << radixSort.getWorkgroupSize() << endl;
+        }
+        for (SortBenchmarkResult& result : results)
+        {
+            if (result.skipped.empty())
+            {
+                result = runSortConfiguration(renderer, radixSort, result.elements, targetSeconds);
+            }
+        }
+        writeSortResults(outFileName, physicalDevice, results);
+    }
+    catch (const std::exception& e)
+    {
+        printf("ERROR: %s\n", e.what());
+        renderer.mainDevices.device.waitIdle();
+        renderer.cleanUp();
+        return EXIT_FAILURE;
+    }
+
+    cout << "Wrote " << results.size() << " sort sizes to " << outFileName << endl;
+    if (sortCapacity > 0)
+    {
+        radixSort.clean();
+    }
+    renderer.cleanUp();
+    return 0;
+}
+
+template<typename T>
+void runReduceScanType(VkRenderer& renderer, VkReduceScan& reduceScan, ReduceScanType type, const char* typeName, const vector<uint32_t>& bits,
+    vk::Buffer inputBuffer, vk::Buffer outputBuffer, double targetSeconds, vector<ReduceScanBenchmarkResult>& results)
+{
+    vector<T> values(bits.size());
+    std::memcpy(values.data(), bits.data(), bits.size() * sizeof(uint32_t));
+    VkStagingRing stagingRing{ &renderer };
+    stagingRing.init();
+    stagingRing.upload(inputBuffer, 0, bits.data(), bits.size() * sizeof(uint32_t));
+    stagingRing.wait(stagingRing.flush());
+    stagingRing.clean();
+
+    struct Operation
+    {
+        const char* name;
+        ReduceScanOp op;
+        bool scan;
+        bool inclusive;
+    };
+    const Operation operations[] = {
+        { "reduce sum", ReduceScanOp::eSum, false, false },
+        { "reduce min", ReduceScanOp::eMin, false, false },
+        { "reduce max", ReduceScanOp::eMax, false, false },
+        { "inclusive scan sum", ReduceScanOp::eSum, true, true },
+        { "exclusive scan sum", ReduceScanOp::eSum, true, false } };
+    for (const Operation& operation : operations)
+    {
+        ReduceScanBenchmarkResult result = runReduceScanConfiguration(renderer, reduceScan, type, operation.op, operation.scan, operation.inclusive,
+            values, inputBuffer, outputBuffer, targetSeconds);
+        result.type = typeName;
+        result.operation = operation.name;
+        if (!result.matchesReference)
+        {
+            cout << operation.name << " of " << values.size() << " " << typeName << " values doesn't match the CPU" << endl;
+        }
+        results.push_back(result);
+    }
+}
+
+int runReduceScanBenchmark(VkRenderer& renderer, const string& outFileName, uint32_t maxElements, double targetSeconds, vk::DeviceSize heapSize)
+{
+    vk::PhysicalDevice physicalDevice = renderer.mainDevices.physicalDevice;
+    vk::PhysicalDeviceLimits limits = physicalDevice.getProperties().limits;
+    vector<ReduceScanBenchmarkResult> results;
+    const char* shaderFileName = "../vulkan_compute_shader_studio/shaders/reduceScan.spv";
+    const char* subgroupShaderFileName = "../vulkan_compute_shader_studio/shaders/reduceScanSubgroup.spv";
+    try
+    {
+        for (bool allowSubgroups : { true, false })
+        {
+            // Input, output and a readback buffer for the check
+            uint32_t capacity = 0;
+            for (uint64_t elements = 1u << 20; elements <= maxElements; elements *= 4)
+            {
+                vk::DeviceSize size = vk::DeviceSize(elements) * sizeof(uint32_t);
+                if (size <= limits.maxStorageBufferRange && 3 * size <= heapSize / 2)
+                {
+                    capacity = static_cast<uint32_t>(elements);
+                }
+            }
+            VkReduceScan reduceScan{ &renderer, shaderFileName, subgroupShaderFileName };
+            reduceScan.init(std::max(capacity, 1u), allowSubgroups);
+            if (allowSubgroups && !reduceScan.usesSubgroups())
+            {
+                cout << "No subgroup arithmetic in compute shaders on this device, only the shared memory path is measured" << endl;
+                reduceScan.clean();
+                continue;
+            }
+
+            for (uint64_t elements = 1u << 20; elements <= maxElements; elements *= 4)
+            {
+                uint32_t elementCount = static_cast<uint32_t>(elements);
+                if (elementCount > capacity)
+                {
+                    ReduceScanBenchmarkResult result{ elementCount, "all", "all", reduceScan.usesSubgroups() };
+                    result.skipped = "buffers larger than maxStorageBufferRange or half the device-local heap";
+                    results.push_back(result);
+                    continue;
+                }
+
+                // Filled on the transfer queue and reduced or scanned on the compute queue, shared by both families
+                vk::DeviceSize size = vk::DeviceSize(elementCount) * sizeof(uint32_t);
+                vk::BufferUsageFlags usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eTransferSrc;
+                DeviceBuffer inputBuffer = renderer.createDeviceBuffer(size, usage);
+                DeviceBuffer outputBuffer = renderer.createDeviceBuffer(size, usage);
+
+                // Small integers so the sums are easy to reason about, floats in [0, 1)
+                std::mt19937 generator(elementCount);
+                vector<uint32_t> bits(elementCount);
+                for (uint32_t& value : bits) value = static_cast<uint32_t>(int32_t(generator() % 2001) - 1000);
+                runReduceScanType<int32_t>(renderer, reduceScan, ReduceScanType::eInt, "int", bits, inputBuffer.buffer, outputBuffer.buffer, targetSeconds, results);
+                for (uint32_t& value : bits) value = generator() % 1001;
+                runReduceScanType<uint32_t>(renderer, reduceScan, ReduceScanType::eUint, "uint", bits, inputBuffer.buffer, outputBuffer.buffer, targetSeconds, results);
+                for (uint32_t& value : bits)
+                {
+                    float floatValue = std::uniform_real_distribution<float>(0.0f, 1.0f)(generator);
+                    std::memcpy(&value, &floatValue, sizeof(float));
+                }
+                runReduceScanType<float>(renderer, reduceScan, ReduceScanType::eFloat, "float", bits, inputBuffer.buffer, outputBuffer.buffer, targetSeconds, results);
+
+                renderer.destroyDeviceBuffer(inputBuffer);
+                renderer.destroyDeviceBuffer(outputBuffer);
+            }
+            reduceScan.clean();
+        }
+        writeReduceScanResults(outFileName, physicalDevice, results);
+    }
+    catch (const std::exception& e)
+    {
+        printf("ERROR: %s\n", e.what());
+        renderer.mainDevices.device.waitIdle();
+        renderer.cleanUp();
+        return EXIT_FAILURE;
+    }
+
+    cout << "Wrote " << results.size() << " reduce and scan configurations to " << outFileName << endl;
+    renderer.cleanUp();
+    return 0;
+}
+
+int runCrossoverBenchmark(VkRenderer& renderer, const char* shaderFileName, const string& outFileName, uint32_t maxElements,
+    double targetSeconds, bool nbody)
+{
+    vector<CrossoverResult> results;
+    // Largest count below which the CPU won every time, what --cpu-threshold should be
+    uint32_t crossover = 0;
+    bool gpuFaster = false;
+    try
+    {
+        for (uint64_t elements = 64; elements <= maxElements; elements *= 2)
+        {
+            CrossoverResult result = runCrossoverConfiguration(renderer, shaderFileName, static_cast<uint32_t>(elements), targetSeconds, nbody);
+            if (!result.matches)
+            {
+                cout << "The backends differ by " << result.maxDifference << " with " << elements << " elements" << endl;
+            }
+            gpuFaster = gpuFaster || result.gpuStepsPerSecond >= result.cpuStepsPerSecond;
+            if (!gpuFaster)
+            {
+                crossover = result.elements;
+            }
+            results.push_back(result);
+        }
+        writeCrossoverResults(outFileName, renderer.mainDevices.physicalDevice, results, renderer.threadPool.size(), crossover);
+    }
+    catch (const std::exception& e)
+    {
+        printf("ERROR: %s\n", e.what());
+        renderer.mainDevices.device.waitIdle();
+        renderer.cleanUp();
+        return EXIT_FAILURE;
+    }
+
+    cout << "The CPU (" << getCpuKernels().name << ", " << renderer.threadPool.size() << " threads) is faster up to " << crossover
+        << " elements, run with --cpu-threshold " << crossover << endl;
+    cout << "Wrote " << results.size() << " element counts to " << outFileName << endl;
+    renderer.cleanUp();
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    string outFileName = "benchmark_results.json";
+    const char* shaderFileName = nullptr;
+    uint32_t maxElements = 0;
+    double targetSeconds = 0.5;
+    bool nbody = false;
+    bool radixSort = false;
+    bool reduceScan = false;
+    bool cpuCrossover = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        string argument = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (argument == "--nbody") nbody = true;
+        else if (argument == "--radix-sort") radixSort = true;
+        else if (argument == "--reduce-scan") reduceScan = true;
+        else if (argument == "--cpu-crossover") cpuCrossover = true;
+        else if (argument == "--out" && hasValue) outFileName = argv[++i];
+        else if (argument == "--max-elements" && hasValue) maxElements = static_cast<uint32_t>(std::stoul(argv[++i]));
+        else if (argument == "--seconds" && hasValue) targetSeconds = std::stod(argv[++i]);
+        else if (argument == "--shader" && hasValue) shaderFileName = argv[++i];
+    }
+    if (!shaderFileName && radixSort)
+    {
+        shaderFileName = "../vulkan_compute_shader_studio/shaders/radixSort.spv";
+    }
+    if (!shaderFileName)
+    {
+        shaderFileName = nbody ? "../vulkan_compute_shader_studio/shaders/comp.spv" : "../vulkan_compute_shader_studio/shaders/copy.spv";
+    }
+    if (maxElements == 0)
+    {
+        maxElements = radixSort || reduceScan ? 64u << 20 : cpuCrossover ? (nbody ? 32768 : 4u << 20) : nbody ? 100000 : 100000000;
+    }
+
+    // Statistics only, no trace file
+    VkRenderer renderer;
+    renderer.profiler.enable();
+    if (renderer.init(nullptr) == EXIT_FAILURE) return EXIT_FAILURE;
+
+    vk::PhysicalDevice physicalDevice = renderer.mainDevices.physicalDevice;
+    vk::PhysicalDeviceLimits limits = physicalDevice.getProperties().limits;
+    vk::DeviceSize heapSize = getDeviceLocalHeapSize(physicalDevice);
+    uint32_t maxWorkgroupSize = std::min(limits.maxComputeWorkGroupSize[0], limits.maxComputeWorkGroupInvocations);
+    cout << "Benchmarking on " << physicalDevice.getProperties().deviceName << endl;
+
+    if (radixSort)
+    {
+        return runSortBenchmark(renderer, shaderFileName, outFileName, maxElements, targetSeconds, heapSize);
+    }
+    if (reduceScan)
+    {
+        return runReduceScanBenchmark(renderer, outFileName, maxElements, targetSeconds, heapSize);
+    }
+    if (cpuCrossover)
+    {
+        return runCrossoverBenchmark(renderer, shaderFileName, outFileName, maxElements, targetSeconds, nbody);
+    }
+
+    vector<BenchmarkResult> results;
+    try
+    {
+        for (uint64_t elements = 1000; elements <= maxElements; elements *= 10)
+        {
+            for (uint32_t workgroupSize : { 64u, 128u, 256u, 512u, 1024u })
+            {
+                if (workgroupSize > maxWorkgroupSize)
+                {
+                    continue;
+                }
+                uint32_t elementCount = static_cast<uint32_t>(elements);
+
+                // Leave half the heap to the driver and everything else
+                BenchmarkResult result{ elementCount, workgroupSize };
+                if (vk::DeviceSize(elementCount) * PARTICLE_FIELD_STRIDE > limits.maxStorageBufferRange)
+                {
+                    result.skipped = "state larger than maxStorageBufferRange";
+                }
+                else if (Simulation::getMemoryFootprint(elementCount, true) > heapSize / 2)
+                {
+                    result.skipped = "state ring larger than half the device-local heap";
+                }
+                else
+                {
+                    result = runConfiguration(renderer, shaderFileName, elementCount, workgroupSize, targetSeconds, nbody);
+                }
+                results.push_back(result);
+            }
+        }
+        writeResults(outFileName, physicalDevice, results);
+    }
+    catch (const std::exception& e)
+    {
+        printf("ERROR: %s\n", e.what());
+        renderer.mainDevices.device.waitIdle();
+        renderer.cleanUp();
+        return EXIT_FAILURE;
+    }
+
+    cout << "Wrote " << results.size() << " configurations to " << outFileName << endl;
+    renderer.cleanUp();
+    return 0;
+}
@@ -0,0 +1,319 @@
+#include "CpuCompute.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+// Same as particlePopulation.comp.glsl, emitted particles land where the GPU puts them
+static uint32_t hashSeed(uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+
+// In [-1, 1)
+static float signedUnit(uint32_t x)
+{
+	return float(hashSeed(x) >> 8) / float(1u << 23) - 1.0f;
+}
+
+CpuCompute::CpuCompute(ThreadPool* pThreadPool, Kernel pKernel) : threadPool{ pThreadPool }, kernel{ pKernel }
+{
+}
+
+CpuCompute::~CpuCompute()
+{
+}
+
+void CpuCompute::init(uint32_t numElements, uint32_t numStates)
+{
+	positions.assign(numStates, vector<ParticleField>(numElements, ParticleField(0.0f)));
+	velocities.assign(numElements, ParticleField(0.0f));
+	aliveLists.assign(numStates, vector<uint32_t>(numElements, 0));
+	aliveCounts.assign(numStates, 0);
+	freeList.assign(numElements, 0);
+	setInitialPopulation(0);
+}
+
+void CpuCompute::setInitialPopulation(uint32_t initialAlive)
+{
+	uint32_t numElements = static_cast<uint32_t>(velocities.size());
+	if (initialAlive > numElements)
+	{
+		throw std::runtime_error("More particles alive than slots for them.");
+	}
+	for (uint32_t slot = 0; slot < numElements; ++slot)
+	{
+		if (slot < initialAlive)
+		{
+			aliveLists[0][slot] = slot;
+		}
+		else
+		{
+			freeList[slot - initialAlive] = slot;
+		}
+	}
+	std::fill(aliveCounts.begin(), aliveCounts.end(), 0);
+	aliveCounts[0] = initialAlive;
+	freeCount = numElements - initialAlive;
+	emittedCount = 0;
+}
+
+void CpuCompute::setInitialPopulation(const void* aliveList, uint32_t aliveCount)
+{
+	uint32_t numElements = static_cast<uint32_t>(velocities.size());
+	if (aliveCount > numElements)
+	{
+		throw std::runtime_error("More particles alive than slots for them.");
+	}
+	memcpy(aliveLists[0].data(), aliveList, size_t(aliveCount) * sizeof(uint32_t));
+	vector<bool> alive(numElements, false);
+	for (uint32_t i = 0; i < aliveCount; ++i)
+	{
+		uint32_t slot = aliveLists[0][i];
+		if (slot >= numElements || alive[slot])
+		{
+			throw std::runtime_error("The alive list has a slot out of range or listed twice.");
+		}
+		alive[slot] = true;
+	}
+	freeCount = 0;
+	for (uint32_t slot = 0; slot < numElements; ++slot)
+	{
+		if (!alive[slot])
+		{
+			freeList[freeCount++] = slot;
+		}
+	}
+	std::fill(aliveCounts.begin(), aliveCounts.end(), 0);
+	aliveCounts[0] = aliveCount;
+	emittedCount = 0;
+}
+
+void CpuCompute::setIntegrationParameters(float timestep, float softening, float gravity)
+{
+	stepParameters.timestep = timestep;
+	stepParameters.softeningSquared = softening * softening;
+	stepParameters.gravity = gravity;
+}
+
+void CpuCompute::setEmitParameters(uint32_t emitPerStep, float lifetime, glm::vec3 emitterCentre, float emitterRadius)
+{
+	populationParameters.emitPerStep = emitPerStep;
+	populationParameters.emitLifetime = lifetime;
+	populationParameters.emitter = glm::vec4(emitterCentre, emitterRadius);
+}
+
+void CpuCompute::run(uint32_t num_elements, uint32_t stateIndex)
+{
+	wait(submit(num_elements, stateIndex));
+}
+
+uint64_t CpuCompute::submit(uint32_t num_elements, uint32_t stateIndex)
+{
+	if (num_elements > velocities.size())
+	{
+		throw std::runtime_error("More elements than the CPU state was initialised with.");
+	}
+	uint32_t outState = (stateIndex + 1) % static_cast<uint32_t>(positions.size());
+	uint32_t count = aliveCounts[stateIndex];
+	uint32_t blockSize = getBlockSize(count);
+	uint32_t numBlocks = (count + blockSize - 1) / blockSize;
+
+	if (kernel == Kernel::eNBody)
+	{
+		loadBodies(stateIndex, blockSize);
+	}
+	keptCounts.assign(numBlocks, 0);
+	if (released.size() < numBlocks)
+	{
+		released.resize(numBlocks);
+	}
+	// Like the workgroups, every task steps its range of the alive list and keeps its survivors
+	// together, they're packed into the next list afterwards
+	threadPool->parallelFor(numBlocks, [&](uint32_t block, uint32_t) {
+		uint32_t first = block * blockSize;
+		released[block].clear();
+		keptCounts[block] = stepBlock(stateIndex, first, std::min(count, first + blockSize), released[block]);
+	});
+	compact(stateIndex, blockSize, numBlocks);
+	emit(outState);
+	return ++stepCount;
+}
+
+uint32_t CpuCompute::getBlockSize(uint32_t count) const
+{
+	// Whole vectors per task. A few tasks per thread so uneven ones even out, but copies are so
+	// cheap per particle that they need large blocks to be worth handing out.
+	uint32_t blockSize = workgroupSize;
+	if (blockSize == 0)
+	{
+		uint32_t numTasks = threadPool->size() * 4;
+		blockSize = std::max((count + numTasks - 1) / numTasks, kernel == Kernel::eNBody ? 16u : 16384u);
+	}
+	return (blockSize + CPU_SIMD_MAX_WIDTH - 1) / CPU_SIMD_MAX_WIDTH * CPU_SIMD_MAX_WIDTH;
+}
+
+void CpuCompute::loadBodies(uint32_t stateIndex, uint32_t blockSize)
+{
+	// The alive bodies in list order as structure of arrays, so a vector of particles loads with
+	// one instruction and every body is broadcast from there. Zero mass padding up to whole vectors.
+	uint32_t count = aliveCounts[stateIndex];
+	size_t paddedCount = (count + CPU_SIMD_MAX_WIDTH - 1) / CPU_SIMD_MAX_WIDTH * CPU_SIMD_MAX_WIDTH;
+	bodyX.resize(paddedCount);
+	bodyY.resize(paddedCount);
+	bodyZ.resize(paddedCount);
+	bodyMass.resize(paddedCount);
+	const vector<ParticleField>& in = positions[stateIndex];
+	const vector<uint32_t>& aliveIn = aliveLists[stateIndex];
+	uint32_t numBlocks = (count + blockSize - 1) / blockSize;
+	threadPool->parallelFor(numBlocks, [&](uint32_t block, uint32_t) {
+		for (uint32_t i = block * blockSize; i < std::min(count, (block + 1) * blockSize); ++i)
+		{
+			const ParticleField& body = in[aliveIn[i]];
+			bodyX[i] = body.x;
+			bodyY[i] = body.y;
+			bodyZ[i] = body.z;
+			bodyMass[i] = body.w;
+		}
+	});
+	for (size_t i = count; i < paddedCount; ++i)
+	{
+		bodyX[i] = bodyY[i] = bodyZ[i] = bodyMass[i] = 0.0f;
+	}
+}
+
+uint32_t CpuCompute::stepBlock(uint32_t stateIndex, uint32_t first, uint32_t last, vector<uint32_t>& blockReleased)
+{
+	uint32_t outState = (stateIndex + 1) % static_cast<uint32_t>(positions.size());
+	const vector<ParticleField>& in = positions[stateIndex];
+	vector<ParticleField>& out = positions[outState];
+	const uint32_t* aliveIn = aliveLists[stateIndex].data();
+	// Survivors go to the block's own range of the next list, compact closes the gaps
+	uint32_t* kept = aliveLists[outState].data() + first;
+	uint32_t keptCount = 0;
+
+	if (kernel == Kernel::eCopy)
+	{
+		for (uint32_t i = first; i < last; ++i)
+		{
+			uint32_t slot = aliveIn[i];
+			out[slot] = in[slot];
+			kept[keptCount++] = slot;
+		}
+		return keptCount;
+	}
+
+	// The pulls come from the SIMD kernels a chunk of particles at a time, the rest of the shader is
+	// per particle. They're summed in alive list order, which is the shader's only on the first step:
+	// the GPU packs survivors in workgroup atomic order and compact keeps block order. Past that the
+	// sums round differently, on top of the GPU's inversesqrt and whether its compiler fuses the
+	// multiply-adds, and the results only agree within a tolerance (simulation_benchmark uses 1e-4).
+	const CpuKernels& kernels = getCpuKernels();
+	const CpuBodies bodies{ bodyX.data(), bodyY.data(), bodyZ.data(), bodyMass.data(), aliveCounts[stateIndex] };
+	const float velocityScale = stepParameters.gravity * stepParameters.timestep;
+	const uint32_t chunkSize = 64; // whole vectors of every build
+	float acceleration[3][chunkSize];
+	for (uint32_t chunk = first; chunk < last; chunk += chunkSize)
+	{
+		uint32_t chunkEnd = std::min(last, chunk + chunkSize);
+		kernels.accelerate(bodies, chunk, chunkEnd, stepParameters.softeningSquared, acceleration[0], acceleration[1], acceleration[2]);
+		for (uint32_t i = chunk; i < chunkEnd; ++i)
+		{
+			uint32_t slot = aliveIn[i];
+			ParticleField position = in[slot];
+			ParticleField velocity = velocities[slot];
+			velocity.x += velocityScale * acceleration[0][i - chunk];
+			velocity.y += velocityScale * acceleration[1][i - chunk];
+			velocity.z += velocityScale * acceleration[2][i - chunk];
+			bool survives = true;
+			if (velocity.w > 0.0f)
+			{
+				velocity.w -= stepParameters.timestep;
+				survives = velocity.w > 0.0f;
+			}
+			velocities[slot] = velocity;
+			out[slot] = ParticleField(glm::vec3(position) + stepParameters.timestep * glm::vec3(velocity), position.w);
+			if (survives)
+			{
+				kept[keptCount++] = slot;
+			}
+			else
+			{
+				blockReleased.push_back(slot);
+			}
+		}
+	}
+	return keptCount;
+}
+
+void CpuCompute::compact(uint32_t stateIndex, uint32_t blockSize, uint32_t numBlocks)
+{
+	// Nothing moves while nothing dies. Released slots go to the free list in block order, so
+	// unlike on the GPU the lists come out the same on every run.
+	uint32_t outState = (stateIndex + 1) % static_cast<uint32_t>(positions.size());
+	uint32_t* aliveOut = aliveLists[outState].data();
+	uint32_t outCount = 0;
+	for (uint32_t block = 0; block < numBlocks; ++block)
+	{
+		uint32_t first = block * blockSize;
+		if (first != outCount)
+		{
+			memmove(aliveOut + outCount, aliveOut + first, keptCounts[block] * sizeof(uint32_t));
+		}
+		outCount += keptCounts[block];
+		for (uint32_t slot : released[block])
+		{
+			freeList[freeCount++] = slot;
+		}
+	}
+	aliveCounts[outState] = outCount;
+}
+
+void CpuCompute::emit(uint32_t outState)
+{
+	// The EMIT and FINISH passes: the most recently freed slots come back first
+	uint32_t emitCount = std::min(populationParameters.emitPerStep, freeCount);
+	const glm::vec4& emitter = populationParameters.emitter;
+	for (uint32_t id = 0; id < emitCount; ++id)
+	{
+		uint32_t slot = freeList[freeCount - 1 - id];
+		uint32_t seed = hashSeed(emittedCount + id);
+		glm::vec3 offset(signedUnit(seed), signedUnit(seed + 1u), signedUnit(seed + 2u));
+		positions[outState][slot] = ParticleField(glm::vec3(emitter) + emitter.w * offset, 1.0f);
+		velocities[slot] = ParticleField(0.0f, 0.0f, 0.0f, populationParameters.emitLifetime);
+		aliveLists[outState][aliveCounts[outState] + id] = slot;
+	}
+	freeCount -= emitCount;
+	emittedCount += emitCount;
+	aliveCounts[outState] += emitCount;
+}
+
+void CpuCompute::clean()
+{
+	positions.clear();
+	velocities.clear();
+	aliveLists.clear();
+	aliveCounts.clear();
+	freeList.clear();
+	bodyX.clear();
+	bodyY.clear();
+	bodyZ.clear();
+	bodyMass.clear();
+	keptCounts.clear();
+	released.clear();
+}
+
+void CpuCompute::square(ThreadPool& threadPool, const int32_t* input, int32_t* output, uint32_t count)
+{
+	const uint32_t blockSize = 64 * 1024;
+	uint32_t numBlocks = (count + blockSize - 1) / blockSize;
+	const CpuKernels& kernels = getCpuKernels();
+	threadPool.parallelFor(numBlocks, [&](uint32_t block, uint32_t) {
+		uint32_t first = block * blockSize;
+		kernels.square(input + first, output + first, std::min(count - first, blockSize));
+	});
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include "ThreadPool.h"
+#include "CpuKernels.h"
+#include "shaders/ParticleLayout.h"
+#include "shaders/ParticlePopulation.h"
+#include <glm/glm.hpp>
+
+// Host version of VkCompute for the machines and sizes where a submission costs more than the step:
+// the same kernels on the same state layout, SIMD across the particles and split over the thread pool.
+// The state lives in host vectors instead of device buffers, and steps run to completion in submit,
+// so there is nothing to wait for.
+class CpuCompute
+{
+public:
+	// The host versions of computeShader.comp.glsl and copy.comp.glsl
+	enum class Kernel
+	{
+		eNBody,
+		eCopy
+	};
+
+	CpuCompute(ThreadPool* pThreadPool, Kernel pKernel = Kernel::eNBody);
+	~CpuCompute();
+
+	// numStates positions and alive lists, one velocity array and the free list. Every slot starts
+	// free and at the origin, fill the state with setInitialPopulation and the accessors below.
+	void init(uint32_t numElements, uint32_t numStates);
+	// The first initialAlive slots are alive in state 0, the others go to the free list
+	void setInitialPopulation(uint32_t initialAlive);
+	// The slots in aliveList are alive in state 0 in that order, the others go to the free list. The list
+	// can be unaligned, straight from a ParticleFileMapping.
+	void setInitialPopulation(const void* aliveList, uint32_t aliveCount);
+	// Steps the state stateIndex into the next one, returns the number of steps done so far
+	uint64_t submit(uint32_t num_elements, uint32_t stateIndex);
+	void wait(uint64_t) {} // submit only returns once the step is done
+	void run(uint32_t num_elements, uint32_t stateIndex);
+	void setKernel(Kernel pKernel) { kernel = pKernel; }
+	void setWorkgroupSize(uint32_t size) { workgroupSize = size; } // particles per task, 0 picks from the count and the pool size
+	uint32_t getWorkgroupSize() const { return workgroupSize; }
+	// Same parameters and defaults as VkCompute
+	void setIntegrationParameters(float timestep, float softening, float gravity);
+	void setEmitParameters(uint32_t emitPerStep, float lifetime, glm::vec3 emitterCentre, float emitterRadius);
+	void clean();
+
+	vector<ParticleField>& getPositions(uint32_t stateIndex) { return positions[stateIndex]; }
+	vector<ParticleField>& getVelocities() { return velocities; }
+	const vector<uint32_t>& getAliveList(uint32_t stateIndex) const { return aliveLists[stateIndex]; }
+	uint32_t getAliveCount(uint32_t stateIndex) const { return aliveCounts[stateIndex]; }
+
+	// Square.comp.glsl from simple_compute_exemple, output[i] = input[i] * input[i]
+	static void square(ThreadPool& threadPool, const int32_t* input, int32_t* output, uint32_t count);
+
+private:
+	ThreadPool* threadPool;
+	Kernel kernel;
+	uint32_t workgroupSize = 0;
+	StepParameters stepParameters{ 0, 0.001f, 0.05f * 0.05f, 1.0f };
+	PopulationParameters populationParameters{ 0, 0, 0, 0.0f, glm::vec4(0.0f, 0.0f, 0.0f, 0.1f) };
+	uint64_t stepCount = 0;
+
+	vector<vector<ParticleField>> positions;
+	vector<ParticleField> velocities;
+	vector<vector<uint32_t>> aliveLists;
+	vector<uint32_t> aliveCounts;
+	vector<uint32_t> freeList;
+	uint32_t freeCount = 0;
+	uint32_t emittedCount = 0; // seeds the emitted positions, as in ParticleCountersHeader
+
+	// Scratch reused between steps: the alive bodies of the read state as padded structure of arrays,
+	// and per task how many of its particles survived and which slots it released
+	vector<float> bodyX, bodyY, bodyZ, bodyMass;
+	vector<uint32_t> keptCounts;
+	vector<vector<uint32_t>> released;
+
+	uint32_t getBlockSize(uint32_t count) const;
+	void loadBodies(uint32_t stateIndex, uint32_t blockSize);
+	uint32_t stepBlock(uint32_t stateIndex, uint32_t first, uint32_t last, vector<uint32_t>& blockReleased);
+	void compact(uint32_t stateIndex, uint32_t blockSize, uint32_t numBlocks);
+	void emit(uint32_t outState);
+};
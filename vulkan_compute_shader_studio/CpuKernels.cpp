@@ -0,0 +1,46 @@
+#include "CpuSimd.h"
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
+static bool hostHasAvx2()
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	// The AVX2 feature bit, and the OS saving the YMM registers on context switches: OSXSAVE and AVX,
+	// then the SSE and AVX state bits of XCR0
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+	{
+		return false;
+	}
+	__cpuid(info, 1);
+	const int osxsaveAndAvx = (1 << 27) | (1 << 28);
+	if ((info[2] & osxsaveAndAvx) != osxsaveAndAvx || (_xgetbv(0) & 6) != 6)
+	{
+		return false;
+	}
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+	return __builtin_cpu_supports("avx2");
+#else
+	return false;
+#endif
+}
+
+static const CpuKernels& pickCpuKernels()
+{
+	const CpuKernels* avx2 = getCpuKernelsAvx2();
+	if (avx2 && hostHasAvx2())
+	{
+		return *avx2;
+	}
+	return simdKernels;
+}
+
+const CpuKernels& getCpuKernels()
+{
+	static const CpuKernels& kernels = pickCpuKernels();
+	return kernels;
+}
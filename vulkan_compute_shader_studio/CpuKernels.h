@@ -0,0 +1,37 @@
+#pragma once
+#include <cstdint>
+
+// The vector loops of CpuCompute, built once per instruction set and picked when the program starts.
+// CpuKernels.cpp has the ones the whole build targets (SSE2 on x64, NEON, or scalar), CpuKernelsAvx2.cpp
+// the AVX2 ones: only that file is compiled with /arch:AVX2, so the rest of the program still runs on
+// any x64 host and the AVX2 loops are only called when cpuid says the CPU and the OS support them.
+
+// Widest vector of any build, arrays the kernels load from are padded to a multiple of it
+const uint32_t CPU_SIMD_MAX_WIDTH = 8;
+
+// The alive bodies as structure of arrays, padded with zero mass up to CPU_SIMD_MAX_WIDTH
+struct CpuBodies
+{
+	const float* x;
+	const float* y;
+	const float* z;
+	const float* mass;
+	uint32_t count; // without the padding
+};
+
+struct CpuKernels
+{
+	const char* name; // "AVX2", "SSE2", "NEON" or "scalar"
+	uint32_t width;   // particles per vector
+	// Gravity pulled on bodies first to last by all of them, summed in the order computeShader.comp.glsl
+	// sums it. first is a multiple of width, the outputs hold last - first rounded up to width.
+	void (*accelerate)(const CpuBodies& bodies, uint32_t first, uint32_t last, float softeningSquared,
+		float* accelerationX, float* accelerationY, float* accelerationZ);
+	// output[i] = input[i] * input[i], wrapping around like GLSL's int multiply
+	void (*square)(const int32_t* input, int32_t* output, uint32_t count);
+};
+
+// The widest kernels the host can run, checked once
+const CpuKernels& getCpuKernels();
+// nullptr when the compiler couldn't build them
+const CpuKernels* getCpuKernelsAvx2();
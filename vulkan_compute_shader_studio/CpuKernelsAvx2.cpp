@@ -0,0 +1,16 @@
+// The only file built with /arch:AVX2 (-mavx2), nothing outside it may assume the host has AVX2.
+// getCpuKernels only hands these out after checking cpuid.
+#include "CpuKernels.h"
+#if defined(__AVX2__)
+#include "CpuSimd.h"
+
+const CpuKernels* getCpuKernelsAvx2()
+{
+	return &simdKernels;
+}
+#else
+const CpuKernels* getCpuKernelsAvx2()
+{
+	return nullptr;
+}
+#endif
@@ -0,0 +1,180 @@
+#pragma once
+#include "CpuKernels.h"
+#include <cstdint>
+#include <cmath>
+
+// Thin wrapper over the host's vector registers, so the CPU kernels are written once and process
+// SIMD_WIDTH elements per iteration: AVX2 when the compiler targets it (/arch:AVX2, -mavx2), SSE2 on
+// any other x64 build, NEON on 64-bit ARM, and a single lane of plain C++ everywhere else.
+// Every operation is the IEEE one, no approximations, so results only depend on the order of operations.
+// Only CpuKernels.cpp and CpuKernelsAvx2.cpp include it, each with its own instruction set, so
+// everything is in an anonymous namespace and the two builds never get mixed up by the linker.
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define CPU_SIMD_AVX2
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CPU_SIMD_SSE2
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define CPU_SIMD_NEON
+#endif
+
+namespace
+{
+#if defined(CPU_SIMD_AVX2)
+const uint32_t SIMD_WIDTH = 8;
+const char* const SIMD_NAME = "AVX2";
+
+struct SimdFloat
+{
+	__m256 value;
+	static SimdFloat load(const float* data) { return { _mm256_loadu_ps(data) }; }
+	static SimdFloat broadcast(float x) { return { _mm256_set1_ps(x) }; }
+	void store(float* data) const { _mm256_storeu_ps(data, value); }
+	friend SimdFloat operator+(SimdFloat a, SimdFloat b) { return { _mm256_add_ps(a.value, b.value) }; }
+	friend SimdFloat operator-(SimdFloat a, SimdFloat b) { return { _mm256_sub_ps(a.value, b.value) }; }
+	friend SimdFloat operator*(SimdFloat a, SimdFloat b) { return { _mm256_mul_ps(a.value, b.value) }; }
+	friend SimdFloat operator/(SimdFloat a, SimdFloat b) { return { _mm256_div_ps(a.value, b.value) }; }
+	friend SimdFloat sqrt(SimdFloat a) { return { _mm256_sqrt_ps(a.value) }; }
+};
+
+struct SimdInt
+{
+	__m256i value;
+	static SimdInt load(const int32_t* data) { return { _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data)) }; }
+	void store(int32_t* data) const { _mm256_storeu_si256(reinterpret_cast<__m256i*>(data), value); }
+	// Low 32 bits of the product, like GLSL's int multiply
+	friend SimdInt operator*(SimdInt a, SimdInt b) { return { _mm256_mullo_epi32(a.value, b.value) }; }
+};
+#elif defined(CPU_SIMD_SSE2)
+const uint32_t SIMD_WIDTH = 4;
+const char* const SIMD_NAME = "SSE2";
+
+struct SimdFloat
+{
+	__m128 value;
+	static SimdFloat load(const float* data) { return { _mm_loadu_ps(data) }; }
+	static SimdFloat broadcast(float x) { return { _mm_set1_ps(x) }; }
+	void store(float* data) const { _mm_storeu_ps(data, value); }
+	friend SimdFloat operator+(SimdFloat a, SimdFloat b) { return { _mm_add_ps(a.value, b.value) }; }
+	friend SimdFloat operator-(SimdFloat a, SimdFloat b) { return { _mm_sub_ps(a.value, b.value) }; }
+	friend SimdFloat operator*(SimdFloat a, SimdFloat b) { return { _mm_mul_ps(a.value, b.value) }; }
+	friend SimdFloat operator/(SimdFloat a, SimdFloat b) { return { _mm_div_ps(a.value, b.value) }; }
+	friend SimdFloat sqrt(SimdFloat a) { return { _mm_sqrt_ps(a.value) }; }
+};
+
+struct SimdInt
+{
+	__m128i value;
+	static SimdInt load(const int32_t* data) { return { _mm_loadu_si128(reinterpret_cast<const __m128i*>(data)) }; }
+	void store(int32_t* data) const { _mm_storeu_si128(reinterpret_cast<__m128i*>(data), value); }
+	// SSE2 has no 32 bit multiply: even and odd lanes go through the 64 bit one and are interleaved back
+	friend SimdInt operator*(SimdInt a, SimdInt b)
+	{
+		__m128i even = _mm_mul_epu32(a.value, b.value);
+		__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a.value, 32), _mm_srli_epi64(b.value, 32));
+		return { _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0))) };
+	}
+};
+#elif defined(CPU_SIMD_NEON)
+const uint32_t SIMD_WIDTH = 4;
+const char* const SIMD_NAME = "NEON";
+
+struct SimdFloat
+{
+	float32x4_t value;
+	static SimdFloat load(const float* data) { return { vld1q_f32(data) }; }
+	static SimdFloat broadcast(float x) { return { vdupq_n_f32(x) }; }
+	void store(float* data) const { vst1q_f32(data, value); }
+	friend SimdFloat operator+(SimdFloat a, SimdFloat b) { return { vaddq_f32(a.value, b.value) }; }
+	friend SimdFloat operator-(SimdFloat a, SimdFloat b) { return { vsubq_f32(a.value, b.value) }; }
+	friend SimdFloat operator*(SimdFloat a, SimdFloat b) { return { vmulq_f32(a.value, b.value) }; }
+	friend SimdFloat operator/(SimdFloat a, SimdFloat b) { return { vdivq_f32(a.value, b.value) }; }
+	friend SimdFloat sqrt(SimdFloat a) { return { vsqrtq_f32(a.value) }; }
+};
+
+struct SimdInt
+{
+	int32x4_t value;
+	static SimdInt load(const int32_t* data) { return { vld1q_s32(data) }; }
+	void store(int32_t* data) const { vst1q_s32(data, value); }
+	friend SimdInt operator*(SimdInt a, SimdInt b) { return { vmulq_s32(a.value, b.value) }; }
+};
+#else
+const uint32_t SIMD_WIDTH = 1;
+const char* const SIMD_NAME = "scalar";
+
+struct SimdFloat
+{
+	float value;
+	static SimdFloat load(const float* data) { return { *data }; }
+	static SimdFloat broadcast(float x) { return { x }; }
+	void store(float* data) const { *data = value; }
+	friend SimdFloat operator+(SimdFloat a, SimdFloat b) { return { a.value + b.value }; }
+	friend SimdFloat operator-(SimdFloat a, SimdFloat b) { return { a.value - b.value }; }
+	friend SimdFloat operator*(SimdFloat a, SimdFloat b) { return { a.value * b.value }; }
+	friend SimdFloat operator/(SimdFloat a, SimdFloat b) { return { a.value / b.value }; }
+	friend SimdFloat sqrt(SimdFloat a) { return { std::sqrt(a.value) }; }
+};
+
+struct SimdInt
+{
+	int32_t value;
+	static SimdInt load(const int32_t* data) { return { *data }; }
+	void store(int32_t* data) const { *data = value; }
+	friend SimdInt operator*(SimdInt a, SimdInt b) { return { int32_t(uint32_t(a.value) * uint32_t(b.value)) }; }
+};
+#endif
+
+static_assert(CPU_SIMD_MAX_WIDTH % SIMD_WIDTH == 0, "Padding has to be whole vectors of every build");
+
+// computeShader.comp.glsl with one particle per lane. Every particle sums the pulls in alive list
+// order with the same operations as the shader.
+void accelerate(const CpuBodies& bodies, uint32_t first, uint32_t last, float softeningSquared,
+	float* accelerationX, float* accelerationY, float* accelerationZ)
+{
+	const SimdFloat softening = SimdFloat::broadcast(softeningSquared);
+	const SimdFloat one = SimdFloat::broadcast(1.0f);
+	for (uint32_t group = first; group < last; group += SIMD_WIDTH)
+	{
+		SimdFloat x = SimdFloat::load(bodies.x + group);
+		SimdFloat y = SimdFloat::load(bodies.y + group);
+		SimdFloat z = SimdFloat::load(bodies.z + group);
+		SimdFloat sumX = SimdFloat::broadcast(0.0f);
+		SimdFloat sumY = sumX;
+		SimdFloat sumZ = sumX;
+		for (uint32_t j = 0; j < bodies.count; ++j)
+		{
+			SimdFloat deltaX = SimdFloat::broadcast(bodies.x[j]) - x;
+			SimdFloat deltaY = SimdFloat::broadcast(bodies.y[j]) - y;
+			SimdFloat deltaZ = SimdFloat::broadcast(bodies.z[j]) - z;
+			SimdFloat inverseDistance = one / sqrt(deltaX * deltaX + deltaY * deltaY + deltaZ * deltaZ + softening);
+			SimdFloat strength = SimdFloat::broadcast(bodies.mass[j]) * inverseDistance * inverseDistance * inverseDistance;
+			sumX = sumX + strength * deltaX;
+			sumY = sumY + strength * deltaY;
+			sumZ = sumZ + strength * deltaZ;
+		}
+		sumX.store(accelerationX + (group - first));
+		sumY.store(accelerationY + (group - first));
+		sumZ.store(accelerationZ + (group - first));
+	}
+}
+
+// Square.comp.glsl from simple_compute_exemple
+void square(const int32_t* input, int32_t* output, uint32_t count)
+{
+	uint32_t i = 0;
+	for (; i + SIMD_WIDTH <= count; i += SIMD_WIDTH)
+	{
+		SimdInt value = SimdInt::load(input + i);
+		(value * value).store(output + i);
+	}
+	for (; i < count; ++i)
+	{
+		output[i] = int32_t(uint32_t(input[i]) * uint32_t(input[i]));
+	}
+}
+
+const CpuKernels simdKernels = { SIMD_NAME, SIMD_WIDTH, accelerate, square };
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include "shaders/ParticleLayout.h"
+#include <cstdint>
+
+// Binary particle files, what VkSnapshotStream writes. A header, one descriptor per column, then the
+// frames: each one is a frame header followed by every column's elementCount values, in column order.
+// Everything is little endian and tightly packed, a column is one raw copy of the device buffer.
+
+const uint32_t PARTICLE_FILE_MAGIC = 0x4C435450; // "PTCL"
+const uint32_t PARTICLE_FILE_VERSION = 1;
+
+// Columns are particle fields (PARTICLE_FIELD_*, one vec4 per slot) or the alive list, one uint32 slot
+// index per entry of which the frame's aliveCount first are valid
+const uint32_t PARTICLE_FILE_COLUMN_ALIVE_LIST = 0x100;
+
+struct ParticleFileHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t elementCount;	// slots per column
+	uint32_t columnCount;
+	uint64_t frameCount;	// written when the file is closed, 0 if the writer didn't get to it: read frames until the end
+	uint64_t reserved;
+};
+static_assert(sizeof(ParticleFileHeader) == 32, "the column descriptors start at 32 bytes");
+
+struct ParticleFileColumn
+{
+	uint32_t field;		// PARTICLE_FIELD_* or PARTICLE_FILE_COLUMN_ALIVE_LIST
+	uint32_t stride;	// bytes per slot
+};
+static_assert(sizeof(ParticleFileColumn) == 8, "column descriptors are packed");
+
+struct ParticleFileFrame
+{
+	uint64_t step;			// simulation steps done when the frame was taken
+	uint32_t aliveCount;	// slots alive in the frame, all of them without an alive list column
+	uint32_t reserved;
+};
+static_assert(sizeof(ParticleFileFrame) == 16, "frame headers are packed");
+
+inline uint32_t getParticleFileColumnStride(uint32_t field)
+{
+	return field == PARTICLE_FILE_COLUMN_ALIVE_LIST ? static_cast<uint32_t>(sizeof(uint32_t)) : PARTICLE_FIELD_STRIDE;
+}
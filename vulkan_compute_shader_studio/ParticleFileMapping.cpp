@@ -0,0 +1,196 @@
+#include "ParticleFileMapping.h"
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using std::string;
+
+ParticleFileMapping::ParticleFileMapping(const char* pFileName) : fileName{ pFileName }
+{
+	map();
+	try
+	{
+		validate();
+	}
+	catch (...)
+	{
+		close();
+		throw;
+	}
+}
+
+ParticleFileMapping::~ParticleFileMapping()
+{
+	close();
+}
+
+void ParticleFileMapping::map()
+{
+#ifdef _WIN32
+	// Sequential scan lets the cache manager read ahead of the staging copies
+	HANDLE file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		throw std::runtime_error(string("Can't open particle file ") + fileName);
+	}
+	fileHandle = file;
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+	{
+		close();
+		throw std::runtime_error(string("Can't map empty particle file ") + fileName);
+	}
+	size = static_cast<size_t>(fileSize.QuadPart);
+	mappingHandle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mappingHandle)
+	{
+		data = static_cast<const char*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+	}
+#else
+	int file = open(fileName, O_RDONLY);
+	if (file < 0)
+	{
+		throw std::runtime_error(string("Can't open particle file ") + fileName);
+	}
+	struct stat fileStat;
+	if (fstat(file, &fileStat) != 0 || fileStat.st_size == 0)
+	{
+		::close(file);
+		throw std::runtime_error(string("Can't map empty particle file ") + fileName);
+	}
+	size = static_cast<size_t>(fileStat.st_size);
+	void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+	// The mapping keeps the file alive
+	::close(file);
+	if (mapping != MAP_FAILED)
+	{
+		data = static_cast<const char*>(mapping);
+		madvise(mapping, size, MADV_SEQUENTIAL);
+	}
+#endif
+	if (!data)
+	{
+		close();
+		throw std::runtime_error(string("Can't map particle file ") + fileName);
+	}
+}
+
+void ParticleFileMapping::validate()
+{
+	if (size < sizeof(ParticleFileHeader))
+	{
+		throw std::runtime_error(string(fileName) + " is too small to be a particle file");
+	}
+	header = reinterpret_cast<const ParticleFileHeader*>(data);
+	if (header->magic != PARTICLE_FILE_MAGIC || header->version != PARTICLE_FILE_VERSION)
+	{
+		throw std::runtime_error(string(fileName) + " isn't a version " + std::to_string(PARTICLE_FILE_VERSION) + " particle file");
+	}
+	framesOffset = sizeof(ParticleFileHeader) + size_t(header->columnCount) * sizeof(ParticleFileColumn);
+	if (size < framesOffset)
+	{
+		throw std::runtime_error(string(fileName) + " is truncated in its column descriptors");
+	}
+	columns = reinterpret_cast<const ParticleFileColumn*>(data + sizeof(ParticleFileHeader));
+
+	// The simulation's buffers are filled with raw copies, the columns have to be laid out the same
+	frameSize = sizeof(ParticleFileFrame);
+	for (uint32_t i = 0; i < header->columnCount; ++i)
+	{
+		if (columns[i].stride != getParticleFileColumnStride(columns[i].field))
+		{
+			throw std::runtime_error(string(fileName) + ": column " + std::to_string(i) + " has a stride of " + std::to_string(columns[i].stride)
+				+ " bytes, " + std::to_string(getParticleFileColumnStride(columns[i].field)) + " expected");
+		}
+		columnOffsets.push_back(frameSize);
+		frameSize += size_t(header->elementCount) * columns[i].stride;
+	}
+
+	uint64_t completeFrames = (size - framesOffset) / frameSize;
+	frameCount = header->frameCount > 0 ? header->frameCount : completeFrames;
+	if (frameCount == 0 || frameCount > completeFrames)
+	{
+		throw std::runtime_error(string(fileName) + " holds " + std::to_string(completeFrames) + " complete frames, "
+			+ std::to_string(header->frameCount) + " in the header");
+	}
+}
+
+bool ParticleFileMapping::hasColumn(uint32_t field) const
+{
+	for (uint32_t i = 0; i < header->columnCount; ++i)
+	{
+		if (columns[i].field == field)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+ParticleFileFrame ParticleFileMapping::getFrame(uint64_t frameIndex) const
+{
+	ParticleFileFrame frame;
+	memcpy(&frame, getFrameData(frameIndex), sizeof(frame));
+	return frame;
+}
+
+const void* ParticleFileMapping::getColumn(uint64_t frameIndex, uint32_t field) const
+{
+	const char* frame = getFrameData(frameIndex);
+	for (uint32_t i = 0; i < header->columnCount; ++i)
+	{
+		if (columns[i].field == field)
+		{
+			return frame + columnOffsets[i];
+		}
+	}
+	return nullptr;
+}
+
+const char* ParticleFileMapping::getFrameData(uint64_t frameIndex) const
+{
+	if (frameIndex >= frameCount)
+	{
+		throw std::runtime_error(string(fileName) + " has no frame " + std::to_string(frameIndex));
+	}
+	return data + framesOffset + frameIndex * frameSize;
+}
+
+void ParticleFileMapping::close()
+{
+#ifdef _WIN32
+	if (data)
+	{
+		UnmapViewOfFile(data);
+	}
+	if (mappingHandle)
+	{
+		CloseHandle(mappingHandle);
+	}
+	if (fileHandle)
+	{
+		CloseHandle(fileHandle);
+	}
+	mappingHandle = nullptr;
+	fileHandle = nullptr;
+#else
+	if (data)
+	{
+		munmap(const_cast<char*>(data), size);
+	}
+#endif
+	data = nullptr;
+	header = nullptr;
+	columns = nullptr;
+	size = 0;
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include "ParticleFile.h"
+#include <cstddef>
+#include <vector>
+
+using std::vector;
+
+// Read-only memory mapping of a particle file (ParticleFile.h), to start a simulation from it. The
+// columns are pointers straight into the mapping, so they can be handed to VkStagingRing::upload and
+// the only copy is the one into the staging buffer, paged in from disk as the copy goes.
+class ParticleFileMapping
+{
+public:
+	// Maps the whole file and checks the header, the column descriptors and the size against each other
+	explicit ParticleFileMapping(const char* fileName);
+	~ParticleFileMapping();
+	ParticleFileMapping(const ParticleFileMapping&) = delete;
+	ParticleFileMapping& operator=(const ParticleFileMapping&) = delete;
+
+	uint32_t getElementCount() const { return header->elementCount; }
+	// The header's count, or as many complete frames as the file holds when it wasn't closed properly
+	uint64_t getFrameCount() const { return frameCount; }
+	bool hasColumn(uint32_t field) const;
+	ParticleFileFrame getFrame(uint64_t frameIndex) const;
+	// elementCount values of getParticleFileColumnStride(field) bytes, nullptr if the file doesn't have the column.
+	// An alive list column with an odd element count leaves the next ones 4 byte aligned only, memcpy from them.
+	const void* getColumn(uint64_t frameIndex, uint32_t field) const;
+	// Drops the mapping, the pointers above are invalid afterwards
+	void close();
+
+private:
+	const char* fileName;
+	const char* data = nullptr;
+	size_t size = 0;
+#ifdef _WIN32
+	void* fileHandle = nullptr;
+	void* mappingHandle = nullptr;
+#endif
+	const ParticleFileHeader* header = nullptr;
+	const ParticleFileColumn* columns = nullptr;
+	vector<size_t> columnOffsets; // from the frame header, per column
+	size_t framesOffset = 0;
+	size_t frameSize = 0;
+	uint64_t frameCount = 0;
+
+	const char* getFrameData(uint64_t frameIndex) const;
+	void map();
+	void validate();
+};
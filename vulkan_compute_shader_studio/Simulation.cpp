@@ -1,13 +1,19 @@
 #include "Simulation.h"
 #include <iostream>
 #include <fstream>
+#include <chrono>
+#include <cstring>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
 
 using std::cout;
 using std::endl;
 
 
-Simulation::Simulation(VkRenderer* pRenderer, const char* pShaderFileName) :renderer{ pRenderer },
-shaderFileName{ pShaderFileName }
+Simulation::Simulation(VkRenderer* pRenderer, const char* pShaderFileName, uint32_t pNumElements, const char* pPopulationFileName,
+	const char* pSpatialHashFileName) :numElements{ pNumElements }, shaderFileName{ pShaderFileName },
+populationShaderFileName{ pPopulationFileName }, spatialHashShaderFileName{ pSpatialHashFileName }, renderer{ pRenderer }
 {
 
 }
@@ -18,149 +24,600 @@ Simulation::~Simulation()
 
 void Simulation::init()
 {
-
+	if (initialState)
+	{
+		checkInitialState();
+	}
+	if (initialAlive > numElements)
+	{
+		throw std::runtime_error("More particles alive than slots for them.");
+	}
+	onCpu = numElements <= cpuThreshold;
+	if (onCpu && sortInterval > 0)
+	{
+		cout << "The spatial hash sort only runs on the GPU, the particles stepped on the CPU are not reordered" << endl;
+		sortInterval = 0;
+	}
 	createBuffer();
 	allocateBufferMemory();
-	bindBuffers();
-	populateInBuffer();
-
-	vk::DescriptorBufferInfo inBufferInfo = getDescriptorBufferInfo(inBuffer);
-	vk::DescriptorBufferInfo outBufferInfo = getDescriptorBufferInfo(outBuffer);
-	compute.init(inBufferInfo, outBufferInfo);
-
-	uint32_t stride = sizeof(Vertex);
-	size_t offsetPos = offsetof(Vertex, pos);
-	size_t offsetCol = offsetof(Vertex, color);
-	uint32_t verticesSize = static_cast<uint32_t>(vertices.size());
+	drawnValues.assign(numStates, 0);
+
+	vector<vk::DescriptorBufferInfo> stateBufferInfos;
+	vector<vk::DescriptorBufferInfo> aliveBufferInfos;
+	for (uint32_t i = 0; i < numStates; ++i)
+	{
+		stateBufferInfos.push_back(getDescriptorBufferInfo(stateBuffers[i]));
+		aliveBufferInfos.push_back({ aliveBuffers[i], 0, VK_WHOLE_SIZE });
+	}
+	if (onCpu)
+	{
+		cpuCompute.setEmitParameters(emitPerStep, emitLifetime, glm::vec3(0.0f), 0.05f);
+		populateCpuState();
+		cout << "Stepping " << numElements << " elements on the CPU (" << getCpuKernels().name << ", " << renderer->threadPool.size() << " threads)" << endl;
+	}
+	else
+	{
+		compute.setEmitParameters(emitPerStep, emitLifetime, glm::vec3(0.0f), 0.05f);
+		compute.init(stateBufferInfos, getDescriptorBufferInfo(velocityBuffer), aliveBufferInfos, { freeListBuffer, 0, VK_WHOLE_SIZE },
+			{ countersBuffer, 0, VK_WHOLE_SIZE });
+		// The initial indirect arguments depend on the workgroup size compute picked
+		populateInBuffer();
+	}
+	if (sortInterval > 0)
+	{
+		// About one particle per cell, as far as two scan levels of the compute workgroup size allow
+		uint32_t workgroupSize = compute.getWorkgroupSize();
+		spatialHash.init(numElements, std::min(numElements, workgroupSize * workgroupSize), sortCellSize, workgroupSize);
+	}
 
-	graphics.init(vertexBuffer, stride, offsetPos, offsetCol, verticesSize);
+	if (!renderer->headless)
+	{
+		graphics.init(stateBuffers, colorBuffer, aliveBuffers, countersBuffer);
+	}
+	if (snapshotInterval > 0 && snapshotFileName)
+	{
+		snapshots.init(snapshotFileName, numElements, { PARTICLE_FIELD_POSITION, PARTICLE_FIELD_VELOCITY, PARTICLE_FILE_COLUMN_ALIVE_LIST });
+	}
 
 
 }
 
 void Simulation::run()
 {
-	compute.run(numElements);
-	graphics.draw();
-	updateBuffers(); //breaks
+	VkProfiler::CpuScope cpuScope(renderer->profiler, "Simulation::run");
+	// The state this step writes was last drawn numStates frames ago, only that frame has to be done.
+	// Both waits happen on the GPU, the host just queues the work.
+	uint32_t readState = static_cast<uint32_t>(frameCount % numStates);
+	uint32_t writeState = (readState + 1) % numStates;
+	if (onCpu)
+	{
+		cpuCompute.submit(numElements, readState);
+		snapshotIfDue(writeState);
+		// The upload overwrites what the frame numStates ago drew, that one is long done unless the GPU is far behind
+		if (drawnValues[writeState] > 0)
+		{
+			renderer->waitTimelineSemaphore(graphics.getTimeline(), drawnValues[writeState]);
+		}
+		// The staging queue runs its copies in order, waiting on this one covers the initial colors too
+		uint64_t uploadValue = uploadCpuState(writeState);
+		pendingUploadValue = 0;
+		drawnValues[writeState] = graphics.draw(writeState, { stagingRing.getTimeline(), uploadValue,
+			vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eVertexShader });
+		++frameCount;
+		renderer->profiler.collect();
+		return;
+	}
+	vector<TimelineWait> computeWaits;
+	if (drawnValues[writeState] > 0)
+	{
+		// The step starts by clearing the count that frame drew with
+		computeWaits.push_back({ graphics.getTimeline(), drawnValues[writeState], vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eTransfer });
+	}
+	addPendingUploadWait(computeWaits);
+	sortIfDue(readState, computeWaits);
+
+	uint64_t computeValue = compute.submit(numElements, readState, computeWaits);
+	lastComputeValue = computeValue;
+	snapshotIfDue(writeState);
+	drawnValues[writeState] = graphics.draw(writeState, { compute.getTimeline(), computeValue,
+		vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eVertexShader });
+	++frameCount;
+	renderer->profiler.collect();
+}
+
+Simulation::HeadlessTimings Simulation::runHeadless(uint32_t numSteps)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	double submitSeconds = 0.0;
+	uint64_t lastValue = 0;
+	for (uint32_t step = 0; step < numSteps; ++step)
+	{
+		auto submitStart = std::chrono::high_resolution_clock::now();
+		uint32_t readState = static_cast<uint32_t>(frameCount % numStates);
+		if (onCpu)
+		{
+			// Done by the time it returns, the submit time is the step time
+			cpuCompute.submit(numElements, readState);
+		}
+		else
+		{
+			vector<TimelineWait> computeWaits;
+			addPendingUploadWait(computeWaits);
+			sortIfDue(readState, computeWaits);
+			lastValue = compute.submit(numElements, readState, computeWaits);
+			lastComputeValue = lastValue;
+		}
+		snapshotIfDue((readState + 1) % numStates);
+		++frameCount;
+		submitSeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - submitStart).count();
+		renderer->profiler.collect();
+	}
+	if (!onCpu)
+	{
+		compute.wait(lastValue);
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+
+	double seconds = std::chrono::duration<double>(end - start).count();
+	cout << "Headless run: " << numSteps << " steps of " << numElements << " elements in " << seconds << "s ("
+		<< numSteps / seconds << " steps/s)" << endl;
+	return { numSteps, seconds, submitSeconds };
 }
 
 void Simulation::close()
 {
-	
-	renderer->mainDevices.device.destroyBuffer(inBuffer);
-	renderer->mainDevices.device.destroyBuffer(outBuffer);
+	renderer->mainDevices.device.waitIdle();
+	if (snapshotInterval > 0 && snapshotFileName)
+	{
+		snapshots.clean();
+	}
+	for (uint32_t i = 0; i < numStates; ++i)
+	{
+		renderer->mainDevices.device.destroyBuffer(stateBuffers[i]);
+		renderer->allocator.free(stateBufferAllocations[i]);
+	}
+	renderer->mainDevices.device.destroyBuffer(velocityBuffer);
+	renderer->allocator.free(velocityBufferAllocation);
+	for (uint32_t i = 0; i < numStates; ++i)
+	{
+		renderer->mainDevices.device.destroyBuffer(aliveBuffers[i]);
+		renderer->allocator.free(aliveBufferAllocations[i]);
+	}
+	renderer->mainDevices.device.destroyBuffer(freeListBuffer);
+	renderer->allocator.free(freeListBufferAllocation);
+	renderer->mainDevices.device.destroyBuffer(countersBuffer);
+	renderer->allocator.free(countersBufferAllocation);
+	if (colorBuffer)
+	{
+		renderer->mainDevices.device.destroyBuffer(colorBuffer);
+		renderer->allocator.free(colorBufferAllocation);
+	}
 
-	renderer->mainDevices.device.freeMemory(inBufferMemory);
-	renderer->mainDevices.device.freeMemory(outBufferMemory);
+	stagingRing.clean();
+	if (sortInterval > 0)
+	{
+		spatialHash.clean();
+	}
+	if (onCpu)
+	{
+		cpuCompute.clean();
+	}
+	else
+	{
+		compute.clean();
+	}
+	if (!renderer->headless)
+	{
+		graphics.clean();
+	}
+
+}
+
+vector<ParticleField> Simulation::readPositions()
+{
+	// The last step wrote this state, or nothing has run yet and it holds the initial upload
+	uint32_t state = static_cast<uint32_t>(frameCount % numStates);
+	if (onCpu)
+	{
+		return cpuCompute.getPositions(state);
+	}
+	compute.wait(lastComputeValue);
+	if (pendingUploadValue > 0)
+	{
+		stagingRing.wait(pendingUploadValue);
+	}
 
-	compute.clean();
-	graphics.clean();
-	renderer->mainDevices.device.destroyBuffer(vertexBuffer);
-	renderer->mainDevices.device.freeMemory(vertexBufferMemory);
-	renderer->cleanUp();
+	// One-off copy into host-visible memory, it just waits on a fence
+	vk::Device device = renderer->mainDevices.device;
+	vk::Buffer readbackBuffer = device.createBuffer(vk::BufferCreateInfo(vk::BufferCreateFlags(), bufferSize, vk::BufferUsageFlagBits::eTransferDst));
+	Allocation readbackAllocation = renderer->allocator.allocateBuffer(readbackBuffer, MemoryUsage::eReadback);
+	vk::CommandPool commandPool = device.createCommandPool(vk::CommandPoolCreateInfo(vk::CommandPoolCreateFlags(), renderer->queueFamilyIndices.computeFamily));
+	vk::CommandBuffer commandBuffer = device.allocateCommandBuffers(vk::CommandBufferAllocateInfo(commandPool, vk::CommandBufferLevel::ePrimary, 1)).front();
+
+	commandBuffer.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+	vk::MemoryBarrier writeBarrier(vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eTransferRead);
+	commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer,
+		vk::DependencyFlags(), writeBarrier, {}, {});
+	commandBuffer.copyBuffer(stateBuffers[state], readbackBuffer, vk::BufferCopy(0, 0, bufferSize));
+	vk::MemoryBarrier hostBarrier(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eHostRead);
+	commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost, vk::DependencyFlags(), hostBarrier, {}, {});
+	commandBuffer.end();
+
+	vk::Fence fence = device.createFence(vk::FenceCreateInfo());
+	renderer->computeQueue.submit(vk::SubmitInfo(0, nullptr, nullptr, 1, &commandBuffer), fence);
+	if (device.waitForFences(fence, VK_TRUE, UINT64_MAX) != vk::Result::eSuccess)
+	{
+		throw std::runtime_error("Failed to wait for the readback copy.");
+	}
+	renderer->allocator.invalidate(readbackAllocation);
+	HostSpan<ParticleField> mapped = readbackAllocation.as<ParticleField>();
+	vector<ParticleField> positions(mapped.begin(), mapped.begin() + numElements);
+
+	device.destroyFence(fence);
+	device.destroyCommandPool(commandPool);
+	device.destroyBuffer(readbackBuffer);
+	renderer->allocator.free(readbackAllocation);
+	return positions;
+}
 
+vk::DeviceSize Simulation::getMemoryFootprint(uint32_t elementCount, bool headless)
+{
+	uint32_t numBuffers = headless ? numStates + 1 : numStates + 2;
+	// Plus an alive list per state and the free list, one slot index per element
+	return numBuffers * vk::DeviceSize(elementCount) * PARTICLE_FIELD_STRIDE
+		+ (numStates + 1) * vk::DeviceSize(elementCount) * sizeof(uint32_t) + getParticleCountersOffset(numStates);
+}
+
+vk::DeviceSize Simulation::getBytesPerStep(uint32_t elementCount)
+{
+	return 2 * vk::DeviceSize(elementCount) * (PARTICLE_FIELD_STRIDE + sizeof(uint32_t));
 }
 
 void Simulation::createBuffer()
 {
-	vk::BufferCreateInfo inBufferCreateInfo{
+	// Compute writes a state while the previous one is drawn, if graphics or uploads live in another
+	// queue family they use it at the same time so the buffers are shared instead of transferred
+	vector<uint32_t> queueFamilies = renderer->getQueueFamilies();
+	bool concurrent = queueFamilies.size() > 1;
+
+	vk::BufferCreateInfo stateBufferCreateInfo{
 		vk::BufferCreateFlags(),
 		bufferSize,
-		vk::BufferUsageFlagBits::eStorageBuffer,
-		vk::SharingMode::eExclusive,
-		1,
-		&renderer->queueFamilyIndices.computeFamily
+		vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eTransferSrc,
+		concurrent ? vk::SharingMode::eConcurrent : vk::SharingMode::eExclusive,
+		concurrent ? static_cast<uint32_t>(queueFamilies.size()) : 1u,
+		queueFamilies.data()
 	};
 
-	vk::BufferCreateInfo outBufferCreateInfo{
-	vk::BufferCreateFlags(),
-	bufferSize,
-	vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eVertexBuffer,
-	vk::SharingMode::eExclusive,
-	1,
-	& renderer->queueFamilyIndices.computeFamily
-	};
+	for (uint32_t i = 0; i < numStates; ++i)
+	{
+		stateBuffers.push_back(renderer->mainDevices.device.createBuffer(stateBufferCreateInfo));
+	}
 
-	vk::BufferCreateInfo vertexBufferInfo{};
-	vertexBufferInfo.sType = vk::StructureType::eBufferCreateInfo;
-	vertexBufferInfo.size = bufferSize;
-	vertexBufferInfo.usage = vk::BufferUsageFlagBits::eVertexBuffer;
-	vertexBufferInfo.sharingMode = vk::SharingMode::eExclusive;
+	vk::BufferCreateInfo velocityBufferCreateInfo = stateBufferCreateInfo;
+	velocityBufferCreateInfo.usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eTransferSrc;
+	velocityBuffer = renderer->mainDevices.device.createBuffer(velocityBufferCreateInfo);
 
-	vertexBuffer = renderer->mainDevices.device.createBuffer(vertexBufferInfo);
-	inBuffer = renderer->mainDevices.device.createBuffer(inBufferCreateInfo);
-	outBuffer = renderer->mainDevices.device.createBuffer(outBufferCreateInfo);
+	// Colors are only there to be drawn
+	if (!renderer->headless)
+	{
+		vk::BufferCreateInfo colorBufferCreateInfo = stateBufferCreateInfo;
+		colorBufferCreateInfo.usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst;
+		colorBuffer = renderer->mainDevices.device.createBuffer(colorBufferCreateInfo);
+	}
+
+	// The draws read the alive lists too, and take their instance counts from the counters
+	vk::BufferCreateInfo aliveBufferCreateInfo = stateBufferCreateInfo;
+	aliveBufferCreateInfo.size = vk::DeviceSize(numElements) * sizeof(uint32_t);
+	for (uint32_t i = 0; i < numStates; ++i)
+	{
+		aliveBuffers.push_back(renderer->mainDevices.device.createBuffer(aliveBufferCreateInfo));
+	}
+	freeListBuffer = renderer->mainDevices.device.createBuffer(aliveBufferCreateInfo);
+	vk::BufferCreateInfo countersBufferCreateInfo = stateBufferCreateInfo;
+	countersBufferCreateInfo.size = getParticleCountersOffset(numStates);
+	countersBufferCreateInfo.usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer | vk::BufferUsageFlagBits::eTransferDst
+		| vk::BufferUsageFlagBits::eTransferSrc;
+	countersBuffer = renderer->mainDevices.device.createBuffer(countersBufferCreateInfo);
 
 }
 
 void Simulation::allocateBufferMemory()
 {
-	vk::MemoryRequirements inBufferMemoryRequirements = renderer->mainDevices.device.getBufferMemoryRequirements(inBuffer);
-	vk::MemoryRequirements outBufferMemoryRequirements = renderer->mainDevices.device.getBufferMemoryRequirements(outBuffer);
-	vk::MemoryRequirements vertexBufferMemoryRequirements = renderer->mainDevices.device.getBufferMemoryRequirements(vertexBuffer);
-
-	vk::PhysicalDeviceMemoryProperties memoryProperties = renderer->mainDevices.physicalDevice.getMemoryProperties();
-
-	uint32_t memoryTypeIndex = uint32_t(~0);
-	vk::DeviceSize memoryHeapSize = uint32_t(~0);
+	// Only the GPU touches the state, the initial data comes in through the staging ring
+	for (uint32_t i = 0; i < numStates; ++i)
+	{
+		stateBufferAllocations.push_back(renderer->allocator.allocateBuffer(stateBuffers[i], MemoryUsage::eGpuOnly));
+	}
+	velocityBufferAllocation = renderer->allocator.allocateBuffer(velocityBuffer, MemoryUsage::eGpuOnly);
+	if (colorBuffer)
+	{
+		colorBufferAllocation = renderer->allocator.allocateBuffer(colorBuffer, MemoryUsage::eGpuOnly);
+	}
+	for (uint32_t i = 0; i < numStates; ++i)
+	{
+		aliveBufferAllocations.push_back(renderer->allocator.allocateBuffer(aliveBuffers[i], MemoryUsage::eGpuOnly));
+	}
+	freeListBufferAllocation = renderer->allocator.allocateBuffer(freeListBuffer, MemoryUsage::eGpuOnly);
+	countersBufferAllocation = renderer->allocator.allocateBuffer(countersBuffer, MemoryUsage::eGpuOnly);
+	renderer->allocator.printStatistics();
+}
 
-	for (uint32_t currentMemoryTypeIndex = 0; currentMemoryTypeIndex < memoryProperties.memoryTypeCount; ++currentMemoryTypeIndex) {
-		vk::MemoryType memoryType = memoryProperties.memoryTypes[currentMemoryTypeIndex];
-		if ((vk::MemoryPropertyFlagBits::eHostVisible & memoryType.propertyFlags) && (vk::MemoryPropertyFlagBits::eHostCoherent & memoryType.propertyFlags)) {
-			memoryHeapSize = memoryProperties.memoryHeaps[memoryType.heapIndex].size;
-			memoryTypeIndex = currentMemoryTypeIndex;
-			break;
+void Simulation::populateInBuffer()
+{
+	stagingRing.init();
+	if (initialState)
+	{
+		uploadFileState();
+	}
+	else
+	{
+		uploadRepeated(stateBuffers.front(), initialPositions);
+		uploadRepeated(velocityBuffer, { ParticleField(0.0f) });
+		if (colorBuffer)
+		{
+			uploadRepeated(colorBuffer, initialColors);
 		}
+		// The first initialAlive slots are alive in state 0, the rest free
+		uploadSlots(aliveBuffers.front(), 0, initialAlive);
+		uploadSlots(freeListBuffer, initialAlive, numElements - initialAlive);
 	}
 
-	vk::MemoryAllocateInfo inBufferMemoryAllocateInfo(inBufferMemoryRequirements.size, memoryTypeIndex);
-	vk::MemoryAllocateInfo outBufferMemoryAllocataInfo(outBufferMemoryRequirements.size, memoryTypeIndex);
-	vk::MemoryAllocateInfo vertexBufferMemoryAllocataInfo(outBufferMemoryRequirements.size, memoryTypeIndex);
+	// The other states' lists are written by the steps before anything reads them, only their
+	// counters need the constant fields.
+	vector<uint8_t> counters(getParticleCountersOffset(numStates), 0);
+	ParticleCountersHeader header{ numElements - initialAlive, 0, {0, 0} };
+	memcpy(counters.data(), &header, sizeof(header));
+	for (uint32_t i = 0; i < numStates; ++i)
+	{
+		ParticleCounters stateCounters = makeParticleCounters(i == 0 ? initialAlive : 0, compute.getWorkgroupSize());
+		memcpy(counters.data() + getParticleCountersOffset(i), &stateCounters, sizeof(stateCounters));
+	}
+	stagingRing.upload(countersBuffer, 0, counters.data(), counters.size());
+	pendingUploadValue = stagingRing.flush();
+}
 
-	inBufferMemory = renderer->mainDevices.device.allocateMemory(inBufferMemoryAllocateInfo);
-	outBufferMemory = renderer->mainDevices.device.allocateMemory(outBufferMemoryAllocataInfo);
-	vertexBufferMemory = renderer->mainDevices.device.allocateMemory(vertexBufferMemoryAllocataInfo);
+void Simulation::populateCpuState()
+{
+	// The state lives on the host, the GPU only gets the colors here and each drawn state after its step
+	cpuCompute.init(numElements, numStates);
+	vector<ParticleField>& positions = cpuCompute.getPositions(0);
+	const void* fileColors = nullptr;
+	if (initialState)
+	{
+		memcpy(positions.data(), initialState->getColumn(initialStateFrame, PARTICLE_FIELD_POSITION), bufferSize);
+		if (const void* velocities = initialState->getColumn(initialStateFrame, PARTICLE_FIELD_VELOCITY))
+		{
+			memcpy(cpuCompute.getVelocities().data(), velocities, bufferSize);
+		}
+		if (const void* aliveList = initialState->getColumn(initialStateFrame, PARTICLE_FILE_COLUMN_ALIVE_LIST))
+		{
+			cpuCompute.setInitialPopulation(aliveList, initialAlive);
+		}
+		else
+		{
+			cpuCompute.setInitialPopulation(initialAlive);
+		}
+		fileColors = initialState->getColumn(initialStateFrame, PARTICLE_FIELD_COLOR);
+	}
+	else
+	{
+		cpuCompute.setInitialPopulation(initialAlive);
+		for (uint32_t i = 0; i < numElements; ++i)
+		{
+			positions[i] = initialPositions[i % initialPositions.size()];
+		}
+	}
+	stagingRing.init();
+	if (colorBuffer)
+	{
+		if (fileColors)
+		{
+			stagingRing.upload(colorBuffer, 0, fileColors, bufferSize);
+		}
+		else
+		{
+			uploadRepeated(colorBuffer, initialColors);
+		}
+		pendingUploadValue = stagingRing.flush();
+	}
 }
 
-void Simulation::bindBuffers()
+void Simulation::checkInitialState()
 {
-	renderer->mainDevices.device.bindBufferMemory(inBuffer, inBufferMemory, 0);
-	renderer->mainDevices.device.bindBufferMemory(outBuffer, outBufferMemory, 0);
-	renderer->mainDevices.device.bindBufferMemory(vertexBuffer, vertexBufferMemory, 0);
+	if (initialState->getElementCount() != numElements)
+	{
+		throw std::runtime_error("The simulation has " + std::to_string(numElements) + " elements, its initial state "
+			+ std::to_string(initialState->getElementCount()));
+	}
+	if (!initialState->hasColumn(PARTICLE_FIELD_POSITION))
+	{
+		throw std::runtime_error("The initial state has no positions.");
+	}
+	// Without an alive list every slot is alive
+	initialAlive = initialState->hasColumn(PARTICLE_FILE_COLUMN_ALIVE_LIST) ? initialState->getFrame(initialStateFrame).aliveCount : numElements;
 }
 
-void Simulation::populateInBuffer()
+void Simulation::uploadFileState()
 {
-	
-	inBufferPtr = static_cast<float*>(renderer->mainDevices.device.mapMemory(inBufferMemory, 0,bufferSize));
+	// Straight from the mapping into the staging ring, the pages are read from disk as the copies go
+	// and never land anywhere else on the host
+	stagingRing.upload(stateBuffers.front(), 0, initialState->getColumn(initialStateFrame, PARTICLE_FIELD_POSITION), bufferSize);
+	if (const void* velocities = initialState->getColumn(initialStateFrame, PARTICLE_FIELD_VELOCITY))
+	{
+		stagingRing.upload(velocityBuffer, 0, velocities, bufferSize);
+	}
+	else
+	{
+		uploadRepeated(velocityBuffer, { ParticleField(0.0f) });
+	}
+	if (colorBuffer)
+	{
+		if (const void* colors = initialState->getColumn(initialStateFrame, PARTICLE_FIELD_COLOR))
+		{
+			stagingRing.upload(colorBuffer, 0, colors, bufferSize);
+		}
+		else
+		{
+			uploadRepeated(colorBuffer, initialColors);
+		}
+	}
 
-	memcpy(inBufferPtr, vertices.data(), bufferSize);
-	renderer->mainDevices.device.unmapMemory(inBufferMemory);
+	const void* aliveList = initialState->getColumn(initialStateFrame, PARTICLE_FILE_COLUMN_ALIVE_LIST);
+	if (!aliveList)
+	{
+		uploadSlots(aliveBuffers.front(), 0, numElements);
+		return;
+	}
+	if (initialAlive > 0)
+	{
+		stagingRing.upload(aliveBuffers.front(), 0, aliveList, vk::DeviceSize(initialAlive) * sizeof(uint32_t));
+	}
+	uploadFreeSlots(aliveList);
+}
+
+void Simulation::uploadFreeSlots(const void* aliveList)
+{
+	// Every slot the alive list doesn't have, in order, a chunk at a time like uploadSlots
+	vector<bool> alive(numElements, false);
+	for (uint32_t i = 0; i < initialAlive; ++i)
+	{
+		uint32_t slot;
+		memcpy(&slot, static_cast<const char*>(aliveList) + size_t(i) * sizeof(uint32_t), sizeof(slot));
+		if (slot >= numElements || alive[slot])
+		{
+			throw std::runtime_error("The alive list has a slot out of range or listed twice.");
+		}
+		alive[slot] = true;
+	}
+	const uint32_t chunkSlots = 64 * 1024;
+	vector<uint32_t> chunk;
+	uint32_t uploaded = 0;
+	for (uint32_t slot = 0; slot < numElements; ++slot)
+	{
+		if (!alive[slot])
+		{
+			chunk.push_back(slot);
+		}
+		if (chunk.size() == chunkSlots || (slot + 1 == numElements && !chunk.empty()))
+		{
+			stagingRing.upload(freeListBuffer, vk::DeviceSize(uploaded) * sizeof(uint32_t), chunk.data(), vk::DeviceSize(chunk.size()) * sizeof(uint32_t));
+			uploaded += static_cast<uint32_t>(chunk.size());
+			chunk.clear();
+		}
+	}
+}
 
+uint64_t Simulation::uploadCpuState(uint32_t state)
+{
+	uint32_t aliveCount = cpuCompute.getAliveCount(state);
+	stagingRing.upload(stateBuffers[state], 0, cpuCompute.getPositions(state).data(), bufferSize);
+	if (aliveCount > 0)
+	{
+		stagingRing.upload(aliveBuffers[state], 0, cpuCompute.getAliveList(state).data(), vk::DeviceSize(aliveCount) * sizeof(uint32_t));
+	}
+	// Only the draw arguments are read, nothing dispatches from these
+	ParticleCounters counters = makeParticleCounters(aliveCount, 1);
+	stagingRing.upload(countersBuffer, getParticleCountersOffset(state), &counters, sizeof(counters));
+	return stagingRing.flush();
+}
 
-	vertexBufferPtr = static_cast<float*>(renderer->mainDevices.device.mapMemory(vertexBufferMemory, 0, bufferSize));
-	memcpy(vertexBufferPtr, inBufferPtr, bufferSize);
-	renderer->mainDevices.device.unmapMemory(vertexBufferMemory);
+void Simulation::uploadRepeated(vk::Buffer buffer, const vector<ParticleField>& pattern)
+{
+	// Large element counts repeat the pattern, uploaded a chunk at a time. The chunk size is a
+	// multiple of the pattern size so every chunk starts at the first element of the pattern.
+	const uint32_t chunkElements = static_cast<uint32_t>(64 * 1024 / pattern.size() * pattern.size());
+	vector<ParticleField> chunk;
+	for (uint32_t i = 0; i < std::min(numElements, chunkElements); ++i)
+	{
+		chunk.push_back(pattern[i % pattern.size()]);
+	}
+	for (uint32_t first = 0; first < numElements; first += chunkElements)
+	{
+		uint32_t count = std::min(chunkElements, numElements - first);
+		stagingRing.upload(buffer, vk::DeviceSize(first) * PARTICLE_FIELD_STRIDE, chunk.data(), vk::DeviceSize(count) * PARTICLE_FIELD_STRIDE);
+	}
+}
 
+void Simulation::uploadSlots(vk::Buffer buffer, uint32_t firstSlot, uint32_t count)
+{
+	// Consecutive slot indices, a chunk at a time like uploadRepeated
+	const uint32_t chunkSlots = 64 * 1024;
+	vector<uint32_t> chunk;
+	for (uint32_t first = 0; first < count; first += chunkSlots)
+	{
+		chunk.clear();
+		for (uint32_t i = first; i < std::min(count, first + chunkSlots); ++i)
+		{
+			chunk.push_back(firstSlot + i);
+		}
+		stagingRing.upload(buffer, vk::DeviceSize(first) * sizeof(uint32_t), chunk.data(), vk::DeviceSize(chunk.size()) * sizeof(uint32_t));
+	}
 }
 
-vk::DescriptorBufferInfo Simulation::getDescriptorBufferInfo(vk::Buffer buffer)
+void Simulation::addPendingUploadWait(vector<TimelineWait>& waits)
 {
-	vk::DescriptorBufferInfo bufferInfo(buffer, 0, numElements * sizeof(Vertex));
-	return bufferInfo;
+	// The first step reads what the staging ring copied, later ones are ordered behind it on the compute timeline
+	if (pendingUploadValue > 0)
+	{
+		// Indirect arguments included, and the step clears a count next to the uploaded ones
+		waits.push_back({ stagingRing.getTimeline(), pendingUploadValue,
+			vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eTransfer });
+		pendingUploadValue = 0;
+	}
 }
 
-void Simulation::updateBuffers()
+void Simulation::sortIfDue(uint32_t readState, vector<TimelineWait>& waits)
 {
-	inBufferPtr = static_cast<float*>(renderer->mainDevices.device.mapMemory(inBufferMemory, 0, bufferSize));
-	outBufferPtr = static_cast<float*>(renderer->mainDevices.device.mapMemory(outBufferMemory, 0, bufferSize));
-	vertexBufferPtr = static_cast<float*>(renderer->mainDevices.device.mapMemory(vertexBufferMemory, 0, bufferSize));
+	if (sortInterval == 0 || frameCount == 0 || frameCount % sortInterval != 0)
+	{
+		return;
+	}
+	// Reorders the state the step is about to read, with velocities and colors so particles keep theirs.
+	// The state was written by the last step, and colors and other states may still be drawn: every
+	// frame queued so far has to be done before they move.
+	vector<TimelineWait> sortWaits = { { compute.getTimeline(), lastComputeValue, vk::PipelineStageFlagBits::eComputeShader } };
+	uint64_t lastDrawnValue = *std::max_element(drawnValues.begin(), drawnValues.end());
+	if (lastDrawnValue > 0)
+	{
+		sortWaits.push_back({ graphics.getTimeline(), lastDrawnValue, vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eTransfer });
+	}
+	vector<vk::DescriptorBufferInfo> fields = { getDescriptorBufferInfo(velocityBuffer) };
+	if (colorBuffer)
+	{
+		fields.push_back(getDescriptorBufferInfo(colorBuffer));
+	}
+	// The slots move too, so the lists of them follow: the read state's alive list and the free list
+	vk::DescriptorBufferInfo countersInfo{ countersBuffer, 0, VK_WHOLE_SIZE };
+	uint32_t aliveCountIndex = static_cast<uint32_t>((getParticleCountersOffset(readState) + offsetof(ParticleCounters, aliveCount)) / sizeof(uint32_t));
+	vector<VkSpatialHash::RemapList> remapLists = {
+		{ { aliveBuffers[readState], 0, VK_WHOLE_SIZE }, countersInfo, aliveCountIndex },
+		{ { freeListBuffer, 0, VK_WHOLE_SIZE }, countersInfo, offsetof(ParticleCountersHeader, freeCount) / sizeof(uint32_t) } };
+	uint64_t sortValue = spatialHash.submit(numElements, getDescriptorBufferInfo(stateBuffers[readState]), fields, remapLists, sortWaits);
+	waits.push_back({ spatialHash.getTimeline(), sortValue, vk::PipelineStageFlagBits::eComputeShader });
+}
 
-	memcpy(inBufferPtr, outBufferPtr, bufferSize);
-	memcpy(vertexBufferPtr, inBufferPtr, bufferSize);
+void Simulation::snapshotIfDue(uint32_t writeState)
+{
+	// Right after the step that wrote the state, frameCount steps were done before it
+	uint64_t step = frameCount + 1;
+	if (snapshotInterval == 0 || !snapshotFileName || step % snapshotInterval != 0)
+	{
+		return;
+	}
+	if (onCpu)
+	{
+		snapshots.capture(step, { cpuCompute.getPositions(writeState).data(), cpuCompute.getVelocities().data(), cpuCompute.getAliveList(writeState).data() },
+			cpuCompute.getAliveCount(writeState));
+		return;
+	}
+	// Queued on the compute queue behind the step, the next step waits for the copies before it touches velocities
+	vk::DeviceSize aliveCountOffset = getParticleCountersOffset(writeState) + offsetof(ParticleCounters, aliveCount);
+	snapshots.capture(step, { stateBuffers[writeState], velocityBuffer, aliveBuffers[writeState] }, countersBuffer, aliveCountOffset);
+}
 
-	renderer->mainDevices.device.unmapMemory(inBufferMemory);
-	renderer->mainDevices.device.unmapMemory(outBufferMemory);
-	renderer->mainDevices.device.unmapMemory(vertexBufferMemory);
+vk::DescriptorBufferInfo Simulation::getDescriptorBufferInfo(vk::Buffer buffer)
+{
+	vk::DescriptorBufferInfo bufferInfo(buffer, 0, bufferSize);
+	return bufferInfo;
 }
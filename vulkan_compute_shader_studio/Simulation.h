@@ -2,57 +2,143 @@
 #include "VkRenderer.h"
 #include "VkGraphics.h"
 #include "VkCompute.h"
+#include "VkStagingRing.h"
+#include "VkSpatialHash.h"
+#include "CpuCompute.h"
+#include "VkSnapshotStream.h"
+#include "ParticleFileMapping.h"
+#include "shaders/ParticleLayout.h"
 #include <glm/glm.hpp>
 #include <array>
 #include <algorithm>
 class Simulation
 {
 public:
-	Simulation(VkRenderer* pRenderer, const char* pFileName);
+	Simulation(VkRenderer* pRenderer, const char* pFileName, uint32_t pNumElements = 3,
+		const char* pPopulationFileName = "shaders/particlePopulation.spv", const char* pSpatialHashFileName = "shaders/spatialHash.spv");
 	~Simulation();
 
+	struct HeadlessTimings
+	{
+		uint32_t steps;
+		double seconds;			// first submit to last step done
+		double submitSeconds;	// host time spent queuing the steps
+	};
+
+	void setWorkgroupSize(uint32_t size) { compute.setWorkgroupSize(size); } // before init, 0 picks one for the device
+	uint32_t getWorkgroupSize() const { return compute.getWorkgroupSize(); }
+	void setIntegrationParameters(float timestep, float softening, float gravity)
+	{
+		compute.setIntegrationParameters(timestep, softening, gravity);
+		cpuCompute.setIntegrationParameters(timestep, softening, gravity);
+	}
+	// Before init. Up to maxElements the steps run on the host with kernel, the CPU version of the shader
+	// given to the constructor, and only what is drawn is uploaded. 0 always uses the GPU.
+	void setCpuThreshold(uint32_t maxElements, CpuCompute::Kernel kernel = CpuCompute::Kernel::eNBody) { cpuThreshold = maxElements; cpuCompute.setKernel(kernel); }
+	bool runsOnCpu() const { return onCpu; }
+	// Before init. Every interval steps the positions, velocities and alive list are streamed to fileName
+	// (ParticleFile.h) from a background thread, frames the disk can't keep up with are dropped.
+	void setSnapshots(const char* fileName, uint32_t interval) { snapshotFileName = fileName; snapshotInterval = interval; }
+	// Before init. Every interval steps the particles are reordered by grid cell, 0 never sorts.
+	void setSortInterval(uint32_t interval, float cellSize = 0.1f) { sortInterval = interval; sortCellSize = cellSize; }
+	// Before init. numElements is the number of slots: the first initialAlive start alive and never die,
+	// emitPerStep free ones are brought back every step around the origin and live for lifetime seconds.
+	void setParticleSize(float size) { graphics.setParticleSize(size); } // before init, half a quad's side in NDC
+	void setPopulation(uint32_t pInitialAlive, uint32_t pEmitPerStep, float pLifetime) { initialAlive = pInitialAlive; emitPerStep = pEmitPerStep; emitLifetime = pLifetime; }
+	uint32_t getInitialAlive() const { return initialAlive; } // after init it counts a loaded alive list
+	// Before init. Starts from a frame of a particle file instead of initialPositions, uploaded straight from
+	// the mapping, which has to outlive init. numElements is the file's element count, and its alive list
+	// (every slot without one) replaces setPopulation's initialAlive. Missing velocities are zero, missing
+	// colors initialColors.
+	void setInitialState(const ParticleFileMapping* file, uint64_t frameIndex = 0) { initialState = file; initialStateFrame = frameIndex; }
 	void init();
 	void run();
-	void close();
-
-	struct Vertex {
-		glm::vec3 pos;
-		glm::vec3 color;
-	};
+	HeadlessTimings runHeadless(uint32_t numSteps);
+	void close(); // the renderer is left alive, it can host another simulation
+	// Blocking copy of the positions of the last state written, to check results. Slots that aren't
+	// alive in it hold whatever they had last.
+	vector<ParticleField> readPositions();
 
-	const uint32_t numElements = 3;
+	const uint32_t numElements;
+	// Device memory taken by the particle buffers for a given element count, colors included when drawn
+	static vk::DeviceSize getMemoryFootprint(uint32_t elementCount, bool headless);
+	// Bytes a step reads and writes with every slot alive, positions and alive lists in and out
+	static vk::DeviceSize getBytesPerStep(uint32_t elementCount);
 
-	const std::vector<Vertex> vertices = {
-	{{0.0, -0.4, 0.0}, {1.0, 0.0, 0.0}},
-	{{0.4, 0.4, 0.0}, {0.0, 1.0, 0.0}},
-	{{-0.4, 0.4, 0.0}, {0.0, 0.0, 1.0}}
+	// Initial state, repeated over the elements when there are more of them. Position w is the mass.
+	const std::vector<ParticleField> initialPositions = {
+	{0.0, -0.4, 0.0, 1.0},
+	{0.4, 0.4, 0.0, 1.0},
+	{-0.4, 0.4, 0.0, 1.0}
+	};
+	const std::vector<ParticleField> initialColors = {
+	{1.0, 0.0, 0.0, 1.0},
+	{0.0, 1.0, 0.0, 1.0},
+	{0.0, 0.0, 1.0, 1.0}
 	};
 private:
 
 	const char* shaderFileName;
+	const char* populationShaderFileName;
+	const char* spatialHashShaderFileName;
 	VkRenderer* renderer;
-	VkCompute compute{ renderer, shaderFileName };
+	VkCompute compute{ renderer, shaderFileName, populationShaderFileName };
+	CpuCompute cpuCompute{ &renderer->threadPool };
+	uint32_t cpuThreshold = 0; // opt in, the crossover depends on the machine (simulation_benchmark --cpu-crossover)
+	bool onCpu = false;
 	VkGraphics graphics{ renderer};
+	VkStagingRing stagingRing{ renderer };
+	uint64_t pendingUploadValue = 0; // staging timeline value the first step has to wait for
+	VkSnapshotStream snapshots{ renderer };
+	const char* snapshotFileName = nullptr;
+	uint32_t snapshotInterval = 0;
+	VkSpatialHash spatialHash{ renderer, spatialHashShaderFileName };
+	uint32_t sortInterval = 0;
+	float sortCellSize = 0.1f;
+	uint64_t lastComputeValue = 0;
+	uint32_t initialAlive = numElements;
+	const ParticleFileMapping* initialState = nullptr;
+	uint64_t initialStateFrame = 0;
+	uint32_t emitPerStep = 0;
+	float emitLifetime = 0.0f;
 
-	const uint32_t bufferSize = numElements * sizeof(Vertex);
+	const vk::DeviceSize bufferSize = vk::DeviceSize(numElements) * PARTICLE_FIELD_STRIDE; // one field
 
-	vk::Buffer inBuffer;
-	vk::DeviceMemory inBufferMemory;
-	float* inBufferPtr = nullptr;
-	vk::Buffer outBuffer;
-	vk::DeviceMemory outBufferMemory;
-	float* outBufferPtr = nullptr;
+	// Ring of simulation states: step k reads state k and writes state k + 1, which is then drawn.
+	// One more state than frames in flight, so a step never writes a state that's still being drawn.
+	// Only the positions ping-pong: velocities are updated in place and colors never change.
+	static const uint32_t numStates = MAX_FRAME_DRAWS + 1;
+	vector<vk::Buffer> stateBuffers;
+	vector<Allocation> stateBufferAllocations;
+	vk::Buffer velocityBuffer;
+	Allocation velocityBufferAllocation;
+	vk::Buffer colorBuffer;
+	Allocation colorBufferAllocation;
+	// Particles keep their slot for life. Every state has the list of slots alive in it, the free list
+	// holds the others, and the counters buffer their lengths and the indirect arguments (ParticlePopulation.h).
+	vector<vk::Buffer> aliveBuffers;
+	vector<Allocation> aliveBufferAllocations;
+	vk::Buffer freeListBuffer;
+	Allocation freeListBufferAllocation;
+	vk::Buffer countersBuffer;
+	Allocation countersBufferAllocation;
 
-	vk::Buffer vertexBuffer;
-	vk::DeviceMemory vertexBufferMemory;
-	float* vertexBufferPtr = nullptr;
+	vector<uint64_t> drawnValues; // graphics timeline value of the last frame that drew each state
+	uint64_t frameCount = 0;
 
 	//init
 	void createBuffer();
 	void allocateBufferMemory();
-	void bindBuffers();
 	void populateInBuffer();
+	void uploadRepeated(vk::Buffer buffer, const vector<ParticleField>& pattern);
+	void uploadSlots(vk::Buffer buffer, uint32_t firstSlot, uint32_t count);
+	void checkInitialState();
+	void uploadFileState();
+	void uploadFreeSlots(const void* aliveList);
+	void populateCpuState();
+	uint64_t uploadCpuState(uint32_t state);
+	void addPendingUploadWait(vector<TimelineWait>& waits);
+	void sortIfDue(uint32_t readState, vector<TimelineWait>& waits);
+	void snapshotIfDue(uint32_t writeState);
 	vk::DescriptorBufferInfo getDescriptorBufferInfo(vk::Buffer buffer);
-	void updateBuffers();
 };
-
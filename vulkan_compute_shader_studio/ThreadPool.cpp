@@ -0,0 +1,102 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(uint32_t numThreads)
+{
+	if (numThreads == 0)
+	{
+		numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+	}
+	for (uint32_t thread = 1; thread < numThreads; ++thread)
+	{
+		workers.emplace_back(&ThreadPool::workerLoop, this, thread);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+}
+
+void ThreadPool::parallelFor(uint32_t count, const std::function<void(uint32_t index, uint32_t thread)>& pTask)
+{
+	// Not worth waking anyone for a single task
+	if (workers.empty() || count <= 1)
+	{
+		for (uint32_t index = 0; index < count; ++index)
+		{
+			pTask(index, 0);
+		}
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		task = &pTask;
+		taskCount = count;
+		nextIndex = 0;
+		exception = nullptr;
+		busyWorkers = static_cast<uint32_t>(workers.size());
+		++generation;
+	}
+	wake.notify_all();
+	runTasks(0);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	done.wait(lock, [this]() { return busyWorkers == 0; });
+	task = nullptr;
+	if (exception)
+	{
+		std::rethrow_exception(exception);
+	}
+}
+
+void ThreadPool::workerLoop(uint32_t thread)
+{
+	uint64_t seenGeneration = 0;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [&]() { return stopping || generation != seenGeneration; });
+			if (stopping)
+			{
+				return;
+			}
+			seenGeneration = generation;
+		}
+		runTasks(thread);
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--busyWorkers == 0)
+		{
+			done.notify_one();
+		}
+	}
+}
+
+void ThreadPool::runTasks(uint32_t thread)
+{
+	for (uint32_t index = nextIndex++; index < taskCount; index = nextIndex++)
+	{
+		try
+		{
+			(*task)(index, thread);
+		}
+		catch (...)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!exception)
+			{
+				exception = std::current_exception();
+			}
+		}
+	}
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <exception>
+
+using std::vector;
+
+// Fixed set of worker threads for fork-join work on the host. The calling thread takes part as
+// thread 0, so a pool of one thread runs everything inline. Only one parallelFor at a time.
+class ThreadPool
+{
+public:
+	// 0 takes every hardware thread
+	explicit ThreadPool(uint32_t numThreads = 0);
+	~ThreadPool();
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// Calling thread included, thread indices passed to the tasks are below this
+	uint32_t size() const { return static_cast<uint32_t>(workers.size()) + 1; }
+	// Runs task(index, thread) for every index below count and returns once they're all done. Indices
+	// are handed out one at a time, and the first exception a task throws is rethrown here.
+	void parallelFor(uint32_t count, const std::function<void(uint32_t index, uint32_t thread)>& task);
+
+private:
+	vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	bool stopping = false;
+	uint64_t generation = 0; // bumped for every parallelFor, wakes the workers
+	uint32_t busyWorkers = 0;
+
+	const std::function<void(uint32_t, uint32_t)>* task = nullptr;
+	uint32_t taskCount = 0;
+	std::atomic<uint32_t> nextIndex{ 0 };
+	std::exception_ptr exception;
+
+	void workerLoop(uint32_t thread);
+	void runTasks(uint32_t thread);
+};
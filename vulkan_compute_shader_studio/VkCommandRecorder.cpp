@@ -0,0 +1,117 @@
+#include "VkCommandRecorder.h"
+
+VkCommandRecorder::VkCommandRecorder(VkRenderer* pRenderer): renderer{pRenderer}
+{
+}
+
+VkCommandRecorder::~VkCommandRecorder()
+{
+}
+
+void VkCommandRecorder::init(uint32_t pQueueFamily, uint32_t numFrames)
+{
+	queueFamily = pQueueFamily;
+	frames.resize(numFrames);
+	for (Frame& frame : frames)
+	{
+		frame.primary = createCommandPool();
+		for (uint32_t thread = 0; thread < renderer->threadPool.size(); ++thread)
+		{
+			frame.threads.push_back(createCommandPool());
+		}
+	}
+}
+
+void VkCommandRecorder::beginFrame(uint32_t frame)
+{
+	currentFrame = frame;
+	Frame& current = frames[currentFrame];
+	renderer->mainDevices.device.resetCommandPool(current.primary.pool);
+	current.primary.used = 0;
+	for (CommandPool& commandPool : current.threads)
+	{
+		if (commandPool.used > 0)
+		{
+			renderer->mainDevices.device.resetCommandPool(commandPool.pool);
+			commandPool.used = 0;
+		}
+	}
+}
+
+vk::CommandBuffer VkCommandRecorder::record(const vector<RecordFunction>& passes, const vk::RenderPassBeginInfo* renderPassBegin,
+	const VkProfiler::GpuScope& gpuScope)
+{
+	VkProfiler::CpuScope cpuScope(renderer->profiler, "VkCommandRecorder::record");
+	Frame& frame = frames[currentFrame];
+
+	vk::CommandBufferInheritanceInfo inheritanceInfo{};
+	vk::CommandBufferUsageFlags secondaryUsage = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+	if (renderPassBegin)
+	{
+		inheritanceInfo.renderPass = renderPassBegin->renderPass;
+		inheritanceInfo.subpass = 0;
+		inheritanceInfo.framebuffer = renderPassBegin->framebuffer;
+		secondaryUsage |= vk::CommandBufferUsageFlagBits::eRenderPassContinue;
+	}
+
+	// Each thread allocates from and records into its own pool, so pools need no locking
+	vector<vk::CommandBuffer> secondaries(passes.size());
+	renderer->threadPool.parallelFor(static_cast<uint32_t>(passes.size()), [&](uint32_t pass, uint32_t thread) {
+		vk::CommandBuffer secondary = getCommandBuffer(frame.threads[thread], vk::CommandBufferLevel::eSecondary);
+		secondary.begin(vk::CommandBufferBeginInfo(secondaryUsage, &inheritanceInfo));
+		passes[pass](secondary);
+		secondary.end();
+		secondaries[pass] = secondary;
+	});
+
+	vk::CommandBuffer primary = getCommandBuffer(frame.primary, vk::CommandBufferLevel::ePrimary);
+	primary.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+	gpuScope.begin(primary);
+	if (renderPassBegin)
+	{
+		primary.beginRenderPass(*renderPassBegin, vk::SubpassContents::eSecondaryCommandBuffers);
+	}
+	if (!secondaries.empty())
+	{
+		primary.executeCommands(secondaries);
+	}
+	if (renderPassBegin)
+	{
+		primary.endRenderPass();
+	}
+	gpuScope.end(primary);
+	primary.end();
+	return primary;
+}
+
+void VkCommandRecorder::clean()
+{
+	for (Frame& frame : frames)
+	{
+		renderer->mainDevices.device.destroyCommandPool(frame.primary.pool);
+		for (CommandPool& commandPool : frame.threads)
+		{
+			renderer->mainDevices.device.destroyCommandPool(commandPool.pool);
+		}
+	}
+	frames.clear();
+}
+
+VkCommandRecorder::CommandPool VkCommandRecorder::createCommandPool()
+{
+	// Transient: everything is recorded once, submitted once and thrown away with the pool reset
+	vk::CommandPoolCreateInfo commandPoolInfo(vk::CommandPoolCreateFlagBits::eTransient, queueFamily);
+	CommandPool commandPool;
+	commandPool.pool = renderer->mainDevices.device.createCommandPool(commandPoolInfo);
+	return commandPool;
+}
+
+vk::CommandBuffer VkCommandRecorder::getCommandBuffer(CommandPool& commandPool, vk::CommandBufferLevel level)
+{
+	if (commandPool.used == commandPool.commandBuffers.size())
+	{
+		vk::CommandBufferAllocateInfo commandBufferAllocateInfo(commandPool.pool, level, 1);
+		commandPool.commandBuffers.push_back(renderer->mainDevices.device.allocateCommandBuffers(commandBufferAllocateInfo).front());
+	}
+	return commandPool.commandBuffers[commandPool.used++];
+}
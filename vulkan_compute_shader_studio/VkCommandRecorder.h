@@ -0,0 +1,50 @@
+#pragma once
+#include "VkRenderer.h"
+#include "ThreadPool.h"
+#include <functional>
+
+// Records the passes of a submission in parallel. Every frame in flight has one command pool per
+// thread of the renderer's thread pool, each pass goes into a secondary command buffer of the
+// thread that records it, and a primary command buffer then executes them in order. Command
+// buffers are never reset one by one: beginFrame resets the frame's pools and reuses them all.
+class VkCommandRecorder
+{
+public:
+	using RecordFunction = std::function<void(vk::CommandBuffer)>;
+
+	VkCommandRecorder(VkRenderer* pRenderer);
+	~VkCommandRecorder();
+
+	void init(uint32_t pQueueFamily, uint32_t numFrames);
+	// The GPU has to be done with what was recorded for this frame last time
+	void beginFrame(uint32_t frame);
+	// Records one secondary per pass and the primary executing them. Passes run on any thread and in
+	// any order, so they only touch their command buffer, and each one binds its own pipeline,
+	// descriptor sets and push constants. With renderPassBegin they all run inside that render pass, and
+	// gpuScope's timestamps go into the primary around the passes, render pass included.
+	vk::CommandBuffer record(const vector<RecordFunction>& passes, const vk::RenderPassBeginInfo* renderPassBegin = nullptr,
+		const VkProfiler::GpuScope& gpuScope = VkProfiler::GpuScope());
+	void clean();
+
+private:
+	VkRenderer* renderer;
+	uint32_t queueFamily = 0;
+
+	// Handles survive the pool resets, the first used buffers of a pool are handed out again
+	struct CommandPool
+	{
+		vk::CommandPool pool;
+		vector<vk::CommandBuffer> commandBuffers;
+		uint32_t used = 0;
+	};
+	struct Frame
+	{
+		CommandPool primary;
+		vector<CommandPool> threads; // indexed by ThreadPool thread
+	};
+	vector<Frame> frames;
+	uint32_t currentFrame = 0;
+
+	CommandPool createCommandPool();
+	vk::CommandBuffer getCommandBuffer(CommandPool& commandPool, vk::CommandBufferLevel level);
+};
@@ -1,10 +1,13 @@
 #include "VkCompute.h"
+#include <cstring>
+#include <cstddef>
 
 VkCompute::VkCompute()
 {
 }
 
-VkCompute::VkCompute(VkRenderer* pRenderer, const char* pFileName): renderer{pRenderer}, shaderFileName{pFileName}
+VkCompute::VkCompute(VkRenderer* pRenderer, const char* pFileName, const char* pPopulationFileName): renderer{pRenderer}, shaderFileName{pFileName},
+populationShaderFileName{pPopulationFileName}
 {
 
 }
@@ -13,131 +16,292 @@ VkCompute::~VkCompute()
 {
 }
 
-void VkCompute::init(vk::DescriptorBufferInfo inBufferInfo, vk::DescriptorBufferInfo outBufferInfo)
+void VkCompute::init(const vector<vk::DescriptorBufferInfo>& stateBufferInfos, const vk::DescriptorBufferInfo& velocityBufferInfo,
+	const vector<vk::DescriptorBufferInfo>& aliveBufferInfos, const vk::DescriptorBufferInfo& freeListBufferInfo,
+	const vk::DescriptorBufferInfo& countersBufferInfo)
 {
+	stateBuffers = stateBufferInfos;
+	velocityBuffer = velocityBufferInfo;
+	aliveBuffers = aliveBufferInfos;
+	freeListBuffer = freeListBufferInfo;
+	countersBuffer = countersBufferInfo;
 	computeShader.load_compute_shader(renderer);
+	populationShader.load_compute_shader(renderer);
+	chooseWorkgroupSize();
 	createDescriptorSetLayout();
 	createComputePipeline();
-	createDescriptorSet(inBufferInfo, outBufferInfo);
-	createCommandBuffer();
+	createDescriptorSets();
+	createCommandPool();
+	timeline = renderer->createTimelineSemaphore();
 }
 
-void VkCompute::run(uint32_t num_elements)
+uint64_t VkCompute::submit(uint32_t num_elements, uint32_t stateIndex, const vector<TimelineWait>& waits)
 {
-	recordCommands( num_elements);
-	submitWork();
+	// The timestamps go inside the dispatch's own command buffer, waits for the previous state aren't timed
+	VkProfiler::GpuScope gpuScope = renderer->profiler.beginGpuScope("compute dispatch", renderer->queueFamilyIndices.computeFamily,
+		vk::PipelineStageFlagBits::eComputeShader);
+	CachedCommandBuffer& cached = getCommandBuffer(num_elements, stateIndex, gpuScope);
+	submitWork(cached.commandBuffer, waits);
+	cached.lastSubmitValue = timelineValue;
+	return timelineValue;
+}
+
+void VkCompute::wait(uint64_t value)
+{
+	renderer->waitTimelineSemaphore(timeline, value);
+}
+
+void VkCompute::setIntegrationParameters(float timestep, float softening, float gravity)
+{
+	stepParameters.timestep = timestep;
+	stepParameters.softeningSquared = softening * softening;
+	stepParameters.gravity = gravity;
+}
+
+void VkCompute::setEmitParameters(uint32_t emitPerStep, float lifetime, glm::vec3 emitterCentre, float emitterRadius)
+{
+	populationParameters.emitPerStep = emitPerStep;
+	populationParameters.emitLifetime = lifetime;
+	populationParameters.emitter = glm::vec4(emitterCentre, emitterRadius);
+}
+
+void VkCompute::run(uint32_t num_elements, uint32_t stateIndex)
+{
+	wait(submit(num_elements, stateIndex));
 }
 
 void VkCompute::clean()
 {
+	renderer->mainDevices.device.destroySemaphore(timeline);
 	renderer->mainDevices.device.resetCommandPool(commandPool);
-	renderer->mainDevices.device.destroyDescriptorSetLayout(descriptorSetLayout);
-	renderer->mainDevices.device.destroyPipelineLayout(pipelineLayout);
 	computeShader.cleanUp(renderer);
+	populationShader.cleanUp(renderer);
 	renderer->mainDevices.device.destroyPipeline(computePipeline);
-	renderer->mainDevices.device.destroyDescriptorPool(descriptorPool);
+	renderer->mainDevices.device.destroyPipeline(emitPipeline);
+	renderer->mainDevices.device.destroyPipeline(finishPipeline);
+	descriptors.clean();
 	renderer->mainDevices.device.destroyCommandPool(commandPool);
 
 }
 
+void VkCompute::chooseWorkgroupSize()
+{
+	vk::PhysicalDeviceLimits limits = renderer->mainDevices.physicalDevice.getProperties().limits;
+	uint32_t maxSize = std::min(limits.maxComputeWorkGroupSize[0], limits.maxComputeWorkGroupInvocations);
+	if (workgroupSize == 0)
+	{
+		// 256 invocations keeps a few subgroups per workgroup on every vendor, as long as it's
+		// a whole number of subgroups so none of them run partially empty
+		auto propertiesChain = renderer->mainDevices.physicalDevice.getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceSubgroupProperties>();
+		uint32_t subgroupSize = std::max(propertiesChain.get<vk::PhysicalDeviceSubgroupProperties>().subgroupSize, 1u);
+		workgroupSize = std::max(std::min(256u, maxSize) / subgroupSize * subgroupSize, subgroupSize);
+	}
+	workgroupSize = std::min(workgroupSize, maxSize);
+}
+
 void VkCompute::createDescriptorSetLayout()
 {
 
 	const std::vector<vk::DescriptorSetLayoutBinding> DescriptorSetLayoutBinding = {
-		{0, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute},
-		{1, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute} };
+		{PARTICLE_BINDING_POSITION_IN, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute},
+		{PARTICLE_BINDING_POSITION_OUT, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute},
+		{PARTICLE_BINDING_VELOCITY, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute},
+		{PARTICLE_BINDING_ALIVE_IN, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute},
+		{PARTICLE_BINDING_ALIVE_OUT, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute},
+		{PARTICLE_BINDING_FREE_LIST, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute},
+		{PARTICLE_BINDING_COUNTERS, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute} };
 
-	vk::DescriptorSetLayoutCreateInfo descriptorSetLayoutInfo(
-		vk::DescriptorSetLayoutCreateFlags(),
-		DescriptorSetLayoutBinding);
-	descriptorSetLayout = renderer->mainDevices.device.createDescriptorSetLayout(descriptorSetLayoutInfo);
+	descriptorSetLayout = renderer->descriptorCache.getSetLayout(DescriptorSetLayoutBinding);
 
 }
 
 void VkCompute::createComputePipeline()
 {
-	vk::PipelineLayoutCreateInfo pipelineLayoutCreateInfo(
-		vk::PipelineLayoutCreateFlags(),
-		descriptorSetLayout
-	);
-	pipelineLayout = renderer->mainDevices.device.createPipelineLayout(pipelineLayoutCreateInfo);
-	vk::PipelineCache pipelineCache = renderer->mainDevices.device.createPipelineCache(vk::PipelineCacheCreateInfo());
+	// The element count, integration and emit parameters are pushed with every dispatch
+	vk::PushConstantRange pushConstantRange(vk::ShaderStageFlagBits::eCompute, 0, sizeof(StepParameters) + sizeof(PopulationParameters));
+	pipelineLayout = renderer->descriptorCache.getPipelineLayout({ descriptorSetLayout }, { pushConstantRange });
 
-
-
-	vk::PipelineShaderStageCreateInfo pipelineShaderInfo(
-		vk::PipelineShaderStageCreateFlags(),
-		vk::ShaderStageFlagBits::eCompute,
-		computeShader.shaderModule,
-		"main");
-
-	vk::ComputePipelineCreateInfo computePipelineInfo(
-		vk::PipelineCreateFlags(),
-		pipelineShaderInfo,
-		pipelineLayout);
-	computePipeline = renderer->mainDevices.device.createComputePipeline(pipelineCache, computePipelineInfo).value;
-	renderer->mainDevices.device.destroyPipelineCache(pipelineCache);
+	computePipeline = computeShader.createPipeline(renderer, pipelineLayout, { workgroupSize });
+	emitPipeline = populationShader.createPipeline(renderer, pipelineLayout, { workgroupSize, PARTICLE_POPULATION_EMIT });
+	finishPipeline = populationShader.createPipeline(renderer, pipelineLayout, { workgroupSize, PARTICLE_POPULATION_FINISH });
 }
 
-void VkCompute::createDescriptorSet(vk::DescriptorBufferInfo inBufferInfo, vk::DescriptorBufferInfo outBufferInfo)
+void VkCompute::createDescriptorSets()
 {
-	vk::DescriptorPoolSize descriptorPoolSize(vk::DescriptorType::eStorageBuffer, 2);
-	vk::DescriptorPoolCreateInfo DescriptorPoolInfo(vk::DescriptorPoolCreateFlags(), 1, descriptorPoolSize);
-	descriptorPool = renderer->mainDevices.device.createDescriptorPool(DescriptorPoolInfo);
-
-	vk::DescriptorSetAllocateInfo descriptorAllocateInfo(descriptorPool, 1, &descriptorSetLayout);
-	const std::vector<vk::DescriptorSet> descriptorSets = renderer->mainDevices.device.allocateDescriptorSets(descriptorAllocateInfo);
-	descriptorSet = descriptorSets.front();
+	// Written once and kept, the cached command buffers bind them
+	uint32_t numSets = static_cast<uint32_t>(stateBuffers.size());
+	descriptors.init(0, numSets);
+	descriptorSets = descriptors.allocate(descriptorSetLayout, numSets);
 
-
-
-	const std::vector<vk::WriteDescriptorSet> writeDescriptorSets = {
-		{descriptorSet, 0, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &inBufferInfo},
-		{descriptorSet, 1, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &outBufferInfo}
-	};
-	renderer->mainDevices.device.updateDescriptorSets(writeDescriptorSets, {});
+	// The state buffers form a ring, step k reads state k and writes state k + 1
+	for (uint32_t i = 0; i < numSets; ++i)
+	{
+		descriptors.write(descriptorSets[i], PARTICLE_BINDING_POSITION_IN, stateBuffers[i]);
+		descriptors.write(descriptorSets[i], PARTICLE_BINDING_POSITION_OUT, stateBuffers[(i + 1) % numSets]);
+		descriptors.write(descriptorSets[i], PARTICLE_BINDING_VELOCITY, velocityBuffer);
+		descriptors.write(descriptorSets[i], PARTICLE_BINDING_ALIVE_IN, aliveBuffers[i]);
+		descriptors.write(descriptorSets[i], PARTICLE_BINDING_ALIVE_OUT, aliveBuffers[(i + 1) % numSets]);
+		descriptors.write(descriptorSets[i], PARTICLE_BINDING_FREE_LIST, freeListBuffer);
+		descriptors.write(descriptorSets[i], PARTICLE_BINDING_COUNTERS, countersBuffer);
+	}
+	descriptors.flushWrites();
 
 }
 
-void VkCompute::createCommandBuffer()
+void VkCompute::createCommandPool()
 {
 	uint32_t index = renderer->queueFamilyIndices.computeFamily;
 	vk::CommandPoolCreateInfo commandPoolInfo(vk::CommandPoolCreateFlags(), index);
 	commandPoolInfo.flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer;
 	commandPool = renderer->mainDevices.device.createCommandPool(commandPoolInfo);
+}
 
-	vk::CommandBufferAllocateInfo commandBufferAllocateInfo(
-		commandPool,
-		vk::CommandBufferLevel::ePrimary,
-		1);
-
-	const std::vector<vk::CommandBuffer> commandBuffers = renderer->mainDevices.device.allocateCommandBuffers(commandBufferAllocateInfo);
-	commandBuffer = commandBuffers.front();
+VkCompute::CachedCommandBuffer& VkCompute::getCommandBuffer(uint32_t num_elements, uint32_t stateIndex, const VkProfiler::GpuScope& gpuScope)
+{
+	StepParameters parameters = stepParameters;
+	parameters.numElements = num_elements;
+	PopulationParameters population = populationParameters;
+	population.stateIndex = stateIndex;
+	population.numStates = static_cast<uint32_t>(stateBuffers.size());
+	auto key = std::make_tuple(computePipeline, descriptorSets[stateIndex], gpuScope.query);
+	auto cachedIterator = commandBufferCache.find(key);
+	if (cachedIterator != commandBufferCache.end() && memcmp(&cachedIterator->second.parameters, &parameters, sizeof(StepParameters)) == 0
+		&& memcmp(&cachedIterator->second.population, &population, sizeof(PopulationParameters)) == 0)
+	{
+		return cachedIterator->second;
+	}
 
+	if (cachedIterator == commandBufferCache.end())
+	{
+		vk::CommandBufferAllocateInfo commandBufferAllocateInfo(
+			commandPool,
+			vk::CommandBufferLevel::ePrimary,
+			1);
+		CachedCommandBuffer cached{ renderer->mainDevices.device.allocateCommandBuffers(commandBufferAllocateInfo).front(), {}, {}, 0 };
+		cachedIterator = commandBufferCache.emplace(key, cached).first;
+	}
+	else
+	{
+		// Can't reset a command buffer the GPU is still executing
+		renderer->waitTimelineSemaphore(timeline, cachedIterator->second.lastSubmitValue);
+	}
 
+	cachedIterator->second.parameters = parameters;
+	cachedIterator->second.population = population;
+	recordCommands(cachedIterator->second.commandBuffer, parameters, population, gpuScope);
+	return cachedIterator->second;
 }
 
-void VkCompute::recordCommands(uint32_t num_elements)
+void VkCompute::recordCommands(vk::CommandBuffer commandBuffer, const StepParameters& parameters, const PopulationParameters& population,
+	const VkProfiler::GpuScope& gpuScope)
 {
-	vk::CommandBufferBeginInfo commandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+	uint32_t stateIndex = population.stateIndex;
+	uint32_t outStateIndex = (stateIndex + 1) % population.numStates;
+	const vk::DescriptorBufferInfo& outBuffer = stateBuffers[outStateIndex];
+	const vk::DescriptorBufferInfo& aliveOutBuffer = aliveBuffers[outStateIndex];
+
+	// Submitted again while a previous submission may still be pending
+	vk::CommandBufferBeginInfo commandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eSimultaneousUse);
 	commandBuffer.begin(commandBufferBeginInfo);
-	commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, computePipeline);
+
+	// The step appends the survivors to the written state's alive list, which starts empty
+	vk::DeviceSize outCountOffset = countersBuffer.offset + getParticleCountersOffset(outStateIndex) + offsetof(ParticleCounters, aliveCount);
+	commandBuffer.fillBuffer(countersBuffer.buffer, outCountOffset, sizeof(uint32_t), 0);
+	vk::MemoryBarrier fillToCompute(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+	commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags(), fillToCompute, {}, {});
+
 	commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute,
 		pipelineLayout,
 		0,
-		{ descriptorSet },
+		{ descriptorSets[stateIndex] },
 		{});
-	commandBuffer.dispatch(num_elements, 1, 1);
+	commandBuffer.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(StepParameters), &parameters);
+	commandBuffer.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eCompute, sizeof(StepParameters), sizeof(PopulationParameters), &population);
+
+	// As many invocations as particles alive in the read state, the previous step wrote the group count
+	gpuScope.begin(commandBuffer);
+	commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, computePipeline);
+	commandBuffer.dispatchIndirect(countersBuffer.buffer, countersBuffer.offset + getParticleCountersOffset(stateIndex));
+
+	// Emit reads the free list and the count the step left, finish both of them and what emit appended.
+	// Small buffers and back to back dispatches, a global barrier is as good as listing them.
+	vk::MemoryBarrier computeToCompute(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+	auto kernelBarrier = [&]() {
+		commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader,
+			vk::DependencyFlags(), computeToCompute, {}, {});
+	};
+	kernelBarrier();
+	if (population.emitPerStep > 0)
+	{
+		commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, emitPipeline);
+		vk::Extent2D groupCount = renderer->getGroupCount((population.emitPerStep + workgroupSize - 1) / workgroupSize);
+		commandBuffer.dispatch(groupCount.width, groupCount.height, 1);
+		kernelBarrier();
+	}
+	commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, finishPipeline);
+	commandBuffer.dispatch(1, 1, 1);
+	gpuScope.end(commandBuffer);
+
+	// The next step reads what this one wrote and its indirect arguments, and so does the draw when it
+	// shares the queue family. A dedicated compute family is covered by the semaphore the draw waits on.
+	bool sharedQueue = !renderer->headless && renderer->queueFamilyIndices.computeFamily == renderer->queueFamilyIndices.graphicsFamily;
+	vk::AccessFlags dstAccess = vk::AccessFlagBits::eShaderRead;
+	vk::PipelineStageFlags dstStage = vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eDrawIndirect;
+	if (sharedQueue)
+	{
+		// The vertex shader reads positions and the alive list as storage buffers
+		dstStage |= vk::PipelineStageFlagBits::eVertexShader;
+	}
+	std::array<vk::BufferMemoryBarrier, 5> barriers{};
+	barriers[0] = vk::BufferMemoryBarrier(
+		vk::AccessFlagBits::eShaderWrite,
+		dstAccess,
+		VK_QUEUE_FAMILY_IGNORED,
+		VK_QUEUE_FAMILY_IGNORED,
+		outBuffer.buffer,
+		outBuffer.offset,
+		outBuffer.range);
+	// Velocities are updated in place, the next step reads and writes them again
+	barriers[1] = vk::BufferMemoryBarrier(
+		vk::AccessFlagBits::eShaderWrite,
+		vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite,
+		VK_QUEUE_FAMILY_IGNORED,
+		VK_QUEUE_FAMILY_IGNORED,
+		velocityBuffer.buffer,
+		velocityBuffer.offset,
+		velocityBuffer.range);
+	barriers[2] = vk::BufferMemoryBarrier(
+		vk::AccessFlagBits::eShaderWrite,
+		vk::AccessFlagBits::eShaderRead,
+		VK_QUEUE_FAMILY_IGNORED,
+		VK_QUEUE_FAMILY_IGNORED,
+		aliveOutBuffer.buffer,
+		aliveOutBuffer.offset,
+		aliveOutBuffer.range);
+	barriers[3] = vk::BufferMemoryBarrier(
+		vk::AccessFlagBits::eShaderWrite,
+		vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite,
+		VK_QUEUE_FAMILY_IGNORED,
+		VK_QUEUE_FAMILY_IGNORED,
+		freeListBuffer.buffer,
+		freeListBuffer.offset,
+		freeListBuffer.range);
+	// Dispatch and draw arguments, and the counts the next step appends to
+	barriers[4] = vk::BufferMemoryBarrier(
+		vk::AccessFlagBits::eShaderWrite,
+		vk::AccessFlagBits::eIndirectCommandRead | vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eTransferWrite,
+		VK_QUEUE_FAMILY_IGNORED,
+		VK_QUEUE_FAMILY_IGNORED,
+		countersBuffer.buffer,
+		countersBuffer.offset,
+		countersBuffer.range);
+	commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, dstStage | vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags(), {}, barriers, {});
+
 	commandBuffer.end();
 }
 
-void VkCompute::submitWork()
+void VkCompute::submitWork(vk::CommandBuffer commandBuffer, const vector<TimelineWait>& waits)
 {
-	vk::Queue* queuePtr = &renderer->computeQueue;
-	vk::Fence fence = renderer->mainDevices.device.createFence(vk::FenceCreateInfo());
-	vk::SubmitInfo submitInfo(0, nullptr, nullptr, 1, &commandBuffer);
-	queuePtr->submit({ submitInfo }, fence);
-	renderer->mainDevices.device.waitForFences({ fence }, true, uint64_t(-1));
-	renderer->mainDevices.device.destroyFence(fence);
-
-}
\ No newline at end of file
+	VkProfiler::CpuScope cpuScope(renderer->profiler, "VkCompute::submitWork");
+	renderer->submitTimeline(renderer->computeQueue, { commandBuffer }, waits, timeline, ++timelineValue);
+}
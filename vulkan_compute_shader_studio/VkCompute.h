@@ -1,38 +1,85 @@
 #pragma once
 #include "VkRenderer.h"
 #include "VkComputeShader.h"
+#include "VkDescriptorAllocator.h"
+#include "shaders/ParticleLayout.h"
+#include "shaders/ParticlePopulation.h"
+#include <map>
+#include <tuple>
 
 
 class VkCompute
 {
 public:
 	VkCompute();
-	VkCompute(VkRenderer* pRenderer, const char* pFileName);
+	// The step shader, and particlePopulation.spv which emits particles and writes the indirect arguments after it
+	VkCompute(VkRenderer* pRenderer, const char* pFileName, const char* pPopulationFileName);
 	~VkCompute();
 
-	void init(vk::DescriptorBufferInfo inBufferInfo, vk::DescriptorBufferInfo outBufferInfo);
-	void run(uint32_t num_elements);
+	// One position and one alive list per state. The counters buffer is laid out as in ParticlePopulation.h.
+	void init(const vector<vk::DescriptorBufferInfo>& stateBufferInfos, const vk::DescriptorBufferInfo& velocityBufferInfo,
+		const vector<vk::DescriptorBufferInfo>& aliveBufferInfos, const vk::DescriptorBufferInfo& freeListBufferInfo,
+		const vk::DescriptorBufferInfo& countersBufferInfo);
+	// Non-blocking, returns the value the compute timeline reaches once this step is done. num_elements is
+	// the number of slots, how many of them are alive is only known to the GPU.
+	uint64_t submit(uint32_t num_elements, uint32_t stateIndex, const vector<TimelineWait>& waits = {});
+	void wait(uint64_t value);
+	void run(uint32_t num_elements, uint32_t stateIndex);
+	vk::Semaphore getTimeline() const { return timeline; }
+	void setWorkgroupSize(uint32_t size) { workgroupSize = size; } // before init, 0 picks one for the device
+	// Pushed with every step, changing them re-records the cached command buffers on their next use
+	void setIntegrationParameters(float timestep, float softening, float gravity);
+	// Same, emitPerStep dead slots come back every step around the emitter, a lifetime of 0 never dies
+	void setEmitParameters(uint32_t emitPerStep, float lifetime, glm::vec3 emitterCentre, float emitterRadius);
+	uint32_t getWorkgroupSize() const { return workgroupSize; }
 	void clean();
 
 private:
 	VkRenderer* renderer;
 	const char* shaderFileName;
+	const char* populationShaderFileName;
 	VkComputeShader computeShader{ shaderFileName };
+	VkComputeShader populationShader{ populationShaderFileName };
 
 	vk::DescriptorSetLayout descriptorSetLayout;
 	vk::PipelineLayout pipelineLayout;
-	vk::DescriptorPool descriptorPool;
-	vk::DescriptorSet descriptorSet;
+	VkDescriptorAllocator descriptors{ renderer };
+	vector<vk::DescriptorSet> descriptorSets; // set i reads state i and writes state i + 1
 	vk::Pipeline computePipeline;
+	vk::Pipeline emitPipeline;
+	vk::Pipeline finishPipeline;
 	vk::CommandPool commandPool;
-	vk::CommandBuffer commandBuffer;
+	// Pre-recorded dispatches keyed by (pipeline, descriptor set, profiler query), re-recorded when the pushed
+	// parameters change. The profiler hands the same few query pairs out again and again, so profiling only
+	// adds a handful of copies.
+	struct CachedCommandBuffer
+	{
+		vk::CommandBuffer commandBuffer;
+		StepParameters parameters;
+		PopulationParameters population;
+		uint64_t lastSubmitValue;
+	};
+	std::map<std::tuple<vk::Pipeline, vk::DescriptorSet, uint32_t>, CachedCommandBuffer> commandBufferCache;
+	vector<vk::DescriptorBufferInfo> stateBuffers;
+	vk::DescriptorBufferInfo velocityBuffer;
+	vector<vk::DescriptorBufferInfo> aliveBuffers;
+	vk::DescriptorBufferInfo freeListBuffer;
+	vk::DescriptorBufferInfo countersBuffer;
+	StepParameters stepParameters{ 0, 0.001f, 0.05f * 0.05f, 1.0f };
+	PopulationParameters populationParameters{ 0, 0, 0, 0.0f, glm::vec4(0.0f, 0.0f, 0.0f, 0.1f) };
+	vk::Semaphore timeline;
+	uint64_t timelineValue = 0;
+	uint32_t workgroupSize = 0; // local_size_x, specialization constant 0 of the shader
 
+	void chooseWorkgroupSize();
 	void createDescriptorSetLayout();
 	void createComputePipeline();
-	void createDescriptorSet(vk::DescriptorBufferInfo inBufferInfo, vk::DescriptorBufferInfo outBufferInfo);
-	void createCommandBuffer();
+	void createDescriptorSets();
+	void createCommandPool();
 
-	void recordCommands(uint32_t num_elements);
-	void submitWork();
+	CachedCommandBuffer& getCommandBuffer(uint32_t num_elements, uint32_t stateIndex, const VkProfiler::GpuScope& gpuScope);
+	void recordCommands(vk::CommandBuffer commandBuffer, const StepParameters& parameters, const PopulationParameters& population,
+		const VkProfiler::GpuScope& gpuScope);
+	void submitWork(vk::CommandBuffer commandBuffer, const vector<TimelineWait>& waits);
 };
 
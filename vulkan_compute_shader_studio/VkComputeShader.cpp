@@ -17,6 +17,28 @@ void VkComputeShader::load_compute_shader(VkRenderer* renderer)
     shaderModule = renderer->createShader(shaderContent);
 }
 
+vk::Pipeline VkComputeShader::createPipeline(VkRenderer* renderer, vk::PipelineLayout pipelineLayout, const vector<uint32_t>& specializationConstants) const
+{
+    vector<vk::SpecializationMapEntry> specializationEntries;
+    for (uint32_t i = 0; i < specializationConstants.size(); ++i)
+    {
+        specializationEntries.push_back(vk::SpecializationMapEntry(i, i * sizeof(uint32_t), sizeof(uint32_t)));
+    }
+    vk::SpecializationInfo specializationInfo(
+        static_cast<uint32_t>(specializationEntries.size()),
+        specializationEntries.data(),
+        specializationConstants.size() * sizeof(uint32_t),
+        specializationConstants.data());
+    vk::PipelineShaderStageCreateInfo pipelineShaderInfo(
+        vk::PipelineShaderStageCreateFlags(),
+        vk::ShaderStageFlagBits::eCompute,
+        shaderModule,
+        "main",
+        &specializationInfo);
+    vk::ComputePipelineCreateInfo computePipelineInfo(vk::PipelineCreateFlags(), pipelineShaderInfo, pipelineLayout);
+    return renderer->mainDevices.device.createComputePipeline(renderer->pipelineCache, computePipelineInfo).value;
+}
+
 void VkComputeShader::cleanUp(VkRenderer* renderer)
 {
     renderer->mainDevices.device.destroyShaderModule(shaderModule);
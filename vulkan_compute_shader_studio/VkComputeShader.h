@@ -12,6 +12,8 @@ public:
 	VkComputeShader(const char* pFileName);
 	~VkComputeShader();
 	void load_compute_shader(VkRenderer* renderer);
+	// Specialization constant i is set to specializationConstants[i], the kernels here all take uint constants
+	vk::Pipeline createPipeline(VkRenderer* renderer, vk::PipelineLayout pipelineLayout, const vector<uint32_t>& specializationConstants) const;
 	vk::ShaderModule shaderModule;
 	void cleanUp(VkRenderer* renderer);
 
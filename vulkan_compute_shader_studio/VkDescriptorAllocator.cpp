@@ -0,0 +1,127 @@
+#include "VkDescriptorAllocator.h"
+#include <algorithm>
+#include <array>
+
+// Descriptors per set a pool is sized for, by type. Every kernel here binds storage buffers only,
+// the largest set has 11 of them.
+static const std::array<std::pair<vk::DescriptorType, uint32_t>, 3> poolSizeRatios = { {
+	{ vk::DescriptorType::eStorageBuffer, 12 },
+	{ vk::DescriptorType::eUniformBuffer, 2 },
+	{ vk::DescriptorType::eCombinedImageSampler, 2 } } };
+
+// Doubling stops there, a pool that big is never the bottleneck
+static const uint32_t maxSetsPerPool = 4096;
+
+VkDescriptorAllocator::VkDescriptorAllocator(VkRenderer* pRenderer) : renderer{ pRenderer }
+{
+}
+
+VkDescriptorAllocator::~VkDescriptorAllocator()
+{
+}
+
+void VkDescriptorAllocator::init(uint32_t numFrames, uint32_t pSetsPerPool)
+{
+	setsPerPool = std::max(pSetsPerPool, 1u);
+	framePools.resize(numFrames);
+	currentFrame = 0;
+}
+
+vector<vk::DescriptorSet> VkDescriptorAllocator::allocate(vk::DescriptorSetLayout layout, uint32_t count)
+{
+	return allocateFrom(persistentPools, layout, count);
+}
+
+void VkDescriptorAllocator::beginFrame(uint32_t frame)
+{
+	currentFrame = frame;
+	PoolList& poolList = framePools[frame];
+	for (uint32_t i = 0; i <= poolList.current && i < poolList.pools.size(); ++i)
+	{
+		renderer->mainDevices.device.resetDescriptorPool(poolList.pools[i]);
+	}
+	poolList.current = 0;
+}
+
+vk::DescriptorSet VkDescriptorAllocator::allocateTransient(vk::DescriptorSetLayout layout)
+{
+	return allocateFrom(framePools[currentFrame], layout, 1).front();
+}
+
+void VkDescriptorAllocator::write(vk::DescriptorSet set, uint32_t binding, const vk::DescriptorBufferInfo& bufferInfo, vk::DescriptorType type)
+{
+	pendingBufferInfos.push_back(bufferInfo);
+	pendingWrites.push_back({ set, binding, 0, 1, type, nullptr, &pendingBufferInfos.back() });
+}
+
+void VkDescriptorAllocator::flushWrites()
+{
+	if (pendingWrites.empty())
+	{
+		return;
+	}
+	renderer->mainDevices.device.updateDescriptorSets(pendingWrites, {});
+	pendingWrites.clear();
+	pendingBufferInfos.clear();
+}
+
+void VkDescriptorAllocator::clean()
+{
+	// Sets go away with their pools
+	vk::Device device = renderer->mainDevices.device;
+	for (vk::DescriptorPool pool : persistentPools.pools)
+	{
+		device.destroyDescriptorPool(pool);
+	}
+	persistentPools = PoolList();
+	for (PoolList& poolList : framePools)
+	{
+		for (vk::DescriptorPool pool : poolList.pools)
+		{
+			device.destroyDescriptorPool(pool);
+		}
+	}
+	framePools.clear();
+	pendingWrites.clear();
+	pendingBufferInfos.clear();
+}
+
+vector<vk::DescriptorSet> VkDescriptorAllocator::allocateFrom(PoolList& poolList, vk::DescriptorSetLayout layout, uint32_t count)
+{
+	const vector<vk::DescriptorSetLayout> setLayouts(count, layout);
+	while (true)
+	{
+		bool newPool = poolList.current == poolList.pools.size();
+		if (newPool)
+		{
+			uint32_t maxSets = std::min(setsPerPool << std::min(poolList.current, 16u), maxSetsPerPool);
+			poolList.pools.push_back(createPool(std::max(maxSets, count)));
+		}
+		vk::DescriptorSetAllocateInfo descriptorAllocateInfo(poolList.pools[poolList.current], setLayouts);
+		try
+		{
+			return renderer->mainDevices.device.allocateDescriptorSets(descriptorAllocateInfo);
+		}
+		catch (const vk::SystemError&)
+		{
+			// Out of pool memory or fragmented, the next pool takes over. A brand new pool failing
+			// means the layout needs more descriptors than a set is sized for.
+			if (newPool)
+			{
+				throw;
+			}
+			++poolList.current;
+		}
+	}
+}
+
+vk::DescriptorPool VkDescriptorAllocator::createPool(uint32_t maxSets)
+{
+	vector<vk::DescriptorPoolSize> poolSizes;
+	for (const auto& ratio : poolSizeRatios)
+	{
+		poolSizes.push_back({ ratio.first, ratio.second * maxSets });
+	}
+	vk::DescriptorPoolCreateInfo descriptorPoolInfo(vk::DescriptorPoolCreateFlags(), maxSets, poolSizes);
+	return renderer->mainDevices.device.createDescriptorPool(descriptorPoolInfo);
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include "VkRenderer.h"
+#include <deque>
+
+// Descriptor sets from pools that grow on demand, any layout from the renderer's descriptor cache.
+// Persistent sets live as long as the allocator. Transient sets belong to a frame in flight and are
+// all handed back at once when beginFrame comes around to that frame again, one pool reset instead
+// of a free per set. Writes are queued and sent in a single vkUpdateDescriptorSets by flushWrites,
+// which has to happen before the sets are bound.
+class VkDescriptorAllocator
+{
+public:
+	VkDescriptorAllocator(VkRenderer* pRenderer);
+	~VkDescriptorAllocator();
+
+	// numFrames sets of transient pools, 0 when only persistent sets are used. The first pool of each
+	// kind holds setsPerPool sets, every pool added after it twice as many as the one before.
+	void init(uint32_t numFrames, uint32_t pSetsPerPool = 16);
+	vector<vk::DescriptorSet> allocate(vk::DescriptorSetLayout layout, uint32_t count = 1);
+	// The GPU has to be done with what this frame's sets were bound to last time
+	void beginFrame(uint32_t frame);
+	vk::DescriptorSet allocateTransient(vk::DescriptorSetLayout layout);
+	void write(vk::DescriptorSet set, uint32_t binding, const vk::DescriptorBufferInfo& bufferInfo,
+		vk::DescriptorType type = vk::DescriptorType::eStorageBuffer);
+	void flushWrites();
+	void clean();
+
+private:
+	VkRenderer* renderer;
+	uint32_t setsPerPool = 16;
+
+	struct PoolList
+	{
+		vector<vk::DescriptorPool> pools;
+		uint32_t current = 0; // pools before it are full until the next reset
+	};
+	PoolList persistentPools;
+	vector<PoolList> framePools;
+	uint32_t currentFrame = 0;
+
+	// Buffer infos are pointed to by the pending writes, a deque keeps them in place as it grows
+	std::deque<vk::DescriptorBufferInfo> pendingBufferInfos;
+	vector<vk::WriteDescriptorSet> pendingWrites;
+
+	vector<vk::DescriptorSet> allocateFrom(PoolList& poolList, vk::DescriptorSetLayout layout, uint32_t count);
+	vk::DescriptorPool createPool(uint32_t maxSets);
+};
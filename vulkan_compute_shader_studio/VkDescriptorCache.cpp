@@ -0,0 +1,107 @@
+#include "VkDescriptorCache.h"
+#include <algorithm>
+#include <stdexcept>
+
+VkDescriptorCache::VkDescriptorCache()
+{
+}
+
+VkDescriptorCache::~VkDescriptorCache()
+{
+}
+
+void VkDescriptorCache::init(vk::Device pDevice)
+{
+	device = pDevice;
+}
+
+size_t VkDescriptorCache::KeyHash::operator()(const Key& key) const
+{
+	// FNV-1a over the words, equal keys are still compared in full
+	uint64_t hash = 14695981039346656037ull;
+	for (uint64_t word : key)
+	{
+		hash ^= word;
+		hash *= 1099511628211ull;
+	}
+	return static_cast<size_t>(hash);
+}
+
+vk::DescriptorSetLayout VkDescriptorCache::getSetLayout(const vector<vk::DescriptorSetLayoutBinding>& bindings)
+{
+	vector<vk::DescriptorSetLayoutBinding> sortedBindings = bindings;
+	std::sort(sortedBindings.begin(), sortedBindings.end(),
+		[](const vk::DescriptorSetLayoutBinding& a, const vk::DescriptorSetLayoutBinding& b) { return a.binding < b.binding; });
+	Key key;
+	for (const vk::DescriptorSetLayoutBinding& binding : sortedBindings)
+	{
+		if (binding.pImmutableSamplers)
+		{
+			throw std::runtime_error("The descriptor cache doesn't handle immutable samplers.");
+		}
+		key.push_back(uint64_t(binding.binding) << 32 | binding.descriptorCount);
+		key.push_back(uint64_t(binding.descriptorType) << 32 | static_cast<VkShaderStageFlags>(binding.stageFlags));
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	auto layoutIterator = setLayouts.find(key);
+	if (layoutIterator != setLayouts.end())
+	{
+		return layoutIterator->second;
+	}
+	vk::DescriptorSetLayoutCreateInfo descriptorSetLayoutInfo(vk::DescriptorSetLayoutCreateFlags(), sortedBindings);
+	vk::DescriptorSetLayout setLayout = device.createDescriptorSetLayout(descriptorSetLayoutInfo);
+	setLayouts[key] = setLayout;
+	return setLayout;
+}
+
+vk::DescriptorSetLayout VkDescriptorCache::getSetLayout(vk::DescriptorType type, uint32_t count, vk::ShaderStageFlags stages)
+{
+	vector<vk::DescriptorSetLayoutBinding> bindings;
+	for (uint32_t binding = 0; binding < count; ++binding)
+	{
+		bindings.push_back({ binding, type, 1, stages });
+	}
+	return getSetLayout(bindings);
+}
+
+vk::PipelineLayout VkDescriptorCache::getPipelineLayout(const vector<vk::DescriptorSetLayout>& setLayoutHandles,
+	const vector<vk::PushConstantRange>& pushConstantRanges)
+{
+	// Set layouts come from this cache, equal bindings already mean equal handles
+	Key key;
+	for (vk::DescriptorSetLayout setLayout : setLayoutHandles)
+	{
+		key.push_back(reinterpret_cast<uint64_t>(static_cast<VkDescriptorSetLayout>(setLayout)));
+	}
+	for (const vk::PushConstantRange& range : pushConstantRanges)
+	{
+		key.push_back(static_cast<VkShaderStageFlags>(range.stageFlags));
+		key.push_back(uint64_t(range.offset) << 32 | range.size);
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	auto layoutIterator = pipelineLayouts.find(key);
+	if (layoutIterator != pipelineLayouts.end())
+	{
+		return layoutIterator->second;
+	}
+	vk::PipelineLayoutCreateInfo pipelineLayoutCreateInfo(vk::PipelineLayoutCreateFlags(), setLayoutHandles, pushConstantRanges);
+	vk::PipelineLayout pipelineLayout = device.createPipelineLayout(pipelineLayoutCreateInfo);
+	pipelineLayouts[key] = pipelineLayout;
+	return pipelineLayout;
+}
+
+void VkDescriptorCache::clean()
+{
+	for (auto& pipelineLayout : pipelineLayouts)
+	{
+		device.destroyPipelineLayout(pipelineLayout.second);
+	}
+	pipelineLayouts.clear();
+	for (auto& setLayout : setLayouts)
+	{
+		device.destroyDescriptorSetLayout(setLayout.second);
+	}
+	setLayouts.clear();
+}
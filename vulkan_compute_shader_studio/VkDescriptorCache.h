@@ -0,0 +1,37 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+
+using std::vector;
+
+// Descriptor set layouts and pipeline layouts shared by everything created on the renderer's device.
+// They're looked up by a hash of what they're created from, so kernels declaring the same bindings
+// get the same handles, and they live until the renderer is cleaned up: callers never destroy them.
+class VkDescriptorCache
+{
+public:
+	VkDescriptorCache();
+	~VkDescriptorCache();
+
+	void init(vk::Device pDevice);
+	// Binding order doesn't matter, immutable samplers aren't supported
+	vk::DescriptorSetLayout getSetLayout(const vector<vk::DescriptorSetLayoutBinding>& bindings);
+	// Bindings 0 to count - 1 all of the same type, how most kernels here are laid out
+	vk::DescriptorSetLayout getSetLayout(vk::DescriptorType type, uint32_t count, vk::ShaderStageFlags stages);
+	vk::PipelineLayout getPipelineLayout(const vector<vk::DescriptorSetLayout>& setLayouts, const vector<vk::PushConstantRange>& pushConstantRanges = {});
+	void clean();
+
+private:
+	using Key = vector<uint64_t>;
+	struct KeyHash
+	{
+		size_t operator()(const Key& key) const;
+	};
+
+	vk::Device device;
+	std::mutex mutex; // lookups may come from any thread
+	std::unordered_map<Key, vk::DescriptorSetLayout, KeyHash> setLayouts;
+	std::unordered_map<Key, vk::PipelineLayout, KeyHash> pipelineLayouts;
+};
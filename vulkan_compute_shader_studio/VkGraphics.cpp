@@ -1,4 +1,5 @@
 #include "VkGraphics.h"
+#include <cstddef>
 
 VkGraphics::VkGraphics(VkRenderer* pRenderer): renderer{pRenderer}
 {
@@ -8,16 +9,17 @@ VkGraphics::~VkGraphics()
 {
 }
 
-void VkGraphics::init(vk::Buffer vertexBuffer, uint32_t stride, size_t offsetPos,
-    size_t offsetCol, uint32_t verticesSize)
+void VkGraphics::init(const vector<vk::Buffer>& positionBuffers, vk::Buffer colorBuffer, const vector<vk::Buffer>& aliveBuffers, vk::Buffer pCountersBuffer)
 {
+    numStates = static_cast<uint32_t>(positionBuffers.size());
+    countersBuffer = pCountersBuffer;
     createSwapchain();
     createRenderPass();
-    createGraphicsPipeline(stride, offsetPos, offsetCol);
+    createDescriptorSetLayout();
+    createDescriptorSets(positionBuffers, colorBuffer, aliveBuffers);
+    createGraphicsPipeline();
     createFramebuffers();
-    createGraphicsCommandPool();
-    createGraphicsCommandBuffer();
-    recordCommands(vertexBuffer, verticesSize);
+    recorder.init(renderer->queueFamilyIndices.graphicsFamily, MAX_FRAME_DRAWS);
     createSynchronisation();
 }
 
@@ -30,7 +32,8 @@ void VkGraphics::clean()
         renderer->mainDevices.device.destroySemaphore(imageAvailable[i]);
         renderer->mainDevices.device.destroyFence(drawFences[i]);
     }
-    renderer->mainDevices.device.destroyCommandPool(graphicsCommandPool);
+    renderer->mainDevices.device.destroySemaphore(timeline);
+    recorder.clean();
     for (auto framebuffer : swapchainFramebuffers)
     {
         renderer->mainDevices.device.destroyFramebuffer(framebuffer);
@@ -40,7 +43,7 @@ void VkGraphics::clean()
     {
         renderer->mainDevices.device.destroyImageView(image.imageView);
     }
-    renderer->mainDevices.device.destroyPipelineLayout(pipelineLayout);
+    descriptors.clean();
     renderer->mainDevices.device.destroyRenderPass(renderPass);
     renderer->mainDevices.device.destroyPipeline(graphicsPipeline);
 }
@@ -180,7 +183,28 @@ vk::ImageView VkGraphics::createImageView(vk::Image image, vk::Format format, vk
     return imageView;
 }
 
-void VkGraphics::createGraphicsPipeline(uint32_t stride, size_t offsetPos, size_t offsetCol)
+void VkGraphics::createDescriptorSetLayout()
+{
+    descriptorSetLayout = renderer->descriptorCache.getSetLayout(vk::DescriptorType::eStorageBuffer, PARTICLE_RENDER_BINDING_COUNT,
+        vk::ShaderStageFlagBits::eVertex);
+}
+
+void VkGraphics::createDescriptorSets(const vector<vk::Buffer>& positionBuffers, vk::Buffer colorBuffer, const vector<vk::Buffer>& aliveBuffers)
+{
+    descriptors.init(0, numStates);
+    descriptorSets = descriptors.allocate(descriptorSetLayout, numStates);
+
+    // Set j draws state j: its positions and alive list, and the colors every state shares
+    for (uint32_t j = 0; j < numStates; ++j)
+    {
+        descriptors.write(descriptorSets[j], PARTICLE_RENDER_BINDING_POSITIONS, { positionBuffers[j], 0, VK_WHOLE_SIZE });
+        descriptors.write(descriptorSets[j], PARTICLE_RENDER_BINDING_COLORS, { colorBuffer, 0, VK_WHOLE_SIZE });
+        descriptors.write(descriptorSets[j], PARTICLE_RENDER_BINDING_ALIVE, { aliveBuffers[j], 0, VK_WHOLE_SIZE });
+    }
+    descriptors.flushWrites();
+}
+
+void VkGraphics::createGraphicsPipeline()
 {
     auto vertexShaderCode = readShaderFile("shaders/vert.spv");
     auto fragmentShaderCode = readShaderFile("shaders/frag.spv");
@@ -204,34 +228,17 @@ void VkGraphics::createGraphicsPipeline(uint32_t stride, size_t offsetPos, size_
     };
 
     // -- VERTEX INPUT STAGE --
-    vk::VertexInputBindingDescription vertexBinding{};
-    vertexBinding.binding = 0;
-    vertexBinding.stride = stride;
-    vertexBinding.inputRate = vk::VertexInputRate::eVertex;
-
-    std::array<vk::VertexInputAttributeDescription, 2> attributeDescriptions{};
-
-    attributeDescriptions[0].binding = 0;
-    attributeDescriptions[0].location = 0;
-    attributeDescriptions[0].format = vk::Format::eR32G32B32Sfloat;
-    attributeDescriptions[0].offset = offsetPos;
-
-    attributeDescriptions[1].binding = 0;
-    attributeDescriptions[1].location = 1;
-    attributeDescriptions[1].format = vk::Format::eR32G32B32Sfloat;
-    attributeDescriptions[1].offset = offsetCol;
-
+    // None, the vertex shader reads the particles from storage buffers (ParticleRender.h)
     vk::PipelineVertexInputStateCreateInfo vertexInputCreateInfo{};
     vertexInputCreateInfo.sType = vk::StructureType::ePipelineVertexInputStateCreateInfo;
-    vertexInputCreateInfo.vertexBindingDescriptionCount = 1;
-    vertexInputCreateInfo.pVertexBindingDescriptions = &vertexBinding;
-    vertexInputCreateInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());;
-    vertexInputCreateInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+    vertexInputCreateInfo.vertexBindingDescriptionCount = 0;
+    vertexInputCreateInfo.vertexAttributeDescriptionCount = 0;
 
     // -- INPUT ASSEMBLY --
     vk::PipelineInputAssemblyStateCreateInfo inputAssemblyCreateInfo{};
     inputAssemblyCreateInfo.sType = vk::StructureType::ePipelineInputAssemblyStateCreateInfo;
-    inputAssemblyCreateInfo.topology = vk::PrimitiveTopology::eTriangleList;
+    // One quad per instance
+    inputAssemblyCreateInfo.topology = vk::PrimitiveTopology::eTriangleStrip;
     inputAssemblyCreateInfo.primitiveRestartEnable = VK_FALSE;
 
     // -- VIEWPORT AND SCISSOR --
@@ -261,7 +268,8 @@ void VkGraphics::createGraphicsPipeline(uint32_t stride, size_t offsetPos, size_
     rasterizerCreateInfo.rasterizerDiscardEnable = VK_FALSE;
     rasterizerCreateInfo.polygonMode = vk::PolygonMode::eFill;
     rasterizerCreateInfo.lineWidth = 1.0f;
-    rasterizerCreateInfo.cullMode = vk::CullModeFlagBits::eBack;
+    // Quads always face the camera, nothing to cull
+    rasterizerCreateInfo.cullMode = vk::CullModeFlagBits::eNone;
     rasterizerCreateInfo.frontFace = vk::FrontFace::eClockwise;
     rasterizerCreateInfo.depthBiasEnable = VK_FALSE;
 
@@ -290,14 +298,8 @@ void VkGraphics::createGraphicsPipeline(uint32_t stride, size_t offsetPos, size_
     colorBlendingCreateInfo.pAttachments = &colorBlendAttachment;
 
     // -- PIPELINE LAYOUT --
-    vk::PipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
-    pipelineLayoutCreateInfo.sType = vk::StructureType::ePipelineLayoutCreateInfo;
-    pipelineLayoutCreateInfo.setLayoutCount = 0;
-    pipelineLayoutCreateInfo.pSetLayouts = nullptr;
-    pipelineLayoutCreateInfo.pushConstantRangeCount = 0;
-    pipelineLayoutCreateInfo.pPushConstantRanges = nullptr;
-
-    pipelineLayout = renderer->mainDevices.device.createPipelineLayout(pipelineLayoutCreateInfo);
+    vk::PushConstantRange pushConstantRange(vk::ShaderStageFlagBits::eVertex, 0, sizeof(RenderParameters));
+    pipelineLayout = renderer->descriptorCache.getPipelineLayout({ descriptorSetLayout }, { pushConstantRange });
 
     // -- GRAPHICS PIPELINE CREATION --
     vk::GraphicsPipelineCreateInfo graphicsPipelineCreateInfo{};
@@ -319,7 +321,7 @@ void VkGraphics::createGraphicsPipeline(uint32_t stride, size_t offsetPos, size_
     graphicsPipelineCreateInfo.basePipelineIndex = -1;
 
 
-    vk::Result result = renderer->mainDevices.device.createGraphicsPipelines(VK_NULL_HANDLE, 1, &graphicsPipelineCreateInfo, nullptr, &graphicsPipeline);
+    vk::Result result = renderer->mainDevices.device.createGraphicsPipelines(renderer->pipelineCache, 1, &graphicsPipelineCreateInfo, nullptr, &graphicsPipeline);
     if (result != vk::Result::eSuccess)
     {
         throw std::runtime_error("Cound not create a graphics pipeline");
@@ -400,35 +402,12 @@ void VkGraphics::createFramebuffers()
     }
 }
 
-void VkGraphics::createGraphicsCommandPool()
+vk::CommandBuffer VkGraphics::recordCommands(uint32_t imageIndex, uint32_t stateIndex, const VkProfiler::GpuScope& gpuScope)
 {
-    vk::CommandPoolCreateInfo poolInfo{};
-    poolInfo.sType = vk::StructureType::eCommandPoolCreateInfo;
-    poolInfo.queueFamilyIndex = renderer->queueFamilyIndices.graphicsFamily;
-
-    graphicsCommandPool = renderer->mainDevices.device.createCommandPool(poolInfo);
-}
-
-void VkGraphics::createGraphicsCommandBuffer()
-{
-    commandBuffers.resize(swapchainFramebuffers.size());
-    vk::CommandBufferAllocateInfo commandBufferAllocInfo{};
-    commandBufferAllocInfo.sType = vk::StructureType::eCommandBufferAllocateInfo;
-    commandBufferAllocInfo.commandPool = graphicsCommandPool;
-    commandBufferAllocInfo.commandBufferCount = static_cast<uint32_t>(commandBuffers.size());
-    commandBufferAllocInfo.level = vk::CommandBufferLevel::ePrimary;
-
-    commandBuffers = renderer->mainDevices.device.allocateCommandBuffers(commandBufferAllocInfo);
-}
-
-void VkGraphics::recordCommands(vk::Buffer vertexBuffer, uint32_t verticesSize)
-{
-    vk::CommandBufferBeginInfo commandBufferBeginInfo{};
-    commandBufferBeginInfo.sType = vk::StructureType::eCommandBufferBeginInfo;
-
     vk::RenderPassBeginInfo renderPassBeginInfo{};
     renderPassBeginInfo.sType = vk::StructureType::eRenderPassBeginInfo;
     renderPassBeginInfo.renderPass = renderPass;
+    renderPassBeginInfo.framebuffer = swapchainFramebuffers[imageIndex];
     renderPassBeginInfo.renderArea.offset.x = 0;
     renderPassBeginInfo.renderArea.offset.y = 0;
     renderPassBeginInfo.renderArea.extent = swapchainExtent;
@@ -439,44 +418,64 @@ void VkGraphics::recordCommands(vk::Buffer vertexBuffer, uint32_t verticesSize)
     renderPassBeginInfo.pClearValues = &clearValues;
     renderPassBeginInfo.clearValueCount = 1;
 
-
-    for (size_t i = 0; i < commandBuffers.size(); ++i)
-    {
-        renderPassBeginInfo.framebuffer = swapchainFramebuffers[i];
-        commandBuffers[i].begin(commandBufferBeginInfo);
-        commandBuffers[i].beginRenderPass(renderPassBeginInfo, vk::SubpassContents::eInline);
-        commandBuffers[i].bindPipeline(vk::PipelineBindPoint::eGraphics, graphicsPipeline);
-
-        vk::DeviceSize offsets[] = { 0 };
-        vk::Buffer vertexBuffers[] = { vertexBuffer };
-
-        commandBuffers[i].bindVertexBuffers(0, 1, vertexBuffers, offsets);
-        commandBuffers[i].draw(static_cast<uint32_t>(verticesSize), 1, 0, 0);
-        commandBuffers[i].endRenderPass();
-        commandBuffers[i].end();
-    }
+    RenderParameters parameters = renderParameters;
+    parameters.aspectRatio = float(swapchainExtent.height) / float(swapchainExtent.width);
+
+    // One secondary per pass, recorded in parallel. Passes added here only need to bind their own state.
+    vector<VkCommandRecorder::RecordFunction> passes;
+    passes.push_back([&](vk::CommandBuffer commandBuffer) {
+        commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, graphicsPipeline);
+        commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout, 0, descriptorSets[stateIndex], {});
+        commandBuffer.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eVertex, 0, sizeof(RenderParameters), &parameters);
+        // One instance per alive particle, the step that wrote the alive list also wrote the instance count
+        commandBuffer.drawIndirect(countersBuffer, getParticleCountersOffset(stateIndex) + offsetof(ParticleCounters, vertexCount), 1, sizeof(ParticleCounters));
+    });
+    return recorder.record(passes, &renderPassBeginInfo, gpuScope);
 }
 
-void VkGraphics::draw()
+uint64_t VkGraphics::draw(uint32_t stateIndex, const TimelineWait& computeWait)
 {
+    VkProfiler::CpuScope cpuScope(renderer->profiler, "VkGraphics::draw");
     renderer->mainDevices.device.waitForFences(drawFences[currentFrame], VK_TRUE, std::numeric_limits<uint32_t>::max());
     renderer->mainDevices.device.resetFences(drawFences[currentFrame]);
+    // What this frame recorded last time is done, its command pools can be reused
+    recorder.beginFrame(currentFrame);
     uint32_t imageToBeDrawnIndex;
 
     vk::ResultValue result = renderer->mainDevices.device.acquireNextImageKHR(swapchain, std::numeric_limits<uint32_t>::max(), imageAvailable[currentFrame], VK_NULL_HANDLE);
     imageToBeDrawnIndex = result.value;
 
+    // The vertex shader waits on the compute step that wrote the state, the compute
+    // step that next overwrites it waits on the graphics timeline. Binary values are ignored.
+    uint64_t signalValue = ++timelineValue;
+    vk::Semaphore waitSemaphores[]{ imageAvailable[currentFrame], computeWait.semaphore };
+    uint64_t waitValues[]{ 0, computeWait.value };
+    vk::Semaphore signalSemaphores[]{ renderFinished[currentFrame], timeline };
+    uint64_t signalValues[]{ 0, signalValue };
+
+    vk::TimelineSemaphoreSubmitInfo timelineSubmitInfo{};
+    timelineSubmitInfo.waitSemaphoreValueCount = 2;
+    timelineSubmitInfo.pWaitSemaphoreValues = waitValues;
+    timelineSubmitInfo.signalSemaphoreValueCount = 2;
+    timelineSubmitInfo.pSignalSemaphoreValues = signalValues;
+
     vk::SubmitInfo submitInfo{};
     submitInfo.sType = vk::StructureType::eSubmitInfo;
-    submitInfo.waitSemaphoreCount = 1;
-    submitInfo.pWaitSemaphores = &imageAvailable[currentFrame];
+    submitInfo.pNext = &timelineSubmitInfo;
+    submitInfo.waitSemaphoreCount = 2;
+    submitInfo.pWaitSemaphores = waitSemaphores;
 
-    vk::PipelineStageFlags waitStages[]{ vk::PipelineStageFlagBits::eColorAttachmentOutput };
+    vk::PipelineStageFlags waitStages[]{ vk::PipelineStageFlagBits::eColorAttachmentOutput, computeWait.stage };
     submitInfo.pWaitDstStageMask = waitStages;
+    // Both waits block color attachment output: the swapchain image's directly, the compute step's through
+    // the indirect and vertex stages before it. The render pass span starts once both are signalled.
+    VkProfiler::GpuScope gpuScope = renderer->profiler.beginGpuScope("render pass", renderer->queueFamilyIndices.graphicsFamily,
+        vk::PipelineStageFlagBits::eColorAttachmentOutput);
+    vk::CommandBuffer commandBuffer = recordCommands(imageToBeDrawnIndex, stateIndex, gpuScope);
     submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffers[imageToBeDrawnIndex];
-    submitInfo.signalSemaphoreCount = 1;
-    submitInfo.pSignalSemaphores = &renderFinished[currentFrame];
+    submitInfo.pCommandBuffers = &commandBuffer;
+    submitInfo.signalSemaphoreCount = 2;
+    submitInfo.pSignalSemaphores = signalSemaphores;
 
     renderer->graphicsQueue.submit(submitInfo, drawFences[currentFrame]);
 
@@ -491,6 +490,7 @@ void VkGraphics::draw()
     renderer->presentationQueue.presentKHR(presentInfo);
 
     currentFrame = (currentFrame + 1) % MAX_FRAME_DRAWS;
+    return signalValue;
 }
 
 void VkGraphics::createSynchronisation()
@@ -512,4 +512,5 @@ void VkGraphics::createSynchronisation()
         renderFinished[i] = renderer->mainDevices.device.createSemaphore(semaphoreCreateInfo);
         drawFences[i] = renderer->mainDevices.device.createFence(fenceCreateInfo);
     }
+    timeline = renderer->createTimelineSemaphore();
 }
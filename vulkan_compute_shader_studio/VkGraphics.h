@@ -1,5 +1,10 @@
 #pragma once
 #include "VkRenderer.h"
+#include "VkCommandRecorder.h"
+#include "VkDescriptorAllocator.h"
+#include "shaders/ParticleLayout.h"
+#include "shaders/ParticlePopulation.h"
+#include "shaders/ParticleRender.h"
 //class Vertex;
 
 class VkGraphics
@@ -8,10 +13,14 @@ public:
 	VkGraphics(VkRenderer* pRenderer);
 	~VkGraphics();
 
-	void init(vk::Buffer vertexBuffer, uint32_t stride, size_t offsetPos,
-		size_t offsetCol, uint32_t verticesSize);
+	// One position buffer per simulation state, a single color buffer, both laid out as in ParticleLayout.h.
+	// Every state draws a quad per slot of its alive list, as many as the counters buffer says (ParticlePopulation.h).
+	void setParticleSize(float size) { renderParameters.particleSize = size; } // see RenderParameters, used from the next frame
+	void init(const vector<vk::Buffer>& positionBuffers, vk::Buffer colorBuffer, const vector<vk::Buffer>& aliveBuffers, vk::Buffer countersBuffer);
 	void clean();
-	void draw();
+	// Returns the value the graphics timeline reaches once this frame is done reading its state
+	uint64_t draw(uint32_t stateIndex, const TimelineWait& computeWait);
+	vk::Semaphore getTimeline() const { return timeline; }
 
 private:
 	VkRenderer* renderer;
@@ -19,30 +28,36 @@ private:
 	vk::Format swapchainImageFormat;
 	vk::Extent2D swapchainExtent;
 	vector<SwapchainImage> swapchainImages;
+	vk::DescriptorSetLayout descriptorSetLayout;
+	VkDescriptorAllocator descriptors{ renderer };
+	vector<vk::DescriptorSet> descriptorSets; // one per simulation state
+	RenderParameters renderParameters{ 0.01f, 1.0f, {0.0f, 0.0f} };
 	vk::PipelineLayout pipelineLayout;
 	vk::RenderPass renderPass;
 	vk::Pipeline graphicsPipeline;
 	vector<vk::Framebuffer> swapchainFramebuffers;
-	vk::CommandPool graphicsCommandPool;
-	vector<vk::CommandBuffer> commandBuffers;
+	VkCommandRecorder recorder{ renderer }; // re-records every frame, one set of pools per frame in flight
+	vk::Buffer countersBuffer;
+	uint32_t numStates = 0;
 	vector<vk::Semaphore> imageAvailable;
 	vector<vk::Semaphore> renderFinished;
-	const int MAX_FRAME_DRAWS = 2;
 	int currentFrame = 0;
 	vector<vk::Fence> drawFences;
+	vk::Semaphore timeline;
+	uint64_t timelineValue = 0;
 
 	void createSwapchain();
 	vk::SurfaceFormatKHR chooseBestSurfaceFormat(const vector<vk::SurfaceFormatKHR>& formats);
 	vk::PresentModeKHR chooseBestPresentationMode(const vector<vk::PresentModeKHR>& presentationModes);
 	vk::Extent2D chooseSwapExtent(const vk::SurfaceCapabilitiesKHR& surfaceCapabilities);
 	vk::ImageView createImageView(vk::Image image, vk::Format format, vk::ImageAspectFlags aspectFlags);
-	void createGraphicsPipeline(uint32_t stride, size_t offsetPos, size_t offsetCol);
+	void createDescriptorSetLayout();
+	void createDescriptorSets(const vector<vk::Buffer>& positionBuffers, vk::Buffer colorBuffer, const vector<vk::Buffer>& aliveBuffers);
+	void createGraphicsPipeline();
 	void createRenderPass();
 	void createFramebuffers();
-	void createGraphicsCommandPool();
-	void createGraphicsCommandBuffer();
 
-	void recordCommands(vk::Buffer outBuffer, uint32_t verticesSize);
+	vk::CommandBuffer recordCommands(uint32_t imageIndex, uint32_t stateIndex, const VkProfiler::GpuScope& gpuScope);
 	void createSynchronisation();
 };
 
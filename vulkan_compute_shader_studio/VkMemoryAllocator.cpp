@@ -0,0 +1,335 @@
+#include "VkMemoryAllocator.h"
+#include <stdexcept>
+#include <iostream>
+#include <algorithm>
+
+VkMemoryAllocator::VkMemoryAllocator()
+{
+}
+
+VkMemoryAllocator::~VkMemoryAllocator()
+{
+}
+
+void VkMemoryAllocator::init(vk::PhysicalDevice pPhysicalDevice, vk::Device pDevice, vk::DeviceSize pBlockSize)
+{
+	physicalDevice = pPhysicalDevice;
+	device = pDevice;
+	blockSize = pBlockSize;
+	memoryProperties = physicalDevice.getMemoryProperties();
+	vk::PhysicalDeviceLimits limits = physicalDevice.getProperties().limits;
+	maxAllocationCount = limits.maxMemoryAllocationCount;
+	nonCoherentAtomSize = limits.nonCoherentAtomSize;
+}
+
+Allocation VkMemoryAllocator::allocate(const vk::MemoryRequirements& pRequirements, MemoryUsage usage)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	Allocation allocation{};
+	allocation.memoryTypeIndex = findMemoryType(pRequirements.memoryTypeBits, usage);
+
+	// Flushes and invalidates work on whole atoms, non-coherent allocations own all the atoms they touch
+	// so that invalidating one never throws away unflushed writes of its neighbour
+	vk::MemoryRequirements requirements = pRequirements;
+	vk::MemoryPropertyFlags flags = memoryProperties.memoryTypes[allocation.memoryTypeIndex].propertyFlags;
+	allocation.hostCoherent = !(flags & vk::MemoryPropertyFlagBits::eHostVisible) || (flags & vk::MemoryPropertyFlagBits::eHostCoherent);
+	if (!allocation.hostCoherent)
+	{
+		requirements.alignment = std::max(requirements.alignment, nonCoherentAtomSize);
+		requirements.size = (requirements.size + nonCoherentAtomSize - 1) / nonCoherentAtomSize * nonCoherentAtomSize;
+	}
+	allocation.size = requirements.size;
+	vector<Block>& typeBlocks = blocks[allocation.memoryTypeIndex];
+
+	// Anything bigger than half a block gets its own memory, it would only fragment the shared ones
+	bool dedicated = requirements.size > blockSize / 2;
+	if (!dedicated)
+	{
+		for (uint32_t i = 0; i < typeBlocks.size(); ++i)
+		{
+			if (typeBlocks[i].memory && !typeBlocks[i].dedicated && allocateFromBlock(typeBlocks[i], requirements, allocation.offset))
+			{
+				allocation.blockIndex = i;
+				break;
+			}
+		}
+	}
+
+	if (allocation.blockIndex == uint32_t(-1))
+	{
+		allocation.blockIndex = createBlock(allocation.memoryTypeIndex, dedicated ? requirements.size : blockSize, dedicated);
+		if (!allocateFromBlock(typeBlocks[allocation.blockIndex], requirements, allocation.offset))
+		{
+			throw std::runtime_error("Failed to sub-allocate from a fresh memory block.");
+		}
+	}
+
+	Block& block = typeBlocks[allocation.blockIndex];
+	block.allocationCount++;
+	block.bytesUsed += allocation.size;
+	allocation.memory = block.memory;
+	if (block.mappedData)
+	{
+		allocation.mappedData = static_cast<char*>(block.mappedData) + allocation.offset;
+	}
+	return allocation;
+}
+
+Allocation VkMemoryAllocator::allocateBuffer(vk::Buffer buffer, MemoryUsage usage)
+{
+	vk::MemoryRequirements requirements = device.getBufferMemoryRequirements(buffer);
+	Allocation allocation = allocate(requirements, usage);
+	device.bindBufferMemory(buffer, allocation.memory, allocation.offset);
+	return allocation;
+}
+
+void VkMemoryAllocator::free(Allocation& allocation)
+{
+	if (!allocation.memory)
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	Block& block = blocks[allocation.memoryTypeIndex][allocation.blockIndex];
+	block.allocationCount--;
+	block.bytesUsed -= allocation.size;
+
+	if (block.dedicated)
+	{
+		if (block.mappedData)
+		{
+			device.unmapMemory(block.memory);
+		}
+		device.freeMemory(block.memory);
+		deviceAllocationCount--;
+		block = Block{};
+	}
+	else
+	{
+		// Put the range back in offset order and merge it with the free neighbours
+		FreeRange range{ allocation.offset, allocation.size };
+		auto next = std::lower_bound(block.freeRanges.begin(), block.freeRanges.end(), range,
+			[](const FreeRange& a, const FreeRange& b) { return a.offset < b.offset; });
+		next = block.freeRanges.insert(next, range);
+		if (next + 1 != block.freeRanges.end() && next->offset + next->size == (next + 1)->offset)
+		{
+			next->size += (next + 1)->size;
+			block.freeRanges.erase(next + 1);
+		}
+		if (next != block.freeRanges.begin() && (next - 1)->offset + (next - 1)->size == next->offset)
+		{
+			(next - 1)->size += next->size;
+			block.freeRanges.erase(next);
+		}
+	}
+
+	allocation = Allocation{};
+}
+
+void VkMemoryAllocator::flush(const Allocation& allocation, vk::DeviceSize offset, vk::DeviceSize size) const
+{
+	if (allocation.hostCoherent)
+	{
+		return;
+	}
+	std::lock_guard<std::mutex> lock(mutex);
+	device.flushMappedMemoryRanges(getMappedRange(allocation, offset, size));
+}
+
+void VkMemoryAllocator::invalidate(const Allocation& allocation, vk::DeviceSize offset, vk::DeviceSize size) const
+{
+	if (allocation.hostCoherent)
+	{
+		return;
+	}
+	std::lock_guard<std::mutex> lock(mutex);
+	device.invalidateMappedMemoryRanges(getMappedRange(allocation, offset, size));
+}
+
+VkMemoryAllocator::Statistics VkMemoryAllocator::getStatistics() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	Statistics statistics{};
+	statistics.deviceAllocationCount = deviceAllocationCount;
+	vk::DeviceSize bytesFree = 0;
+	for (uint32_t type = 0; type < VK_MAX_MEMORY_TYPES; ++type)
+	{
+		for (const Block& block : blocks[type])
+		{
+			if (!block.memory)
+			{
+				continue;
+			}
+			statistics.blockCount++;
+			statistics.allocationCount += block.allocationCount;
+			statistics.bytesReserved += block.size;
+			statistics.bytesUsed += block.bytesUsed;
+			for (const FreeRange& range : block.freeRanges)
+			{
+				bytesFree += range.size;
+				statistics.largestFreeRange = std::max(statistics.largestFreeRange, range.size);
+			}
+		}
+	}
+	if (bytesFree > 0)
+	{
+		statistics.fragmentation = 1.0f - float(statistics.largestFreeRange) / float(bytesFree);
+	}
+	return statistics;
+}
+
+void VkMemoryAllocator::printStatistics() const
+{
+	Statistics statistics = getStatistics();
+	std::cout << "Device memory: " << statistics.allocationCount << " allocations in " << statistics.blockCount << " blocks ("
+		<< statistics.deviceAllocationCount << "/" << maxAllocationCount << " vkAllocateMemory), "
+		<< statistics.bytesUsed / 1024 << "KB used of " << statistics.bytesReserved / 1024 << "KB reserved, "
+		<< "largest free range " << statistics.largestFreeRange / 1024 << "KB, fragmentation " << statistics.fragmentation * 100.0f << "%" << std::endl;
+}
+
+void VkMemoryAllocator::clean()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	for (uint32_t type = 0; type < VK_MAX_MEMORY_TYPES; ++type)
+	{
+		for (Block& block : blocks[type])
+		{
+			if (!block.memory)
+			{
+				continue;
+			}
+			if (block.mappedData)
+			{
+				device.unmapMemory(block.memory);
+			}
+			device.freeMemory(block.memory);
+		}
+		blocks[type].clear();
+	}
+	deviceAllocationCount = 0;
+}
+
+uint32_t VkMemoryAllocator::findMemoryType(uint32_t memoryTypeBits, MemoryUsage usage) const
+{
+	// Required flags rule a type out, preferred ones only rank the remaining types
+	vk::MemoryPropertyFlags required;
+	vk::MemoryPropertyFlags preferred;
+	vk::MemoryPropertyFlags avoided;
+	switch (usage)
+	{
+	case MemoryUsage::eGpuOnly:
+		preferred = vk::MemoryPropertyFlagBits::eDeviceLocal;
+		avoided = vk::MemoryPropertyFlagBits::eHostVisible;
+		break;
+	case MemoryUsage::eUpload:
+		required = vk::MemoryPropertyFlagBits::eHostVisible;
+		preferred = vk::MemoryPropertyFlagBits::eHostCoherent;
+		avoided = vk::MemoryPropertyFlagBits::eHostCached;
+		break;
+	case MemoryUsage::eReadback:
+		// Cached reads are much faster than uncached ones, worth an invalidate when it isn't coherent
+		required = vk::MemoryPropertyFlagBits::eHostVisible;
+		preferred = vk::MemoryPropertyFlagBits::eHostCached;
+		break;
+	}
+
+	uint32_t bestIndex = uint32_t(-1);
+	int bestScore = -1;
+	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i)
+	{
+		vk::MemoryPropertyFlags flags = memoryProperties.memoryTypes[i].propertyFlags;
+		if (!(memoryTypeBits & (1u << i)) || (flags & required) != required)
+		{
+			continue;
+		}
+		int score = ((flags & preferred) == preferred ? 2 : 0) + ((flags & avoided) ? 0 : 1);
+		if (score > bestScore)
+		{
+			bestScore = score;
+			bestIndex = i;
+		}
+	}
+
+	if (bestIndex == uint32_t(-1))
+	{
+		throw std::runtime_error("No memory type matches the requirements of this resource.");
+	}
+	return bestIndex;
+}
+
+uint32_t VkMemoryAllocator::createBlock(uint32_t memoryTypeIndex, vk::DeviceSize size, bool dedicated)
+{
+	if (deviceAllocationCount >= maxAllocationCount)
+	{
+		throw std::runtime_error("Reached maxMemoryAllocationCount, can't create another memory block.");
+	}
+
+	Block block{};
+	block.size = size;
+	block.dedicated = dedicated;
+	block.freeRanges.push_back({ 0, size });
+	vk::MemoryAllocateInfo memoryAllocateInfo(size, memoryTypeIndex);
+	block.memory = device.allocateMemory(memoryAllocateInfo);
+	deviceAllocationCount++;
+
+	if (memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible)
+	{
+		block.mappedData = device.mapMemory(block.memory, 0, VK_WHOLE_SIZE);
+	}
+
+	// Reuse the slot of a released dedicated block so indices held by live allocations stay valid
+	vector<Block>& typeBlocks = blocks[memoryTypeIndex];
+	for (uint32_t i = 0; i < typeBlocks.size(); ++i)
+	{
+		if (!typeBlocks[i].memory)
+		{
+			typeBlocks[i] = block;
+			return i;
+		}
+	}
+	typeBlocks.push_back(block);
+	return static_cast<uint32_t>(typeBlocks.size() - 1);
+}
+
+bool VkMemoryAllocator::allocateFromBlock(Block& block, const vk::MemoryRequirements& requirements, vk::DeviceSize& offset)
+{
+	// First fit, the alignment padding in front of the allocation stays in the free list
+	for (size_t i = 0; i < block.freeRanges.size(); ++i)
+	{
+		FreeRange range = block.freeRanges[i];
+		vk::DeviceSize alignedOffset = (range.offset + requirements.alignment - 1) / requirements.alignment * requirements.alignment;
+		vk::DeviceSize padding = alignedOffset - range.offset;
+		if (range.size < padding + requirements.size)
+		{
+			continue;
+		}
+
+		block.freeRanges.erase(block.freeRanges.begin() + i);
+		vk::DeviceSize remaining = range.size - padding - requirements.size;
+		if (remaining > 0)
+		{
+			block.freeRanges.insert(block.freeRanges.begin() + i, FreeRange{ alignedOffset + requirements.size, remaining });
+		}
+		if (padding > 0)
+		{
+			block.freeRanges.insert(block.freeRanges.begin() + i, FreeRange{ range.offset, padding });
+		}
+		offset = alignedOffset;
+		return true;
+	}
+	return false;
+}
+
+vk::MappedMemoryRange VkMemoryAllocator::getMappedRange(const Allocation& allocation, vk::DeviceSize offset, vk::DeviceSize size) const
+{
+	if (size == VK_WHOLE_SIZE)
+	{
+		size = allocation.size - offset;
+	}
+	vk::DeviceSize begin = (allocation.offset + offset) / nonCoherentAtomSize * nonCoherentAtomSize;
+	vk::DeviceSize end = (allocation.offset + offset + size + nonCoherentAtomSize - 1) / nonCoherentAtomSize * nonCoherentAtomSize;
+	// The last atom of a block may be partial, the range then has to stop at the end of the memory
+	end = std::min(end, blocks[allocation.memoryTypeIndex][allocation.blockIndex].size);
+	return vk::MappedMemoryRange(allocation.memory, begin, end - begin);
+}
@@ -0,0 +1,119 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <vector>
+#include <mutex>
+
+using std::vector;
+
+// What the memory is used for, decides which memory type it lands in
+enum class MemoryUsage
+{
+	eGpuOnly,	// DEVICE_LOCAL, only touched by the GPU
+	eUpload,	// HOST_VISIBLE, preferably HOST_COHERENT, written by the CPU and read by the GPU
+	eReadback	// HOST_VISIBLE, preferably HOST_CACHED, written by the GPU and read by the CPU
+};
+
+// Typed view over mapped memory (std::span is C++20)
+template<typename T>
+struct HostSpan
+{
+	T* ptr = nullptr;
+	size_t count = 0;
+
+	T* data() const { return ptr; }
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+	T& operator[](size_t i) const { return ptr[i]; }
+	T* begin() const { return ptr; }
+	T* end() const { return ptr + count; }
+};
+
+struct Allocation
+{
+	vk::DeviceMemory memory;
+	vk::DeviceSize offset = 0;
+	vk::DeviceSize size = 0;
+	uint32_t memoryTypeIndex = uint32_t(-1);
+	uint32_t blockIndex = uint32_t(-1);
+	void* mappedData = nullptr; // host-visible blocks stay mapped for their whole lifetime
+	bool hostCoherent = true;	// false when writes need VkMemoryAllocator::flush and reads ::invalidate
+
+	// Mapped memory seen as an array of T, empty if the allocation isn't host-visible
+	template<typename T>
+	HostSpan<T> as() const
+	{
+		return { static_cast<T*>(mappedData), mappedData ? static_cast<size_t>(size / sizeof(T)) : 0 };
+	}
+};
+
+// A buffer and the memory bound to it, see VkRenderer::createDeviceBuffer
+struct DeviceBuffer
+{
+	vk::Buffer buffer;
+	Allocation allocation;
+};
+
+// Hands out ranges of large vk::DeviceMemory blocks, one pool of blocks per memory type,
+// instead of one vkAllocateMemory per resource. Any thread may call it, the block lists are locked.
+class VkMemoryAllocator
+{
+public:
+	VkMemoryAllocator();
+	~VkMemoryAllocator();
+
+	struct Statistics
+	{
+		uint32_t blockCount = 0;
+		uint32_t allocationCount = 0;
+		uint32_t deviceAllocationCount = 0;	// live vkAllocateMemory calls, dedicated blocks included
+		vk::DeviceSize bytesReserved = 0;	// sum of the block sizes
+		vk::DeviceSize bytesUsed = 0;		// sum of the allocation sizes, alignment padding excluded
+		vk::DeviceSize largestFreeRange = 0;
+		float fragmentation = 0.0f;			// 1 - largest free range / total free bytes
+	};
+
+	void init(vk::PhysicalDevice pPhysicalDevice, vk::Device pDevice, vk::DeviceSize pBlockSize = 64 * 1024 * 1024);
+	Allocation allocate(const vk::MemoryRequirements& requirements, MemoryUsage usage);
+	Allocation allocateBuffer(vk::Buffer buffer, MemoryUsage usage); // allocates and binds
+	void free(Allocation& allocation);
+	// Make host writes visible to the device / device writes visible to the host, no-ops on coherent memory.
+	// Offsets are relative to the allocation and get widened to nonCoherentAtomSize.
+	void flush(const Allocation& allocation, vk::DeviceSize offset = 0, vk::DeviceSize size = VK_WHOLE_SIZE) const;
+	void invalidate(const Allocation& allocation, vk::DeviceSize offset = 0, vk::DeviceSize size = VK_WHOLE_SIZE) const;
+	Statistics getStatistics() const;
+	void printStatistics() const;
+	void clean();
+
+private:
+	struct FreeRange
+	{
+		vk::DeviceSize offset;
+		vk::DeviceSize size;
+	};
+
+	struct Block
+	{
+		vk::DeviceMemory memory;
+		vk::DeviceSize size = 0;
+		vector<FreeRange> freeRanges; // sorted by offset, neighbours are merged on free
+		uint32_t allocationCount = 0;
+		vk::DeviceSize bytesUsed = 0;
+		void* mappedData = nullptr;
+		bool dedicated = false; // sized for a single large allocation, released with it
+	};
+
+	vk::PhysicalDevice physicalDevice;
+	vk::Device device;
+	vk::PhysicalDeviceMemoryProperties memoryProperties;
+	uint32_t maxAllocationCount = 0;
+	uint32_t deviceAllocationCount = 0;
+	vk::DeviceSize blockSize = 0;
+	vk::DeviceSize nonCoherentAtomSize = 1;
+	vector<Block> blocks[VK_MAX_MEMORY_TYPES];
+	mutable std::mutex mutex; // guards blocks, the snapshot writer invalidates while the main thread allocates
+
+	uint32_t findMemoryType(uint32_t memoryTypeBits, MemoryUsage usage) const;
+	uint32_t createBlock(uint32_t memoryTypeIndex, vk::DeviceSize size, bool dedicated);
+	bool allocateFromBlock(Block& block, const vk::MemoryRequirements& requirements, vk::DeviceSize& offset);
+	vk::MappedMemoryRange getMappedRange(const Allocation& allocation, vk::DeviceSize offset, vk::DeviceSize size) const;
+};
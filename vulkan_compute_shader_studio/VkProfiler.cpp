@@ -0,0 +1,249 @@
+#include "VkProfiler.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <cstdint>
+#include <stdexcept>
+
+VkProfiler::VkProfiler()
+{
+}
+
+VkProfiler::~VkProfiler()
+{
+}
+
+void VkProfiler::GpuScope::begin(vk::CommandBuffer commandBuffer) const
+{
+	if (queryPool)
+	{
+		commandBuffer.writeTimestamp(startStage, queryPool, query);
+	}
+}
+
+void VkProfiler::GpuScope::end(vk::CommandBuffer commandBuffer) const
+{
+	if (queryPool)
+	{
+		commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, queryPool, query + 1);
+	}
+}
+
+VkProfiler::CpuScope::CpuScope(VkProfiler& pProfiler, const char* pName): profiler{pProfiler}, name{pName}
+{
+	start = profiler.enabled ? profiler.now() : 0.0;
+}
+
+VkProfiler::CpuScope::~CpuScope()
+{
+	if (!profiler.enabled)
+	{
+		return;
+	}
+	uint64_t threadId = std::hash<std::thread::id>()(std::this_thread::get_id());
+	profiler.addEvent({ name, 1, threadId, start, profiler.now() - start });
+}
+
+void VkProfiler::enable(const char* pTraceFileName)
+{
+	enabled = true;
+	traceFileName = pTraceFileName ? pTraceFileName : "";
+	epoch = std::chrono::steady_clock::now();
+}
+
+void VkProfiler::init(vk::PhysicalDevice physicalDevice, vk::Device pDevice, vk::Queue calibrationQueue, uint32_t calibrationFamily,
+	bool hostQueryReset, uint32_t pMaxScopes)
+{
+	if (!enabled)
+	{
+		return;
+	}
+	device = pDevice;
+
+	// Query pairs are reset from the host once their results are read, a reset recorded in the
+	// command buffer would leave the previous results visible until the GPU reaches it
+	for (const vk::QueueFamilyProperties& properties : physicalDevice.getQueueFamilyProperties())
+	{
+		timestampValidBits.push_back(properties.timestampValidBits);
+	}
+	timestampPeriod = physicalDevice.getProperties().limits.timestampPeriod;
+	gpuEnabled = hostQueryReset && timestampValidBits[calibrationFamily] > 0;
+	if (!gpuEnabled)
+	{
+		std::cout << "Profiler: no timestamp queries or host query reset on this device, only CPU spans are traced" << std::endl;
+		return;
+	}
+
+	vk::QueryPoolCreateInfo queryPoolCreateInfo(vk::QueryPoolCreateFlags(), vk::QueryType::eTimestamp, 2 * pMaxScopes);
+	queryPool = device.createQueryPool(queryPoolCreateInfo);
+	device.resetQueryPool(queryPool, 0, 2 * pMaxScopes);
+
+	slots.resize(pMaxScopes);
+	for (uint32_t i = pMaxScopes; i > 0; --i)
+	{
+		freeSlots.push_back(i - 1);
+	}
+	calibrate(calibrationQueue, calibrationFamily);
+}
+
+VkProfiler::GpuScope VkProfiler::beginGpuScope(const char* name, uint32_t queueFamily, vk::PipelineStageFlagBits startStage)
+{
+	if (!gpuEnabled || timestampValidBits[queueFamily] == 0)
+	{
+		return {};
+	}
+	if (freeSlots.empty())
+	{
+		droppedScopes++;
+		return {};
+	}
+
+	// The most recently read pair comes back first, so the same few go round and command buffers
+	// cached per pair stay few
+	uint32_t slotIndex = freeSlots.back();
+	freeSlots.pop_back();
+	slots[slotIndex].queueFamily = queueFamily;
+	slots[slotIndex].name = name;
+	pendingSlots.push_back(slotIndex);
+	return { queryPool, 2 * slotIndex, startStage };
+}
+
+void VkProfiler::collect()
+{
+	if (!gpuEnabled)
+	{
+		return;
+	}
+
+	// Queues finish out of order, every pending pair is checked rather than stopping at the first busy one
+	auto collected = std::remove_if(pendingSlots.begin(), pendingSlots.end(), [this](uint32_t slotIndex) {
+		uint64_t results[4]; // begin, availability, end, availability
+		vk::Result result = device.getQueryPoolResults(queryPool, 2 * slotIndex, 2, sizeof(results), results, 2 * sizeof(uint64_t),
+			vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWithAvailability);
+		if (result != vk::Result::eSuccess || results[1] == 0 || results[3] == 0)
+		{
+			return false;
+		}
+
+		const Slot& slot = slots[slotIndex];
+		uint32_t validBits = timestampValidBits[slot.queueFamily];
+		uint64_t mask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+		uint64_t ticks = (results[2] - results[0]) & mask;
+		double start = double(results[0] & mask) * timestampPeriod / 1000.0 + gpuOffset;
+		double duration = double(ticks) * timestampPeriod / 1000.0;
+		addEvent({ slot.name, 2, slot.queueFamily, start, duration });
+		ScopeStatistics& statistics = gpuStatistics[slot.name];
+		statistics.count++;
+		statistics.totalMicroseconds += duration;
+
+		device.resetQueryPool(queryPool, 2 * slotIndex, 2);
+		freeSlots.push_back(slotIndex);
+		return true;
+	});
+	pendingSlots.erase(collected, pendingSlots.end());
+}
+
+void VkProfiler::clean()
+{
+	if (!enabled)
+	{
+		return;
+	}
+	collect();
+	writeTrace();
+	if (!gpuEnabled)
+	{
+		return;
+	}
+	device.destroyQueryPool(queryPool);
+}
+
+VkProfiler::ScopeStatistics VkProfiler::getGpuStatistics(const char* name) const
+{
+	auto statisticsIterator = gpuStatistics.find(name);
+	return statisticsIterator != gpuStatistics.end() ? statisticsIterator->second : ScopeStatistics{};
+}
+
+double VkProfiler::now() const
+{
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+void VkProfiler::addEvent(const Event& event)
+{
+	if (traceFileName.empty())
+	{
+		return;
+	}
+	std::lock_guard<std::mutex> lock(eventMutex);
+	events.push_back(event);
+}
+
+void VkProfiler::calibrate(vk::Queue queue, uint32_t queueFamily)
+{
+	// GPU ticks have their own origin. One timestamp bracketed by CPU times puts both on the same
+	// timeline, within the submit latency, which is plenty to line the spans up in the trace.
+	vk::CommandPoolCreateInfo commandPoolInfo(vk::CommandPoolCreateFlagBits::eTransient, queueFamily);
+	vk::CommandPool commandPool = device.createCommandPool(commandPoolInfo);
+	vk::CommandBufferAllocateInfo commandBufferAllocateInfo(commandPool, vk::CommandBufferLevel::ePrimary, 1);
+	vk::CommandBuffer commandBuffer = device.allocateCommandBuffers(commandBufferAllocateInfo).front();
+	commandBuffer.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+	commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, queryPool, 0);
+	commandBuffer.end();
+
+	vk::Fence fence = device.createFence(vk::FenceCreateInfo());
+	vk::SubmitInfo submitInfo(0, nullptr, nullptr, 1, &commandBuffer);
+	double cpuBefore = now();
+	queue.submit(submitInfo, fence);
+	if (device.waitForFences(fence, VK_TRUE, UINT64_MAX) != vk::Result::eSuccess)
+	{
+		throw std::runtime_error("Failed to wait for the profiler calibration.");
+	}
+	double cpuAfter = now();
+
+	uint64_t ticks = 0;
+	if (device.getQueryPoolResults(queryPool, 0, 1, sizeof(ticks), &ticks, sizeof(ticks),
+		vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait) != vk::Result::eSuccess)
+	{
+		throw std::runtime_error("Failed to read the profiler calibration timestamp.");
+	}
+	gpuOffset = (cpuBefore + cpuAfter) / 2.0 - double(ticks) * timestampPeriod / 1000.0;
+
+	device.destroyFence(fence);
+	device.destroyCommandPool(commandPool);
+	device.resetQueryPool(queryPool, 0, 1);
+}
+
+void VkProfiler::writeTrace()
+{
+	if (traceFileName.empty())
+	{
+		return;
+	}
+	std::ofstream file(traceFileName, std::ios::trunc);
+	if (!file.is_open())
+	{
+		std::cout << "Profiler: can't write " << traceFileName << std::endl;
+		return;
+	}
+
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"CPU\"}},\n";
+	file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":2,\"args\":{\"name\":\"GPU queue families\"}}";
+	file.precision(3);
+	file << std::fixed;
+	for (const Event& event : events)
+	{
+		file << ",\n{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":" << event.pid << ",\"tid\":" << event.tid
+			<< ",\"ts\":" << event.start << ",\"dur\":" << event.duration << "}";
+	}
+	file << "\n]}\n";
+
+	std::cout << "Profiler: wrote " << events.size() << " spans to " << traceFileName;
+	if (droppedScopes > 0)
+	{
+		std::cout << ", " << droppedScopes << " GPU scopes dropped for lack of free queries";
+	}
+	std::cout << std::endl;
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <vector>
+#include <map>
+#include <string>
+#include <chrono>
+#include <mutex>
+
+using std::vector;
+
+// Times GPU work with timestamp query pairs and CPU code with scoped spans, and writes both into a
+// chrome://tracing JSON file on clean. Does nothing unless enable() is called before the renderer's init.
+class VkProfiler
+{
+public:
+	VkProfiler();
+	~VkProfiler();
+
+	// A timestamp pair recorded into the profiled command buffer itself, right before and right after
+	// the profiled commands. begin and end do nothing when not profiled.
+	struct GpuScope
+	{
+		vk::QueryPool queryPool;
+		uint32_t query = uint32_t(-1); // first of the pair, the same until its results are read
+		vk::PipelineStageFlagBits startStage = vk::PipelineStageFlagBits::eTopOfPipe;
+
+		void begin(vk::CommandBuffer commandBuffer) const;
+		void end(vk::CommandBuffer commandBuffer) const;
+	};
+
+	class CpuScope
+	{
+	public:
+		CpuScope(VkProfiler& pProfiler, const char* pName);
+		~CpuScope();
+
+	private:
+		VkProfiler& profiler;
+		const char* name;
+		double start;
+	};
+
+	struct ScopeStatistics
+	{
+		uint32_t count = 0;
+		double totalMicroseconds = 0.0;
+	};
+
+	// Without a file name only the GPU statistics are kept, for tools that report their own numbers
+	void enable(const char* pTraceFileName = nullptr);
+	bool isEnabled() const { return enabled; }
+	void init(vk::PhysicalDevice physicalDevice, vk::Device pDevice, vk::Queue calibrationQueue, uint32_t calibrationFamily,
+		bool hostQueryReset, uint32_t pMaxScopes = 512);
+	// Never blocks: the scope is dropped when every query pair is still waiting for its results.
+	// startStage is where the profiled commands start, and has to be one the submission's semaphore
+	// waits block: the begin timestamp is only written once they're signalled, so waits stay out of the span.
+	GpuScope beginGpuScope(const char* name, uint32_t queueFamily, vk::PipelineStageFlagBits startStage);
+	// Reads the query pairs the GPU is done with without waiting, about once per frame is enough
+	void collect();
+	ScopeStatistics getGpuStatistics(const char* name) const;
+	void resetGpuStatistics() { gpuStatistics.clear(); droppedScopes = 0; }
+	uint32_t getDroppedScopes() const { return droppedScopes; }
+	void clean(); // the device has to be idle
+
+private:
+	struct Event
+	{
+		const char* name;
+		uint32_t pid;		// 1 for the CPU, 2 for the GPU
+		uint64_t tid;		// CPU thread or GPU queue family
+		double start;		// microseconds since init
+		double duration;
+	};
+
+	struct Slot
+	{
+		uint32_t queueFamily = uint32_t(-1);
+		const char* name = nullptr;
+	};
+
+	bool enabled = false;
+	bool gpuEnabled = false;
+	std::string traceFileName;
+	std::chrono::steady_clock::time_point epoch;
+
+	vk::Device device;
+	vk::QueryPool queryPool;
+	double timestampPeriod = 1.0; // nanoseconds per tick
+	double gpuOffset = 0.0; // added to GPU microseconds to land on the CPU timeline
+	vector<uint32_t> timestampValidBits; // per queue family
+	vector<Slot> slots;
+	vector<uint32_t> freeSlots;
+	vector<uint32_t> pendingSlots;
+	uint32_t droppedScopes = 0;
+	std::map<std::string, ScopeStatistics> gpuStatistics;
+
+	std::mutex eventMutex;
+	vector<Event> events;
+
+	double now() const;
+	void addEvent(const Event& event);
+	void calibrate(vk::Queue queue, uint32_t queueFamily);
+	void writeTrace();
+};
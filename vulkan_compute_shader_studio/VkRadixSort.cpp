@@ -0,0 +1,185 @@
+#include "VkRadixSort.h"
+#include <stdexcept>
+#include <algorithm>
+
+VkRadixSort::VkRadixSort()
+{
+}
+
+VkRadixSort::VkRadixSort(VkRenderer* pRenderer, const char* pFileName): renderer{pRenderer}, shaderFileName{pFileName}
+{
+
+}
+
+VkRadixSort::~VkRadixSort()
+{
+}
+
+void VkRadixSort::init(uint32_t pMaxElements, uint32_t pWorkgroupSize)
+{
+	maxElements = pMaxElements;
+	workgroupSize = pWorkgroupSize;
+	chooseWorkgroupSize();
+	// The histogram entries are scanned in two levels, the second one by a single workgroup
+	uint64_t numEntries = uint64_t(RADIX_SORT_DIGITS) * getNumBlocks(maxElements);
+	if (numEntries > uint64_t(getTileSize()) * getTileSize())
+	{
+		throw std::runtime_error("Radix sort: too many elements for two scan levels at this workgroup size.");
+	}
+
+	sortShader.load_compute_shader(renderer);
+	createBuffers();
+	createDescriptorSetLayout();
+	createPipelines();
+	// A single frame: a sort waits for the previous one before recording
+	descriptors.init(1);
+	recorder.init(renderer->queueFamilyIndices.computeFamily, 1);
+	timeline = renderer->createTimelineSemaphore();
+}
+
+uint64_t VkRadixSort::submit(uint32_t numElements, const vk::DescriptorBufferInfo& keys, const vk::DescriptorBufferInfo& payloads,
+	const vector<TimelineWait>& waits)
+{
+	VkProfiler::CpuScope cpuScope(renderer->profiler, "VkRadixSort::submit");
+	if (numElements > maxElements)
+	{
+		throw std::runtime_error("Radix sort: more elements than it was initialised for.");
+	}
+	// A single frame of command pools, the previous sort has to be done before they're reset
+	wait(timelineValue);
+	recorder.beginFrame(0);
+	descriptors.beginFrame(0);
+	vk::CommandBuffer commandBuffer = recordCommands(numElements, keys, payloads);
+	renderer->submitTimeline(renderer->computeQueue, { commandBuffer }, waits, timeline, ++timelineValue);
+	return timelineValue;
+}
+
+void VkRadixSort::wait(uint64_t value)
+{
+	renderer->waitTimelineSemaphore(timeline, value);
+}
+
+void VkRadixSort::clean()
+{
+	vk::Device device = renderer->mainDevices.device;
+	device.destroySemaphore(timeline);
+	recorder.clean();
+	descriptors.clean();
+	for (vk::Pipeline pipeline : pipelines)
+	{
+		device.destroyPipeline(pipeline);
+	}
+	sortShader.cleanUp(renderer);
+
+	renderer->destroyDeviceBuffer(keyBuffer);
+	renderer->destroyDeviceBuffer(payloadBuffer);
+	renderer->destroyDeviceBuffer(histogramBuffer);
+	renderer->destroyDeviceBuffer(blockSumBuffer);
+}
+
+void VkRadixSort::chooseWorkgroupSize()
+{
+	vk::PhysicalDeviceLimits limits = renderer->mainDevices.physicalDevice.getProperties().limits;
+	uint32_t maxSize = std::min({ limits.maxComputeWorkGroupSize[0], limits.maxComputeWorkGroupInvocations, 256u });
+	if (workgroupSize == 0)
+	{
+		workgroupSize = maxSize;
+	}
+	workgroupSize = std::min(workgroupSize, maxSize);
+}
+
+void VkRadixSort::createBuffers()
+{
+	// Only the internal buffers, the sorted ones belong to the caller
+	keyBuffer = renderer->createDeviceBuffer(vk::DeviceSize(maxElements) * sizeof(uint32_t), vk::BufferUsageFlagBits::eStorageBuffer);
+	payloadBuffer = renderer->createDeviceBuffer(vk::DeviceSize(maxElements) * sizeof(uint32_t), vk::BufferUsageFlagBits::eStorageBuffer);
+	histogramBuffer = renderer->createDeviceBuffer(vk::DeviceSize(RADIX_SORT_DIGITS) * getNumBlocks(maxElements) * sizeof(uint32_t),
+		vk::BufferUsageFlagBits::eStorageBuffer);
+	blockSumBuffer = renderer->createDeviceBuffer(vk::DeviceSize(getTileSize()) * sizeof(uint32_t), vk::BufferUsageFlagBits::eStorageBuffer);
+}
+
+void VkRadixSort::createDescriptorSetLayout()
+{
+	descriptorSetLayout = renderer->descriptorCache.getSetLayout(vk::DescriptorType::eStorageBuffer, RADIX_SORT_BINDING_COUNT,
+		vk::ShaderStageFlagBits::eCompute);
+}
+
+void VkRadixSort::createPipelines()
+{
+	vk::PushConstantRange pushConstantRange(vk::ShaderStageFlagBits::eCompute, 0, sizeof(RadixSortParameters));
+	pipelineLayout = renderer->descriptorCache.getPipelineLayout({ descriptorSetLayout }, { pushConstantRange });
+
+	for (uint32_t kernel = 0; kernel < RADIX_SORT_NUM_KERNELS; ++kernel)
+	{
+		pipelines[kernel] = sortShader.createPipeline(renderer, pipelineLayout, { workgroupSize, kernel });
+	}
+}
+
+std::array<vk::DescriptorSet, 2> VkRadixSort::createDescriptorSets(const vk::DescriptorBufferInfo& keys, const vk::DescriptorBufferInfo& payloads)
+{
+	std::array<vk::DescriptorSet, 2> sets = { descriptors.allocateTransient(descriptorSetLayout), descriptors.allocateTransient(descriptorSetLayout) };
+
+	// Even passes read the caller's buffers and write the internal ones, odd passes the other way round
+	vk::DescriptorBufferInfo internalKeys(keyBuffer.buffer, 0, VK_WHOLE_SIZE);
+	vk::DescriptorBufferInfo internalPayloads(payloadBuffer.buffer, 0, VK_WHOLE_SIZE);
+	vk::DescriptorBufferInfo histograms(histogramBuffer.buffer, 0, VK_WHOLE_SIZE);
+	vk::DescriptorBufferInfo blockSums(blockSumBuffer.buffer, 0, VK_WHOLE_SIZE);
+	std::array<std::array<vk::DescriptorBufferInfo, RADIX_SORT_BINDING_COUNT>, 2> bufferInfos = { {
+		{ keys, payloads, internalKeys, internalPayloads, histograms, blockSums },
+		{ internalKeys, internalPayloads, keys, payloads, histograms, blockSums } } };
+
+	for (uint32_t i = 0; i < 2; ++i)
+	{
+		for (uint32_t binding = 0; binding < RADIX_SORT_BINDING_COUNT; ++binding)
+		{
+			descriptors.write(sets[i], binding, bufferInfos[i][binding]);
+		}
+	}
+	descriptors.flushWrites();
+	return sets;
+}
+
+vk::CommandBuffer VkRadixSort::recordCommands(uint32_t numElements, const vk::DescriptorBufferInfo& keys, const vk::DescriptorBufferInfo& payloads)
+{
+	std::array<vk::DescriptorSet, 2> sets = createDescriptorSets(keys, payloads);
+	uint32_t numBlocks = getNumBlocks(numElements);
+	uint32_t numEntries = RADIX_SORT_DIGITS * numBlocks;
+	uint32_t numScanBlocks = (numEntries + getTileSize() - 1) / getTileSize();
+
+	// Nothing to record in parallel, every kernel depends on the one before
+	vector<VkCommandRecorder::RecordFunction> passes;
+	passes.push_back([&](vk::CommandBuffer commandBuffer) {
+		// Every kernel reads what the one before wrote, a global barrier covers all the buffers at once
+		vk::MemoryBarrier kernelBarrier(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+		auto dispatchAndWait = [&](uint32_t kernel, uint32_t numGroups) {
+			dispatchKernel(commandBuffer, kernel, numGroups);
+			commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader,
+				vk::DependencyFlags(), kernelBarrier, {}, {});
+		};
+
+		for (uint32_t pass = 0; pass < RADIX_SORT_PASSES; ++pass)
+		{
+			RadixSortParameters parameters{ numElements, pass * RADIX_SORT_BITS, numBlocks, 0 };
+			commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipelineLayout, 0, sets[pass % 2], {});
+			commandBuffer.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(RadixSortParameters), &parameters);
+
+			dispatchAndWait(RADIX_SORT_KERNEL_HISTOGRAM, numBlocks);
+			dispatchAndWait(RADIX_SORT_KERNEL_SCAN_BLOCKS, numScanBlocks);
+			dispatchAndWait(RADIX_SORT_KERNEL_SCAN_BLOCK_SUMS, 1);
+			dispatchAndWait(RADIX_SORT_KERNEL_ADD_BLOCK_SUMS, (numEntries + workgroupSize - 1) / workgroupSize);
+			dispatchAndWait(RADIX_SORT_KERNEL_SCATTER, numBlocks);
+		}
+	});
+	VkProfiler::GpuScope gpuScope = renderer->profiler.beginGpuScope("radix sort", renderer->queueFamilyIndices.computeFamily,
+		vk::PipelineStageFlagBits::eComputeShader);
+	return recorder.record(passes, nullptr, gpuScope);
+}
+
+void VkRadixSort::dispatchKernel(vk::CommandBuffer commandBuffer, uint32_t kernel, uint32_t numGroups)
+{
+	// Pipelines share the layout, the bound set and push constants stay valid across binds
+	commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, pipelines[kernel]);
+	vk::Extent2D groupCount = renderer->getGroupCount(numGroups);
+	commandBuffer.dispatch(groupCount.width, groupCount.height, 1);
+}
+
@@ -0,0 +1,61 @@
+#pragma once
+#include "VkRenderer.h"
+#include "VkComputeShader.h"
+#include "VkCommandRecorder.h"
+#include "VkDescriptorAllocator.h"
+#include "shaders/RadixSortLayout.h"
+#include <array>
+
+// GPU LSD radix sort of uint32 keys, each carrying a uint32 payload (usually the index of what the key
+// belongs to). RADIX_SORT_PASSES passes of histogram, scan and stable scatter, ping-ponging with
+// internal buffers and ending back in the caller's. Runs on the compute queue with its own timeline.
+class VkRadixSort
+{
+public:
+	VkRadixSort();
+	VkRadixSort(VkRenderer* pRenderer, const char* pFileName);
+	~VkRadixSort();
+
+	// 0 picks the workgroup size, which is capped at 256 to keep the 16 bit rank counters from overflowing
+	void init(uint32_t pMaxElements, uint32_t pWorkgroupSize = 0);
+	// Sorts keys ascending in place, payloads move with them and equal keys keep their order.
+	// Non-blocking, returns the value the timeline reaches once both buffers are sorted.
+	uint64_t submit(uint32_t numElements, const vk::DescriptorBufferInfo& keys, const vk::DescriptorBufferInfo& payloads,
+		const vector<TimelineWait>& waits = {});
+	void wait(uint64_t value);
+	vk::Semaphore getTimeline() const { return timeline; }
+	uint32_t getWorkgroupSize() const { return workgroupSize; }
+	void clean();
+
+private:
+	VkRenderer* renderer;
+	const char* shaderFileName;
+	VkComputeShader sortShader{ shaderFileName };
+
+	uint32_t maxElements = 0;
+	uint32_t workgroupSize = 0;
+
+	vk::DescriptorSetLayout descriptorSetLayout;
+	vk::PipelineLayout pipelineLayout;
+	std::array<vk::Pipeline, RADIX_SORT_NUM_KERNELS> pipelines;
+	VkDescriptorAllocator descriptors{ renderer }; // transient sets, every sort writes its own
+	VkCommandRecorder recorder{ renderer };
+	vk::Semaphore timeline;
+	uint64_t timelineValue = 0;
+
+	DeviceBuffer keyBuffer;			// odd passes write here
+	DeviceBuffer payloadBuffer;
+	DeviceBuffer histogramBuffer;	// RADIX_SORT_DIGITS entries per block of keys
+	DeviceBuffer blockSumBuffer;	// one entry per block of histogram entries
+
+	uint32_t getTileSize() const { return workgroupSize * RADIX_SORT_ITEMS_PER_INVOCATION; }
+	uint32_t getNumBlocks(uint32_t numElements) const { return (numElements + getTileSize() - 1) / getTileSize(); }
+	void chooseWorkgroupSize();
+	void createBuffers();
+	void createDescriptorSetLayout();
+	void createPipelines();
+	std::array<vk::DescriptorSet, 2> createDescriptorSets(const vk::DescriptorBufferInfo& keys, const vk::DescriptorBufferInfo& payloads);
+
+	vk::CommandBuffer recordCommands(uint32_t numElements, const vk::DescriptorBufferInfo& keys, const vk::DescriptorBufferInfo& payloads);
+	void dispatchKernel(vk::CommandBuffer commandBuffer, uint32_t kernel, uint32_t numGroups);
+};
@@ -0,0 +1,254 @@
+#include "VkReduceScan.h"
+#include <stdexcept>
+#include <algorithm>
+#include <array>
+
+VkReduceScan::VkReduceScan()
+{
+}
+
+VkReduceScan::VkReduceScan(VkRenderer* pRenderer, const char* pFileName, const char* pSubgroupFileName): renderer{pRenderer},
+shaderFileName{pFileName}, subgroupShaderFileName{pSubgroupFileName}
+{
+
+}
+
+VkReduceScan::~VkReduceScan()
+{
+}
+
+void VkReduceScan::init(uint32_t pMaxElements, bool allowSubgroups, uint32_t pWorkgroupSize)
+{
+	maxElements = pMaxElements;
+	workgroupSize = pWorkgroupSize;
+	checkSubgroupSupport(allowSubgroups);
+	chooseWorkgroupSize();
+	if (subgroupArithmetic)
+	{
+		subgroupShader.load_compute_shader(renderer);
+	}
+	else
+	{
+		sharedMemoryShader.load_compute_shader(renderer);
+	}
+	createBuffers();
+	createDescriptorSetLayout();
+	// A single frame: an operation waits for the previous one before recording
+	descriptors.init(1);
+	recorder.init(renderer->queueFamilyIndices.computeFamily, 1);
+	timeline = renderer->createTimelineSemaphore();
+}
+
+uint64_t VkReduceScan::reduce(ReduceScanType type, ReduceScanOp op, uint32_t numElements, const vk::DescriptorBufferInfo& input,
+	const vk::DescriptorBufferInfo& output, const vector<TimelineWait>& waits)
+{
+	VkProfiler::CpuScope cpuScope(renderer->profiler, "VkReduceScan::reduce");
+	if (numElements > maxElements)
+	{
+		throw std::runtime_error("Reduce: more elements than it was initialised for.");
+	}
+	beginRecording();
+
+	// Every level reduces each tile to one value until a single tile is left, which writes the output
+	vk::Pipeline pipeline = getPipeline(REDUCE_SCAN_KERNEL_REDUCE, type, op);
+	vector<Dispatch> dispatches;
+	vk::DescriptorBufferInfo levelInput = input;
+	uint32_t count = numElements;
+	for (uint32_t level = 0; ; ++level)
+	{
+		uint32_t numTiles = getNumTiles(count);
+		vk::DescriptorBufferInfo levelOutput = numTiles == 1 ? output : getLevelBufferInfo(level % 2);
+		dispatches.push_back({ pipeline, createDescriptorSet(levelInput, levelOutput, levelBuffers.back().buffer), { count, 0, {} }, numTiles });
+		if (numTiles == 1)
+		{
+			break;
+		}
+		levelInput = levelOutput;
+		count = numTiles;
+	}
+	return submitDispatches("reduce", dispatches, waits);
+}
+
+uint64_t VkReduceScan::scan(ReduceScanType type, ReduceScanOp op, bool inclusive, uint32_t numElements, const vk::DescriptorBufferInfo& input,
+	const vk::DescriptorBufferInfo& output, const vector<TimelineWait>& waits)
+{
+	VkProfiler::CpuScope cpuScope(renderer->profiler, "VkReduceScan::scan");
+	if (numElements > maxElements)
+	{
+		throw std::runtime_error("Scan: more elements than it was initialised for.");
+	}
+	beginRecording();
+
+	// Going up, every level scans its tiles and hands the tile totals to the next one, which scans them
+	// exclusively in place. Going down, each level's tiles are offset by the scanned totals.
+	vk::Pipeline scanPipeline = getPipeline(REDUCE_SCAN_KERNEL_SCAN_BLOCKS, type, op);
+	vk::Pipeline addPipeline = getPipeline(REDUCE_SCAN_KERNEL_ADD_BLOCK_PREFIX, type, op);
+	struct Level
+	{
+		vk::DescriptorSet descriptorSet;
+		uint32_t count;
+	};
+	vector<Level> levels;
+	vector<Dispatch> dispatches;
+	vk::DescriptorBufferInfo levelInput = input;
+	vk::DescriptorBufferInfo levelOutput = output;
+	uint32_t count = numElements;
+	for (uint32_t level = 0; ; ++level)
+	{
+		vk::DescriptorSet descriptorSet = createDescriptorSet(levelInput, levelOutput, levelBuffers[level].buffer);
+		uint32_t numTiles = getNumTiles(count);
+		dispatches.push_back({ scanPipeline, descriptorSet, { count, level == 0 && inclusive ? 1u : 0u, {} }, numTiles });
+		levels.push_back({ descriptorSet, count });
+		if (numTiles == 1)
+		{
+			break;
+		}
+		levelInput = getLevelBufferInfo(level);
+		levelOutput = levelInput;
+		count = numTiles;
+	}
+	for (size_t level = levels.size() - 1; level > 0; --level)
+	{
+		const Level& lower = levels[level - 1];
+		dispatches.push_back({ addPipeline, lower.descriptorSet, { lower.count, 0, {} }, (lower.count + workgroupSize - 1) / workgroupSize });
+	}
+	return submitDispatches("scan", dispatches, waits);
+}
+
+void VkReduceScan::wait(uint64_t value)
+{
+	renderer->waitTimelineSemaphore(timeline, value);
+}
+
+void VkReduceScan::clean()
+{
+	vk::Device device = renderer->mainDevices.device;
+	device.destroySemaphore(timeline);
+	recorder.clean();
+	descriptors.clean();
+	for (auto& pipeline : pipelines)
+	{
+		device.destroyPipeline(pipeline.second);
+	}
+	pipelines.clear();
+	(subgroupArithmetic ? subgroupShader : sharedMemoryShader).cleanUp(renderer);
+
+	for (DeviceBuffer& levelBuffer : levelBuffers)
+	{
+		renderer->destroyDeviceBuffer(levelBuffer);
+	}
+	levelBuffers.clear();
+}
+
+void VkReduceScan::checkSubgroupSupport(bool allowSubgroups)
+{
+	// Subgroup operations are core in Vulkan 1.1, but which ones and in which stages is up to the device
+	auto propertiesChain = renderer->mainDevices.physicalDevice.getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceSubgroupProperties>();
+	const vk::PhysicalDeviceSubgroupProperties& subgroupProperties = propertiesChain.get<vk::PhysicalDeviceSubgroupProperties>();
+	vk::SubgroupFeatureFlags required = vk::SubgroupFeatureFlagBits::eBasic | vk::SubgroupFeatureFlagBits::eArithmetic;
+	subgroupArithmetic = allowSubgroups
+		&& (subgroupProperties.supportedStages & vk::ShaderStageFlagBits::eCompute)
+		&& (subgroupProperties.supportedOperations & required) == required;
+}
+
+void VkReduceScan::chooseWorkgroupSize()
+{
+	vk::PhysicalDeviceLimits limits = renderer->mainDevices.physicalDevice.getProperties().limits;
+	uint32_t maxSize = std::min(limits.maxComputeWorkGroupSize[0], limits.maxComputeWorkGroupInvocations);
+	auto propertiesChain = renderer->mainDevices.physicalDevice.getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceSubgroupProperties>();
+	uint32_t subgroupSize = std::max(propertiesChain.get<vk::PhysicalDeviceSubgroupProperties>().subgroupSize, 1u);
+	if (workgroupSize == 0)
+	{
+		workgroupSize = 256;
+	}
+	// Whole subgroups only, the subgroup path takes each subgroup's total from its elected lane
+	workgroupSize = std::max(std::min(workgroupSize, maxSize) / subgroupSize * subgroupSize, std::min(subgroupSize, maxSize));
+}
+
+void VkReduceScan::createBuffers()
+{
+	// Level k holds the tile totals of level k, down to a single value. Reductions only need more than
+	// one level buffer when they have more than one tile, and the last buffer fills their unused block sums binding.
+	uint32_t count = maxElements;
+	do
+	{
+		count = getNumTiles(count);
+		levelBuffers.push_back(renderer->createDeviceBuffer(vk::DeviceSize(count) * sizeof(uint32_t), vk::BufferUsageFlagBits::eStorageBuffer));
+	} while (count > 1);
+}
+
+void VkReduceScan::createDescriptorSetLayout()
+{
+	descriptorSetLayout = renderer->descriptorCache.getSetLayout(vk::DescriptorType::eStorageBuffer, REDUCE_SCAN_BINDING_COUNT,
+		vk::ShaderStageFlagBits::eCompute);
+	vk::PushConstantRange pushConstantRange(vk::ShaderStageFlagBits::eCompute, 0, sizeof(ReduceScanParameters));
+	pipelineLayout = renderer->descriptorCache.getPipelineLayout({ descriptorSetLayout }, { pushConstantRange });
+}
+
+vk::Pipeline VkReduceScan::getPipeline(uint32_t kernel, ReduceScanType type, ReduceScanOp op)
+{
+	// 3 kernels x 3 types x 3 operations, only the combinations actually used get compiled
+	uint32_t key = kernel | static_cast<uint32_t>(type) << 4 | static_cast<uint32_t>(op) << 8;
+	auto pipelineIterator = pipelines.find(key);
+	if (pipelineIterator != pipelines.end())
+	{
+		return pipelineIterator->second;
+	}
+
+	vk::Pipeline pipeline = (subgroupArithmetic ? subgroupShader : sharedMemoryShader).createPipeline(renderer, pipelineLayout,
+		{ workgroupSize, kernel, static_cast<uint32_t>(type), static_cast<uint32_t>(op) });
+	pipelines[key] = pipeline;
+	return pipeline;
+}
+
+vk::DescriptorSet VkReduceScan::createDescriptorSet(const vk::DescriptorBufferInfo& input, const vk::DescriptorBufferInfo& output, vk::Buffer blockSums)
+{
+	// Queued, submitDispatches sends the writes of every set at once
+	vk::DescriptorSet descriptorSet = descriptors.allocateTransient(descriptorSetLayout);
+	std::array<vk::DescriptorBufferInfo, REDUCE_SCAN_BINDING_COUNT> bufferInfos = { input, output, { blockSums, 0, VK_WHOLE_SIZE } };
+	for (uint32_t binding = 0; binding < REDUCE_SCAN_BINDING_COUNT; ++binding)
+	{
+		descriptors.write(descriptorSet, binding, bufferInfos[binding]);
+	}
+	return descriptorSet;
+}
+
+vk::DescriptorBufferInfo VkReduceScan::getLevelBufferInfo(size_t level) const
+{
+	return { levelBuffers[level].buffer, 0, VK_WHOLE_SIZE };
+}
+
+void VkReduceScan::beginRecording()
+{
+	// A single frame of command pools, the previous operation has to be done before they're reset
+	wait(timelineValue);
+	recorder.beginFrame(0);
+	descriptors.beginFrame(0);
+}
+
+uint64_t VkReduceScan::submitDispatches(const char* scopeName, const vector<Dispatch>& dispatches, const vector<TimelineWait>& waits)
+{
+	descriptors.flushWrites();
+
+	// Nothing to record in parallel, every level depends on the one before
+	vector<VkCommandRecorder::RecordFunction> passes;
+	passes.push_back([&](vk::CommandBuffer commandBuffer) {
+		// Every level reads what the one before wrote, and callers read the last one after the timeline wait
+		vk::MemoryBarrier levelBarrier(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+		for (const Dispatch& dispatch : dispatches)
+		{
+			commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, dispatch.pipeline);
+			commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipelineLayout, 0, dispatch.descriptorSet, {});
+			commandBuffer.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(ReduceScanParameters), &dispatch.parameters);
+			vk::Extent2D groupCount = renderer->getGroupCount(dispatch.numGroups);
+			commandBuffer.dispatch(groupCount.width, groupCount.height, 1);
+			commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader,
+				vk::DependencyFlags(), levelBarrier, {}, {});
+		}
+	});
+	VkProfiler::GpuScope gpuScope = renderer->profiler.beginGpuScope(scopeName, renderer->queueFamilyIndices.computeFamily,
+		vk::PipelineStageFlagBits::eComputeShader);
+	vk::CommandBuffer commandBuffer = recorder.record(passes, nullptr, gpuScope);
+	renderer->submitTimeline(renderer->computeQueue, { commandBuffer }, waits, timeline, ++timelineValue);
+	return timelineValue;
+}
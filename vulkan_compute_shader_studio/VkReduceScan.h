@@ -0,0 +1,92 @@
+#pragma once
+#include "VkRenderer.h"
+#include "VkComputeShader.h"
+#include "VkCommandRecorder.h"
+#include "VkDescriptorAllocator.h"
+#include "shaders/ReduceScanLayout.h"
+#include <map>
+#include <algorithm>
+
+enum class ReduceScanType
+{
+	eInt = REDUCE_SCAN_TYPE_INT,
+	eUint = REDUCE_SCAN_TYPE_UINT,
+	eFloat = REDUCE_SCAN_TYPE_FLOAT
+};
+
+enum class ReduceScanOp
+{
+	eSum = REDUCE_SCAN_OP_SUM,
+	eMin = REDUCE_SCAN_OP_MIN,
+	eMax = REDUCE_SCAN_OP_MAX
+};
+
+// GPU reductions and inclusive/exclusive prefix scans of int, uint and float buffers. Workgroups use
+// subgroup arithmetic when the device supports it in compute shaders, shared memory trees otherwise.
+// Inputs longer than a tile go through one more level per tile factor, all recorded in one submission
+// on the compute queue that signals the object's own timeline.
+class VkReduceScan
+{
+public:
+	VkReduceScan();
+	VkReduceScan(VkRenderer* pRenderer, const char* pFileName, const char* pSubgroupFileName);
+	~VkReduceScan();
+
+	// allowSubgroups false forces the shared memory path, to compare both on the same device
+	void init(uint32_t pMaxElements, bool allowSubgroups = true, uint32_t pWorkgroupSize = 0);
+	// Non-blocking, output[0] holds the result once the returned timeline value is reached
+	uint64_t reduce(ReduceScanType type, ReduceScanOp op, uint32_t numElements, const vk::DescriptorBufferInfo& input,
+		const vk::DescriptorBufferInfo& output, const vector<TimelineWait>& waits = {});
+	// Non-blocking, output may be the input buffer
+	uint64_t scan(ReduceScanType type, ReduceScanOp op, bool inclusive, uint32_t numElements, const vk::DescriptorBufferInfo& input,
+		const vk::DescriptorBufferInfo& output, const vector<TimelineWait>& waits = {});
+	void wait(uint64_t value);
+	vk::Semaphore getTimeline() const { return timeline; }
+	bool usesSubgroups() const { return subgroupArithmetic; }
+	uint32_t getWorkgroupSize() const { return workgroupSize; }
+	void clean();
+
+private:
+	VkRenderer* renderer;
+	const char* shaderFileName;
+	const char* subgroupShaderFileName;
+	VkComputeShader sharedMemoryShader{ shaderFileName };
+	VkComputeShader subgroupShader{ subgroupShaderFileName };
+
+	uint32_t maxElements = 0;
+	uint32_t workgroupSize = 0;
+	bool subgroupArithmetic = false;
+
+	vk::DescriptorSetLayout descriptorSetLayout;
+	vk::PipelineLayout pipelineLayout;
+	std::map<uint32_t, vk::Pipeline> pipelines; // created on first use, see getPipeline
+	VkDescriptorAllocator descriptors{ renderer }; // transient sets, every submission writes its own
+	VkCommandRecorder recorder{ renderer };
+	vk::Semaphore timeline;
+	uint64_t timelineValue = 0;
+
+	// Scan level k writes its tile totals to levelBuffers[k], which level k + 1 scans in place.
+	// Reductions ping-pong their partial results between the first two.
+	vector<DeviceBuffer> levelBuffers;
+
+	uint32_t getTileSize() const { return workgroupSize * REDUCE_SCAN_ITEMS_PER_INVOCATION; }
+	uint32_t getNumTiles(uint32_t numElements) const { return std::max((numElements + getTileSize() - 1) / getTileSize(), 1u); }
+	void checkSubgroupSupport(bool allowSubgroups);
+	void chooseWorkgroupSize();
+	void createBuffers();
+	void createDescriptorSetLayout();
+	vk::Pipeline getPipeline(uint32_t kernel, ReduceScanType type, ReduceScanOp op);
+	vk::DescriptorSet createDescriptorSet(const vk::DescriptorBufferInfo& input, const vk::DescriptorBufferInfo& output, vk::Buffer blockSums);
+	vk::DescriptorBufferInfo getLevelBufferInfo(size_t level) const;
+
+	// The levels of an operation, planned before anything is recorded
+	struct Dispatch
+	{
+		vk::Pipeline pipeline;
+		vk::DescriptorSet descriptorSet;
+		ReduceScanParameters parameters;
+		uint32_t numGroups;
+	};
+	void beginRecording();
+	uint64_t submitDispatches(const char* scopeName, const vector<Dispatch>& dispatches, const vector<TimelineWait>& waits);
+};
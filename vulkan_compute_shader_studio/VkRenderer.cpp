@@ -1,6 +1,9 @@
 #include "VkRenderer.h"
 #include <set>
 #include <iostream>
+#include <cstring>
+#include <map>
+#include <algorithm>
 
 VkRenderer::VkRenderer()
 {
@@ -13,14 +16,26 @@ VkRenderer::~VkRenderer()
 int VkRenderer::init(GLFWwindow* pWindow)
 {
     window = pWindow;
+    headless = (window == nullptr);
+    if (!headless)
+    {
+        requiredDeviceExtensions = deviceExtensions;
+    }
     try
     {
         createInstance();
-        createSurface();
+        if (!headless)
+        {
+            createSurface();
+        }
         getPhysicalDevice();
         getQueueFamilyIndices();
         createDevice();
         createQueues();
+        allocator.init(mainDevices.physicalDevice, mainDevices.device);
+        descriptorCache.init(mainDevices.device);
+        profiler.init(mainDevices.physicalDevice, mainDevices.device, computeQueue, queueFamilyIndices.computeFamily, hostQueryReset);
+        createPipelineCache();
     }
     catch (const std::runtime_error& e)
     {
@@ -39,17 +54,25 @@ void VkRenderer::createInstance()
     1,
     nullptr,
     0,
-    VK_API_VERSION_1_1
+    VK_API_VERSION_1_2
     };
 
-    const vector<const char*> layers = { "VK_LAYER_KHRONOS_validation" }; // VK_LAYER_KHRONOS_validation = debug help
+    // Batch nodes usually don't have the SDK installed, only enable validation when it's there
+    vector<const char*> layers;
+    if (checkValidationLayerSupport("VK_LAYER_KHRONOS_validation")) // VK_LAYER_KHRONOS_validation = debug help
+    {
+        layers.push_back("VK_LAYER_KHRONOS_validation");
+    }
 
     vector<const char*> instanceExtensions;
-    uint32_t glfwExtensionCount = 0;
-    const char** glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-    for (size_t i = 0; i < glfwExtensionCount; ++i)
+    if (!headless)
     {
-        instanceExtensions.push_back(glfwExtensions[i]);
+        uint32_t glfwExtensionCount = 0;
+        const char** glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+        for (size_t i = 0; i < glfwExtensionCount; ++i)
+        {
+            instanceExtensions.push_back(glfwExtensions[i]);
+        }
     }
 
     if (!checkInstanceExtensionSupport(instanceExtensions))
@@ -108,11 +131,24 @@ bool VkRenderer::checkInstanceExtensionSupport(const vector<const char*>& checkE
     return true;
 }
 
+bool VkRenderer::checkValidationLayerSupport(const char* layerName)
+{
+    vector<vk::LayerProperties> availableLayers = vk::enumerateInstanceLayerProperties();
+    for (const auto& layer : availableLayers)
+    {
+        if (strcmp(layerName, layer.layerName) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
 bool VkRenderer::checkDeviceExtensionSupport()
 {
     vector<vk::ExtensionProperties> extensions = mainDevices.physicalDevice.enumerateDeviceExtensionProperties(nullptr);
 
-    for (auto deviceextension : deviceExtensions)
+    for (auto deviceextension : requiredDeviceExtensions)
     {
         bool hasextension = false;
         for (const auto& extension : extensions)
@@ -132,18 +168,28 @@ bool VkRenderer::checkDeviceSuitable(vk::PhysicalDevice physicalDevice)
 {
     vk::PhysicalDeviceProperties physicalDeviceProperties = physicalDevice.getProperties();
     vk::PhysicalDeviceFeatures physicalDeviceFeatures = physicalDevice.getFeatures();
+    getQueueFamilyIndices();
     
     bool extensionsSupported = checkDeviceExtensionSupport();
 
-    bool swapchainValid = false;
+    // Compute and graphics are chained with timeline semaphores, core since Vulkan 1.2
+    bool timelineSupported = false;
+    if (physicalDeviceProperties.apiVersion >= VK_API_VERSION_1_2)
+    {
+        auto featureChain = physicalDevice.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan12Features>();
+        timelineSupported = featureChain.get<vk::PhysicalDeviceVulkan12Features>().timelineSemaphore;
+    }
 
-    if (extensionsSupported)
+    // Without a surface there is nothing to present to, any device with a compute queue will do
+    bool swapchainValid = headless;
+
+    if (extensionsSupported && !headless)
     {
         SwapchainDetails swapchainDetails = getSwapchainDetails();
         swapchainValid = !swapchainDetails.presentationModes.empty() && !swapchainDetails.formats.empty();
     }
 
-    return queueFamilyIndices.isValid() && extensionsSupported && swapchainValid;
+    return queueFamilyIndices.isValid(headless) && extensionsSupported && swapchainValid && timelineSupported;
 }
 
 void VkRenderer::getPhysicalDevice()
@@ -154,46 +200,116 @@ void VkRenderer::getPhysicalDevice()
     {
         throw std::runtime_error("Can't find any GPU that supports vulkan, and what are you gonna do about it?");
     }
+    // Every suitable device is scored and the best one wins, so a discrete GPU listed after an integrated one still gets picked
+    bool foundDevice = false;
+    vk::PhysicalDevice bestDevice;
+    uint64_t bestScore = 0;
     for (const auto& device : physicalDevices)
     {
         mainDevices.physicalDevice = device;
 
         if (checkDeviceSuitable(device))
         {
-            mainDevices.physicalDevice = device;
-            break;
+            uint64_t score = scoreDevice(device);
+            if (!foundDevice || score > bestScore)
+            {
+                bestDevice = device;
+                bestScore = score;
+            }
+            foundDevice = true;
         }
     }
+    if (!foundDevice)
+    {
+        throw std::runtime_error("None of the available devices is suitable for this simulation.");
+    }
+    mainDevices.physicalDevice = bestDevice;
+    printf("Using %s (score %llu)\n", bestDevice.getProperties().deviceName.data(), static_cast<unsigned long long>(bestScore));
+}
 
+uint64_t VkRenderer::scoreDevice(vk::PhysicalDevice physicalDevice)
+{
+    // Called right after checkDeviceSuitable, queueFamilyIndices are still the ones of this device
+    vk::PhysicalDeviceProperties physicalDeviceProperties = physicalDevice.getProperties();
+    uint64_t score = 0;
+    switch (physicalDeviceProperties.deviceType)
+    {
+    case vk::PhysicalDeviceType::eDiscreteGpu:   score += 10000; break;
+    case vk::PhysicalDeviceType::eIntegratedGpu: score += 5000; break;
+    case vk::PhysicalDeviceType::eVirtualGpu:    score += 2000; break;
+    case vk::PhysicalDeviceType::eOther:         score += 1000; break;
+    default: break; // CPU implementations like lavapipe only when nothing else is there
+    }
+
+    // One point per 64MiB of the biggest device-local heap, the state ring has to fit in it
+    vk::PhysicalDeviceMemoryProperties memoryProperties = physicalDevice.getMemoryProperties();
+    vk::DeviceSize deviceLocalSize = 0;
+    for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; ++i)
+    {
+        if (memoryProperties.memoryHeaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal)
+        {
+            deviceLocalSize = std::max(deviceLocalSize, memoryProperties.memoryHeaps[i].size);
+        }
+    }
+    score += deviceLocalSize >> 26;
+
+    // Queues that can run next to the graphics one: async compute matters more than async uploads
+    vector<vk::QueueFamilyProperties> queueFamilyProperties = physicalDevice.getQueueFamilyProperties();
+    vk::QueueFlags computeFlags = queueFamilyProperties[queueFamilyIndices.computeFamily].queueFlags;
+    if (!(computeFlags & requestedQueueFlags.eGraphics) || queueFamilyIndices.computeQueueIndex != 0)
+    {
+        score += 500;
+    }
+    if (queueFamilyIndices.transferFamily != queueFamilyIndices.computeFamily || queueFamilyIndices.transferQueueIndex != queueFamilyIndices.computeQueueIndex)
+    {
+        score += 250;
+    }
+    return score;
 }
 
 void VkRenderer::createDevice()
 {
-    float queuePriority = 1.0f;
-    uint32_t numQueues = 2;
+    vector<float> queuePriorities(3, 1.0f);
     vector<vk::DeviceQueueCreateInfo> queuesCreateInfos;
 
-    
-    std::set<uint32_t> indices = { queueFamilyIndices.computeFamily, queueFamilyIndices.graphicsFamily };
+    // Number of queues taken from each family, one past the highest queue index handed out
+    std::map<uint32_t, uint32_t> queueCounts;
+    queueCounts[queueFamilyIndices.computeFamily] = queueFamilyIndices.computeQueueIndex + 1;
+    uint32_t& transferCount = queueCounts[queueFamilyIndices.transferFamily];
+    transferCount = std::max(transferCount, queueFamilyIndices.transferQueueIndex + 1);
+    if (!headless)
+    {
+        uint32_t& graphicsCount = queueCounts[queueFamilyIndices.graphicsFamily];
+        graphicsCount = std::max(graphicsCount, 1u);
+        uint32_t& presentationCount = queueCounts[queueFamilyIndices.presentationFamily];
+        presentationCount = std::max(presentationCount, 1u);
+    }
 
-    for (auto index : indices) {
+    for (auto queueCount : queueCounts) {
         vk::DeviceQueueCreateInfo deviceComputeQueueCreateInfo{};
         deviceComputeQueueCreateInfo.sType = vk::StructureType::eDeviceQueueCreateInfo;
         deviceComputeQueueCreateInfo.flags = vk::DeviceQueueCreateFlags();
         deviceComputeQueueCreateInfo.pNext = nullptr;
-        deviceComputeQueueCreateInfo.queueCount = 1;
-        deviceComputeQueueCreateInfo.queueFamilyIndex = index;
-        deviceComputeQueueCreateInfo.pQueuePriorities = &queuePriority;
+        deviceComputeQueueCreateInfo.queueCount = queueCount.second;
+        deviceComputeQueueCreateInfo.queueFamilyIndex = queueCount.first;
+        deviceComputeQueueCreateInfo.pQueuePriorities = queuePriorities.data();
         queuesCreateInfos.push_back(deviceComputeQueueCreateInfo);
     }
     vk::PhysicalDeviceFeatures deviceFeatures{};
+    // Host query reset is optional, the profiler only traces CPU spans without it
+    auto featureChain = mainDevices.physicalDevice.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan12Features>();
+    hostQueryReset = featureChain.get<vk::PhysicalDeviceVulkan12Features>().hostQueryReset;
+    vk::PhysicalDeviceVulkan12Features vulkan12Features{};
+    vulkan12Features.timelineSemaphore = VK_TRUE;
+    vulkan12Features.hostQueryReset = hostQueryReset;
     vk::DeviceCreateInfo deviceCreateInfo = {};
+    deviceCreateInfo.pNext = &vulkan12Features;
     deviceCreateInfo.flags = vk::DeviceCreateFlags();
     deviceCreateInfo.queueCreateInfoCount = queuesCreateInfos.size();
     deviceCreateInfo.pQueueCreateInfos = queuesCreateInfos.data();
     deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
-    deviceCreateInfo.enabledExtensionCount = deviceExtensions.size();
-    deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();
+    deviceCreateInfo.enabledExtensionCount = requiredDeviceExtensions.size();
+    deviceCreateInfo.ppEnabledExtensionNames = requiredDeviceExtensions.data();
 
 
     mainDevices.device = mainDevices.physicalDevice.createDevice(deviceCreateInfo);
@@ -201,8 +317,13 @@ void VkRenderer::createDevice()
 
 void VkRenderer::createQueues()
 {
+    computeQueue = mainDevices.device.getQueue(queueFamilyIndices.computeFamily, queueFamilyIndices.computeQueueIndex);
+    transferQueue = mainDevices.device.getQueue(queueFamilyIndices.transferFamily, queueFamilyIndices.transferQueueIndex);
+    if (headless)
+    {
+        return;
+    }
     graphicsQueue = mainDevices.device.getQueue(queueFamilyIndices.graphicsFamily, 0);
-    computeQueue = mainDevices.device.getQueue(queueFamilyIndices.computeFamily, 0);
     presentationQueue = mainDevices.device.getQueue(queueFamilyIndices.presentationFamily, 0);
 }
 
@@ -211,31 +332,95 @@ void VkRenderer::getQueueFamilyIndices()
 
     vector<vk::QueueFamilyProperties> queueFamilyProperties = mainDevices.physicalDevice.getQueueFamilyProperties();
 
-    auto computePropertiesIterator = std::find_if(queueFamilyProperties.begin(), queueFamilyProperties.end(), [&](const vk::QueueFamilyProperties& properties)
+    // First family that has all the required flags and none of the excluded ones
+    auto findFamily = [&](vk::QueueFlags required, vk::QueueFlags excluded) -> uint32_t
+    {
+        auto propertiesIterator = std::find_if(queueFamilyProperties.begin(), queueFamilyProperties.end(), [&](const vk::QueueFamilyProperties& properties)
+            {
+                return properties.queueCount > 0 && (properties.queueFlags & required) == required && !(properties.queueFlags & excluded);
+            });
+        if (propertiesIterator == queueFamilyProperties.end())
         {
-            return properties.queueFlags & requestedQueueFlags.eCompute;
-        });
+            return uint32_t(-1);
+        }
+        return std::distance(queueFamilyProperties.begin(), propertiesIterator);
+    };
 
-    queueFamilyIndices.computeFamily = std::distance(queueFamilyProperties.begin(), computePropertiesIterator);
+    queueFamilyIndices.computeFamily = uint32_t(-1);
+    queueFamilyIndices.graphicsFamily = uint32_t(-1);
+    queueFamilyIndices.presentationFamily = uint32_t(-1);
+    queueFamilyIndices.transferFamily = uint32_t(-1);
+    queueFamilyIndices.computeQueueIndex = 0;
+    queueFamilyIndices.transferQueueIndex = 0;
 
-    auto graphicsPropertiesIterator = std::find_if(queueFamilyProperties.begin(), queueFamilyProperties.end(), [&](const vk::QueueFamilyProperties& properties)
+    if (!headless)
+    {
+        // Graphics and presentation on the same family when possible, the swapchain images then stay exclusive
+        for (uint32_t i = 0; i < queueFamilyProperties.size(); ++i)
         {
-            return properties.queueFlags & requestedQueueFlags.eGraphics;
-        });
+            if (queueFamilyProperties[i].queueCount == 0) continue;
+            bool graphicsSupport = bool(queueFamilyProperties[i].queueFlags & requestedQueueFlags.eGraphics);
+            bool presentationSupport = mainDevices.physicalDevice.getSurfaceSupportKHR(i, surface);
+            if (graphicsSupport && queueFamilyIndices.graphicsFamily == uint32_t(-1))
+            {
+                queueFamilyIndices.graphicsFamily = i;
+            }
+            if (presentationSupport && queueFamilyIndices.presentationFamily == uint32_t(-1))
+            {
+                queueFamilyIndices.presentationFamily = i;
+            }
+            if (graphicsSupport && presentationSupport)
+            {
+                queueFamilyIndices.graphicsFamily = i;
+                queueFamilyIndices.presentationFamily = i;
+                break;
+            }
+        }
+    }
 
-    uint32_t temp_index = std::distance(queueFamilyProperties.begin(), graphicsPropertiesIterator);
-    vk::Bool32 presentationSupport = false;
-    presentationSupport = mainDevices.physicalDevice.getSurfaceSupportKHR(temp_index, surface);
-    if (temp_index >= 0 && presentationSupport)
+    // A compute family without graphics runs the steps asynchronously next to the draws, otherwise any compute family
+    queueFamilyIndices.computeFamily = findFamily(requestedQueueFlags.eCompute, requestedQueueFlags.eGraphics);
+    if (queueFamilyIndices.computeFamily == uint32_t(-1))
     {
-        queueFamilyIndices.presentationFamily = temp_index;
-        queueFamilyIndices.graphicsFamily = temp_index;
+        queueFamilyIndices.computeFamily = findFamily(requestedQueueFlags.eCompute, vk::QueueFlags());
+    }
+    if (queueFamilyIndices.computeFamily == uint32_t(-1))
+    {
+        return;
     }
 
+    // Uploads prefer a transfer only family (the DMA engines), compute and graphics families can always transfer
+    queueFamilyIndices.transferFamily = findFamily(requestedQueueFlags.eTransfer, requestedQueueFlags.eCompute | requestedQueueFlags.eGraphics);
+    if (queueFamilyIndices.transferFamily == uint32_t(-1))
+    {
+        queueFamilyIndices.transferFamily = queueFamilyIndices.computeFamily;
+    }
 
+    // When families are shared, take another queue of the family if it has one so the work can still overlap,
+    // and share the last queue when they're all taken
+    std::map<uint32_t, uint32_t> takenQueues;
+    if (!headless && queueFamilyIndices.graphicsFamily != uint32_t(-1))
+    {
+        takenQueues[queueFamilyIndices.graphicsFamily] = 1;
+    }
+    auto takeQueue = [&](uint32_t family) -> uint32_t
+    {
+        uint32_t index = std::min(takenQueues[family], queueFamilyProperties[family].queueCount - 1);
+        takenQueues[family] = index + 1;
+        return index;
+    };
+    queueFamilyIndices.computeQueueIndex = takeQueue(queueFamilyIndices.computeFamily);
+    queueFamilyIndices.transferQueueIndex = takeQueue(queueFamilyIndices.transferFamily);
+}
 
-    queueFamilyIndices.graphicsFamily = std::distance(queueFamilyProperties.begin(), graphicsPropertiesIterator);
-
+vector<uint32_t> VkRenderer::getQueueFamilies()
+{
+    std::set<uint32_t> families = { queueFamilyIndices.computeFamily, queueFamilyIndices.transferFamily };
+    if (!headless)
+    {
+        families.insert(queueFamilyIndices.graphicsFamily);
+    }
+    return vector<uint32_t>(families.begin(), families.end());
 }
 
 vk::ShaderModule VkRenderer::createShader(std::vector<char> shaderCode)
@@ -249,9 +434,156 @@ vk::ShaderModule VkRenderer::createShader(std::vector<char> shaderCode)
     return shaderModule;
 }
 
+DeviceBuffer VkRenderer::createDeviceBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage)
+{
+    vector<uint32_t> queueFamilies = getQueueFamilies();
+    bool concurrent = queueFamilies.size() > 1;
+    vk::BufferCreateInfo bufferCreateInfo{
+        vk::BufferCreateFlags(),
+        size,
+        usage,
+        concurrent ? vk::SharingMode::eConcurrent : vk::SharingMode::eExclusive,
+        concurrent ? static_cast<uint32_t>(queueFamilies.size()) : 1u,
+        queueFamilies.data()
+    };
+    DeviceBuffer deviceBuffer;
+    deviceBuffer.buffer = mainDevices.device.createBuffer(bufferCreateInfo);
+    deviceBuffer.allocation = allocator.allocateBuffer(deviceBuffer.buffer, MemoryUsage::eGpuOnly);
+    return deviceBuffer;
+}
+
+void VkRenderer::destroyDeviceBuffer(DeviceBuffer& deviceBuffer)
+{
+    mainDevices.device.destroyBuffer(deviceBuffer.buffer);
+    allocator.free(deviceBuffer.allocation);
+    deviceBuffer.buffer = nullptr;
+}
+
+vk::Semaphore VkRenderer::createTimelineSemaphore(uint64_t initialValue)
+{
+    vk::SemaphoreTypeCreateInfo semaphoreTypeCreateInfo(vk::SemaphoreType::eTimeline, initialValue);
+    vk::SemaphoreCreateInfo semaphoreCreateInfo{};
+    semaphoreCreateInfo.pNext = &semaphoreTypeCreateInfo;
+    return mainDevices.device.createSemaphore(semaphoreCreateInfo);
+}
+
+void VkRenderer::waitTimelineSemaphore(vk::Semaphore semaphore, uint64_t value)
+{
+    vk::SemaphoreWaitInfo semaphoreWaitInfo(vk::SemaphoreWaitFlags(), 1, &semaphore, &value);
+    vk::Result result = mainDevices.device.waitSemaphores(semaphoreWaitInfo, uint64_t(-1));
+    if (result != vk::Result::eSuccess)
+    {
+        throw std::runtime_error("Failed to wait on a timeline semaphore.");
+    }
+}
+
+void VkRenderer::submitTimeline(vk::Queue queue, const vector<vk::CommandBuffer>& commandBuffers, const vector<TimelineWait>& waits,
+    vk::Semaphore semaphore, uint64_t value)
+{
+    vector<vk::Semaphore> waitSemaphores;
+    vector<uint64_t> waitValues;
+    vector<vk::PipelineStageFlags> waitStages;
+    for (const TimelineWait& waitInfo : waits)
+    {
+        waitSemaphores.push_back(waitInfo.semaphore);
+        waitValues.push_back(waitInfo.value);
+        waitStages.push_back(waitInfo.stage);
+    }
+
+    vk::TimelineSemaphoreSubmitInfo timelineSubmitInfo{};
+    timelineSubmitInfo.waitSemaphoreValueCount = static_cast<uint32_t>(waitValues.size());
+    timelineSubmitInfo.pWaitSemaphoreValues = waitValues.data();
+    timelineSubmitInfo.signalSemaphoreValueCount = 1;
+    timelineSubmitInfo.pSignalSemaphoreValues = &value;
+
+    vk::SubmitInfo submitInfo(0, nullptr, nullptr, static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
+    submitInfo.pNext = &timelineSubmitInfo;
+    submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+    submitInfo.pWaitSemaphores = waitSemaphores.data();
+    submitInfo.pWaitDstStageMask = waitStages.data();
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &semaphore;
+    queue.submit(submitInfo, nullptr);
+}
+
+vk::Extent2D VkRenderer::getGroupCount(uint32_t numGroups)
+{
+    // Groups that don't fit in maxComputeWorkGroupCount[0] spill over into y,
+    // the shaders flatten their id back with gl_NumWorkGroups.x
+    uint32_t maxGroupsX = mainDevices.physicalDevice.getProperties().limits.maxComputeWorkGroupCount[0];
+    uint32_t groupCountX = std::min(numGroups, maxGroupsX);
+    uint32_t groupCountY = groupCountX > 0 ? (numGroups + groupCountX - 1) / groupCountX : 0;
+    return vk::Extent2D(groupCountX, groupCountY);
+}
+
+string VkRenderer::getPipelineCacheFileName()
+{
+    // One file per GPU so machines with several devices don't keep invalidating each other's cache
+    vk::PhysicalDeviceProperties properties = mainDevices.physicalDevice.getProperties();
+    return "pipeline_cache_" + std::to_string(properties.vendorID) + "_" + std::to_string(properties.deviceID) + ".bin";
+}
+
+void VkRenderer::createPipelineCache()
+{
+    vector<char> cacheData;
+    std::ifstream file{ getPipelineCacheFileName(), std::ios::binary | std::ios::ate };
+    if (file.is_open())
+    {
+        cacheData.resize(static_cast<size_t>(file.tellg()));
+        file.seekg(0);
+        file.read(cacheData.data(), cacheData.size());
+        file.close();
+    }
+
+    // Header version one: length, version, vendorID, deviceID, pipelineCacheUUID.
+    // The UUID changes with the driver build, a stale cache is thrown away rather than handed to it.
+    vk::PhysicalDeviceProperties properties = mainDevices.physicalDevice.getProperties();
+    const size_t headerSize = 4 * sizeof(uint32_t) + VK_UUID_SIZE;
+    bool valid = cacheData.size() >= headerSize;
+    if (valid)
+    {
+        uint32_t header[4];
+        memcpy(header, cacheData.data(), sizeof(header));
+        valid = header[0] >= headerSize
+            && header[1] == static_cast<uint32_t>(vk::PipelineCacheHeaderVersion::eOne)
+            && header[2] == properties.vendorID
+            && header[3] == properties.deviceID
+            && memcmp(cacheData.data() + sizeof(header), properties.pipelineCacheUUID.data(), VK_UUID_SIZE) == 0;
+    }
+    if (!valid)
+    {
+        cacheData.clear();
+    }
+
+    vk::PipelineCacheCreateInfo pipelineCacheCreateInfo(vk::PipelineCacheCreateFlags(), cacheData.size(), cacheData.data());
+    pipelineCache = mainDevices.device.createPipelineCache(pipelineCacheCreateInfo);
+    pipelineCacheWarm = valid;
+}
+
+void VkRenderer::savePipelineCache()
+{
+    vector<uint8_t> cacheData = mainDevices.device.getPipelineCacheData(pipelineCache);
+    std::ofstream file{ getPipelineCacheFileName(), std::ios::binary | std::ios::trunc };
+    if (!file.is_open())
+    {
+        printf("WARNING: Could not write the pipeline cache, next start will be cold.\n");
+        return;
+    }
+    file.write(reinterpret_cast<const char*>(cacheData.data()), cacheData.size());
+    file.close();
+}
+
 void VkRenderer::cleanUp()
 {
-    instance.destroySurfaceKHR(surface);
+    profiler.clean();
+    savePipelineCache();
+    mainDevices.device.destroyPipelineCache(pipelineCache);
+    descriptorCache.clean();
+    allocator.clean();
+    if (!headless)
+    {
+        instance.destroySurfaceKHR(surface);
+    }
     mainDevices.device.destroy();
     instance.destroy();
 }
\ No newline at end of file
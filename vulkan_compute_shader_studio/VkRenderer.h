@@ -6,6 +6,10 @@
 #include <vector>
 #include <array>
 #include "VkUtilities.h"
+#include "VkMemoryAllocator.h"
+#include "VkDescriptorCache.h"
+#include "VkProfiler.h"
+#include "ThreadPool.h"
 
 
 
@@ -26,42 +30,74 @@ public:
 	struct {
 		vk::QueueFlagBits eCompute = vk::QueueFlagBits::eCompute;
 		vk::QueueFlagBits eGraphics = vk::QueueFlagBits::eGraphics;
+		vk::QueueFlagBits eTransfer = vk::QueueFlagBits::eTransfer;
 	} requestedQueueFlags;
 
 	struct {
 		uint32_t graphicsFamily = -1;
 		uint32_t presentationFamily = -1;
 		uint32_t  computeFamily = -1;
-		bool isValid()
+		uint32_t transferFamily = -1;
+		// Queue index inside the family, compute and transfer get their own queue when the family has a spare one
+		uint32_t computeQueueIndex = 0;
+		uint32_t transferQueueIndex = 0;
+		bool isValid(bool computeOnly = false)
 		{
-			return graphicsFamily >= 0 && presentationFamily >= 0 && computeFamily >= 0;
+			if (computeOnly) return computeFamily != uint32_t(-1);
+			return graphicsFamily != uint32_t(-1) && presentationFamily != uint32_t(-1) && computeFamily != uint32_t(-1);
 		}
 	} queueFamilyIndices;
 
 	vk::Queue computeQueue;
 	vk::Queue graphicsQueue;
 	vk::Queue presentationQueue;
+	vk::Queue transferQueue;
 	vk::Instance instance;
 	GLFWwindow* window;
 	vk::SurfaceKHR surface;
+	vk::PipelineCache pipelineCache; // shared by every pipeline, persisted between runs
+	VkMemoryAllocator allocator;
+	VkDescriptorCache descriptorCache; // set and pipeline layouts, shared by every kernel with the same bindings
+	VkProfiler profiler; // call profiler.enable() before init to trace the run
+	ThreadPool threadPool; // host workers shared by everything that records or computes in parallel
+	bool pipelineCacheWarm = false; // true when a valid cache was loaded from disk
+	bool headless = false; // compute only: no window, surface, swapchain or graphics queue
+	bool hostQueryReset = false; // vkResetQueryPool from the host, enabled when the device has it
 
-	int init(GLFWwindow* pWindow);
+	int init(GLFWwindow* pWindow); // pass a null window to init in headless mode
 	void draw();
 	void cleanUp();
 	vk::ShaderModule createShader(std::vector<char> shaderCode);
+	// Device-local, concurrent over getQueueFamilies() when there's more than one so any queue can use it
+	DeviceBuffer createDeviceBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage);
+	void destroyDeviceBuffer(DeviceBuffer& deviceBuffer);
+	vk::Semaphore createTimelineSemaphore(uint64_t initialValue = 0);
+	void waitTimelineSemaphore(vk::Semaphore semaphore, uint64_t value);
+	// Submits the command buffers once every wait is reached, then signals value on the timeline semaphore
+	void submitTimeline(vk::Queue queue, const vector<vk::CommandBuffer>& commandBuffers, const vector<TimelineWait>& waits,
+		vk::Semaphore semaphore, uint64_t value);
+	// numGroups workgroups as a dispatch size, what doesn't fit in x spills over into y
+	vk::Extent2D getGroupCount(uint32_t numGroups);
 	SwapchainDetails getSwapchainDetails();
+	vector<uint32_t> getQueueFamilies(); // distinct families resources may be shared between
 
 private:
 
 	void createInstance();
 	void createSurface();
 	bool checkInstanceExtensionSupport(const vector<const char*>& checkExtensions);
+	bool checkValidationLayerSupport(const char* layerName);
 	void getPhysicalDevice();
 	bool checkDeviceSuitable(vk::PhysicalDevice physicalDevice);
+	uint64_t scoreDevice(vk::PhysicalDevice physicalDevice);
 	void createDevice();
 	void createQueues();
+	void createPipelineCache();
+	void savePipelineCache();
+	string getPipelineCacheFileName();
 	void getQueueFamilyIndices();
 	bool checkDeviceExtensionSupport();
 
+	vector<const char*> requiredDeviceExtensions;
 };
 
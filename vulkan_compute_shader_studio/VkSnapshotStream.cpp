@@ -0,0 +1,251 @@
+#include "VkSnapshotStream.h"
+#include <iostream>
+#include <chrono>
+#include <cstring>
+#include <cstddef>
+#include <cstdio>
+#include <stdexcept>
+
+VkSnapshotStream::VkSnapshotStream(VkRenderer* pRenderer) : renderer{ pRenderer }
+{
+}
+
+VkSnapshotStream::~VkSnapshotStream()
+{
+}
+
+void VkSnapshotStream::init(const char* fileName, uint32_t pElementCount, const vector<uint32_t>& pColumns, uint32_t numSlots)
+{
+	elementCount = pElementCount;
+	columns = pColumns;
+	frameDataSize = 0;
+	for (uint32_t column : columns)
+	{
+		frameDataSize += vk::DeviceSize(elementCount) * getParticleFileColumnStride(column);
+	}
+
+	file.open(fileName, std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+	{
+		throw std::runtime_error(string("Can't write snapshots to ") + fileName);
+	}
+	ParticleFileHeader header{ PARTICLE_FILE_MAGIC, PARTICLE_FILE_VERSION, elementCount, static_cast<uint32_t>(columns.size()), 0, 0 };
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	for (uint32_t column : columns)
+	{
+		ParticleFileColumn columnDescriptor{ column, getParticleFileColumnStride(column) };
+		file.write(reinterpret_cast<const char*>(&columnDescriptor), sizeof(columnDescriptor));
+	}
+
+	// The copies run on the compute queue, in order with the steps that write the buffers
+	vk::Device device = renderer->mainDevices.device;
+	vk::CommandPoolCreateInfo commandPoolInfo(vk::CommandPoolCreateFlagBits::eResetCommandBuffer, renderer->queueFamilyIndices.computeFamily);
+	commandPool = device.createCommandPool(commandPoolInfo);
+	vector<vk::CommandBuffer> commandBuffers = device.allocateCommandBuffers(vk::CommandBufferAllocateInfo(commandPool, vk::CommandBufferLevel::ePrimary, numSlots));
+	slots.resize(numSlots);
+	for (uint32_t i = 0; i < numSlots; ++i)
+	{
+		// The alive count goes right after the columns
+		vk::BufferCreateInfo bufferCreateInfo(vk::BufferCreateFlags(), frameDataSize + sizeof(uint32_t), vk::BufferUsageFlagBits::eTransferDst);
+		slots[i].buffer = device.createBuffer(bufferCreateInfo);
+		slots[i].allocation = renderer->allocator.allocateBuffer(slots[i].buffer, MemoryUsage::eReadback);
+		slots[i].commandBuffer = commandBuffers[i];
+	}
+	timeline = renderer->createTimelineSemaphore();
+	writer = std::thread(&VkSnapshotStream::writerLoop, this);
+}
+
+bool VkSnapshotStream::capture(uint64_t step, const vector<vk::Buffer>& columnBuffers, vk::Buffer countersBuffer, vk::DeviceSize aliveCountOffset)
+{
+	Slot* slot = acquireSlot();
+	if (!slot)
+	{
+		return false;
+	}
+
+	vk::CommandBuffer commandBuffer = slot->commandBuffer;
+	commandBuffer.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+	VkProfiler::GpuScope gpuScope = renderer->profiler.beginGpuScope("snapshot copy", renderer->queueFamilyIndices.computeFamily,
+		vk::PipelineStageFlagBits::eTransfer);
+	// The step that wrote the columns and the counters was submitted right before
+	vk::MemoryBarrier readBarrier(vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eTransferRead);
+	commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer,
+		vk::DependencyFlags(), readBarrier, {}, {});
+	gpuScope.begin(commandBuffer);
+	vk::DeviceSize offset = 0;
+	for (size_t i = 0; i < columns.size(); ++i)
+	{
+		vk::DeviceSize columnSize = vk::DeviceSize(elementCount) * getParticleFileColumnStride(columns[i]);
+		commandBuffer.copyBuffer(columnBuffers[i], slot->buffer, vk::BufferCopy(0, offset, columnSize));
+		offset += columnSize;
+	}
+	commandBuffer.copyBuffer(countersBuffer, slot->buffer, vk::BufferCopy(aliveCountOffset, offset, sizeof(uint32_t)));
+	gpuScope.end(commandBuffer);
+	// Velocities are stepped in place by the next submission: it waits for the copies to be done
+	// reading (an execution dependency is enough), and the writer thread reads them from the host
+	vk::MemoryBarrier hostBarrier(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eHostRead);
+	commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+		vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eTransfer | vk::PipelineStageFlagBits::eHost,
+		vk::DependencyFlags(), hostBarrier, {}, {});
+	commandBuffer.end();
+
+	uint64_t signalValue = ++timelineValue;
+	renderer->submitTimeline(renderer->computeQueue, { commandBuffer }, {}, timeline, signalValue);
+
+	queueSlot(*slot, step, signalValue);
+	return true;
+}
+
+bool VkSnapshotStream::capture(uint64_t step, const vector<const void*>& columnData, uint32_t aliveCount)
+{
+	Slot* slot = acquireSlot();
+	if (!slot)
+	{
+		return false;
+	}
+	char* data = slot->allocation.as<char>().data();
+	vk::DeviceSize offset = 0;
+	for (size_t i = 0; i < columns.size(); ++i)
+	{
+		vk::DeviceSize columnSize = vk::DeviceSize(elementCount) * getParticleFileColumnStride(columns[i]);
+		memcpy(data + offset, columnData[i], columnSize);
+		offset += columnSize;
+	}
+	memcpy(data + offset, &aliveCount, sizeof(uint32_t));
+	queueSlot(*slot, step, 0);
+	return true;
+}
+
+VkSnapshotStream::Slot* VkSnapshotStream::acquireSlot()
+{
+	// Slots are handed out and written in the same order, only the oldest one can be free
+	std::lock_guard<std::mutex> lock(mutex);
+	Slot& slot = slots[nextSlot];
+	if (slot.state != SlotState::eFree || writerException)
+	{
+		++statistics.dropped;
+		return nullptr;
+	}
+	nextSlot = (nextSlot + 1) % static_cast<uint32_t>(slots.size());
+	return &slot;
+}
+
+void VkSnapshotStream::queueSlot(Slot& slot, uint64_t step, uint64_t copyValue)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		slot.state = SlotState::eQueued;
+		slot.step = step;
+		slot.copyValue = copyValue;
+		writeQueue.push_back(static_cast<uint32_t>(&slot - slots.data()));
+	}
+	queued.notify_one();
+}
+
+void VkSnapshotStream::writerLoop()
+{
+	while (true)
+	{
+		uint32_t slotIndex;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			queued.wait(lock, [this]() { return stopping || !writeQueue.empty(); });
+			// Everything queued is written before leaving
+			if (writeQueue.empty())
+			{
+				return;
+			}
+			slotIndex = writeQueue.front();
+			writeQueue.pop_front();
+			slots[slotIndex].state = SlotState::eWriting;
+		}
+
+		try
+		{
+			writeFrame(slots[slotIndex]);
+		}
+		catch (...)
+		{
+			// Reported by clean, capture drops every frame from now on
+			std::lock_guard<std::mutex> lock(mutex);
+			writerException = std::current_exception();
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		slots[slotIndex].state = SlotState::eFree;
+	}
+}
+
+void VkSnapshotStream::writeFrame(Slot& slot)
+{
+	VkProfiler::CpuScope cpuScope(renderer->profiler, "VkSnapshotStream::writeFrame");
+	if (slot.copyValue > 0)
+	{
+		renderer->waitTimelineSemaphore(timeline, slot.copyValue);
+		renderer->allocator.invalidate(slot.allocation);
+	}
+	auto start = std::chrono::high_resolution_clock::now();
+	const char* data = slot.allocation.as<char>().data();
+	ParticleFileFrame frame{ slot.step, 0, 0 };
+	memcpy(&frame.aliveCount, data + frameDataSize, sizeof(uint32_t));
+	file.write(reinterpret_cast<const char*>(&frame), sizeof(frame));
+	file.write(data, static_cast<std::streamsize>(frameDataSize));
+	if (!file)
+	{
+		throw std::runtime_error("Failed to write a snapshot, is the disk full?");
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+	std::lock_guard<std::mutex> lock(mutex);
+	++statistics.written;
+	statistics.bytes += sizeof(frame) + frameDataSize;
+	statistics.writeSeconds += seconds;
+}
+
+VkSnapshotStream::Statistics VkSnapshotStream::getStatistics()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return statistics;
+}
+
+void VkSnapshotStream::clean()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	queued.notify_all();
+	writer.join();
+
+	// Every submitted copy was waited for by the writer, dropped frames never submitted one
+	Statistics finalStatistics = getStatistics();
+	file.flush();
+	file.seekp(offsetof(ParticleFileHeader, frameCount));
+	file.write(reinterpret_cast<const char*>(&finalStatistics.written), sizeof(uint64_t));
+	file.close();
+
+	vk::Device device = renderer->mainDevices.device;
+	for (Slot& slot : slots)
+	{
+		device.destroyBuffer(slot.buffer);
+		renderer->allocator.free(slot.allocation);
+	}
+	slots.clear();
+	device.destroyCommandPool(commandPool);
+	device.destroySemaphore(timeline);
+
+	double megabytes = finalStatistics.bytes / (1024.0 * 1024.0);
+	std::cout << "Snapshots: " << finalStatistics.written << " written, " << finalStatistics.dropped << " dropped, " << megabytes << "MB at "
+		<< (finalStatistics.writeSeconds > 0.0 ? megabytes / finalStatistics.writeSeconds : 0.0) << "MB/s" << std::endl;
+	if (writerException)
+	{
+		try
+		{
+			std::rethrow_exception(writerException);
+		}
+		catch (const std::exception& e)
+		{
+			printf("WARNING: Snapshots stopped early: %s\n", e.what());
+		}
+	}
+}
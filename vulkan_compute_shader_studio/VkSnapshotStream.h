@@ -0,0 +1,81 @@
+#pragma once
+#include "VkRenderer.h"
+#include "ParticleFile.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+
+// Streams simulation frames to a particle file (ParticleFile.h) without ever making the caller wait.
+// capture copies the columns into a ring of host-cached readback buffers on the compute queue, in
+// order with the steps, and a writer thread waits for each copy and appends it to the file. When
+// every buffer is still queued for the disk the frame is dropped and counted instead.
+class VkSnapshotStream
+{
+public:
+	VkSnapshotStream(VkRenderer* pRenderer);
+	~VkSnapshotStream();
+
+	struct Statistics
+	{
+		uint64_t written;
+		uint64_t dropped;
+		uint64_t bytes;			// frames only, headers included
+		double writeSeconds;	// writer thread time spent in the file
+	};
+
+	// columns are PARTICLE_FIELD_* or PARTICLE_FILE_COLUMN_ALIVE_LIST, numSlots the readback buffers
+	void init(const char* fileName, uint32_t elementCount, const vector<uint32_t>& columns, uint32_t numSlots = 4);
+	// Copies columnBuffers (one per column, elementCount values from offset 0) and the alive count at
+	// aliveCountOffset in countersBuffer, behind everything already submitted to the compute queue.
+	// Work submitted after it that writes these buffers is held back until the copy is done.
+	// Returns false when the frame was dropped.
+	bool capture(uint64_t step, const vector<vk::Buffer>& columnBuffers, vk::Buffer countersBuffer, vk::DeviceSize aliveCountOffset);
+	// Same from host memory, for states stepped on the CPU
+	bool capture(uint64_t step, const vector<const void*>& columnData, uint32_t aliveCount);
+	Statistics getStatistics();
+	// Waits for the queued frames to be written, finishes the file and prints the statistics
+	void clean();
+
+private:
+	enum class SlotState
+	{
+		eFree,
+		eQueued,	// copy submitted or done, waiting for the writer
+		eWriting
+	};
+	struct Slot
+	{
+		vk::Buffer buffer;
+		Allocation allocation;
+		vk::CommandBuffer commandBuffer;
+		SlotState state = SlotState::eFree;
+		uint64_t step = 0;
+		uint64_t copyValue = 0; // timeline value of the copy, 0 when the data came from the host
+	};
+
+	VkRenderer* renderer;
+	std::ofstream file;
+	uint32_t elementCount = 0;
+	vector<uint32_t> columns;
+	vk::DeviceSize frameDataSize = 0; // columns back to back, then the alive count
+	vector<Slot> slots;
+	uint32_t nextSlot = 0;
+	vk::CommandPool commandPool;
+	vk::Semaphore timeline;
+	uint64_t timelineValue = 0;
+
+	std::thread writer;
+	std::mutex mutex;
+	std::condition_variable queued;
+	std::deque<uint32_t> writeQueue;
+	bool stopping = false;
+	Statistics statistics{};
+	std::exception_ptr writerException;
+
+	Slot* acquireSlot();
+	void queueSlot(Slot& slot, uint64_t step, uint64_t copyValue);
+	void writerLoop();
+	void writeFrame(Slot& slot);
+};
@@ -0,0 +1,232 @@
+#include "VkSpatialHash.h"
+#include <stdexcept>
+
+VkSpatialHash::VkSpatialHash()
+{
+}
+
+VkSpatialHash::VkSpatialHash(VkRenderer* pRenderer, const char* pFileName): renderer{pRenderer}, shaderFileName{pFileName}
+{
+
+}
+
+VkSpatialHash::~VkSpatialHash()
+{
+}
+
+void VkSpatialHash::init(uint32_t pMaxElements, uint32_t pNumCells, float pCellSize, uint32_t pWorkgroupSize)
+{
+	maxElements = pMaxElements;
+	numCells = pNumCells;
+	cellSize = pCellSize;
+	workgroupSize = pWorkgroupSize;
+	// The block sums are scanned by a single workgroup
+	if (numCells == 0 || numCells > workgroupSize * workgroupSize)
+	{
+		throw std::runtime_error("Spatial hash: the number of cells has to be between 1 and the workgroup size squared.");
+	}
+
+	hashShader.load_compute_shader(renderer);
+	createBuffers();
+	createDescriptorSetLayout();
+	createPipelines();
+	// A sort waits for the previous one before recording, a single frame of pools is enough
+	descriptors.init(1);
+	recorder.init(renderer->queueFamilyIndices.computeFamily, 1);
+	timeline = renderer->createTimelineSemaphore();
+}
+
+uint64_t VkSpatialHash::submit(uint32_t numElements, const vk::DescriptorBufferInfo& positions, const vector<vk::DescriptorBufferInfo>& fields,
+	const vector<RemapList>& remapLists, const vector<TimelineWait>& waits)
+{
+	VkProfiler::CpuScope cpuScope(renderer->profiler, "VkSpatialHash::submit");
+	if (numElements > maxElements)
+	{
+		throw std::runtime_error("Spatial hash: more elements than it was initialised for.");
+	}
+	// Sorts are far apart, waiting for the previous one before re-recording its command buffer costs nothing
+	wait(timelineValue);
+	recorder.beginFrame(0);
+	descriptors.beginFrame(0);
+	vk::CommandBuffer commandBuffer = recordCommands(numElements, positions, fields, remapLists);
+	renderer->submitTimeline(renderer->computeQueue, { commandBuffer }, waits, timeline, ++timelineValue);
+	return timelineValue;
+}
+
+void VkSpatialHash::wait(uint64_t value)
+{
+	renderer->waitTimelineSemaphore(timeline, value);
+}
+
+void VkSpatialHash::clean()
+{
+	vk::Device device = renderer->mainDevices.device;
+	device.destroySemaphore(timeline);
+	recorder.clean();
+	descriptors.clean();
+	for (vk::Pipeline pipeline : pipelines)
+	{
+		device.destroyPipeline(pipeline);
+	}
+	hashShader.cleanUp(renderer);
+
+	renderer->destroyDeviceBuffer(particleCellBuffer);
+	renderer->destroyDeviceBuffer(particleRankBuffer);
+	renderer->destroyDeviceBuffer(cellCountBuffer);
+	renderer->destroyDeviceBuffer(cellStartBuffer);
+	renderer->destroyDeviceBuffer(cellEndBuffer);
+	renderer->destroyDeviceBuffer(blockSumBuffer);
+	renderer->destroyDeviceBuffer(scratchBuffer);
+}
+
+void VkSpatialHash::createBuffers()
+{
+	// Neighbour kernels may run on another queue family than the sort, the buffers are shared like the particle ones
+	vk::DeviceSize particleTableSize = vk::DeviceSize(maxElements) * sizeof(uint32_t);
+	particleCellBuffer = renderer->createDeviceBuffer(particleTableSize, vk::BufferUsageFlagBits::eStorageBuffer);
+	particleRankBuffer = renderer->createDeviceBuffer(particleTableSize, vk::BufferUsageFlagBits::eStorageBuffer);
+	cellCountBuffer = renderer->createDeviceBuffer(cellTableSize(), vk::BufferUsageFlagBits::eStorageBuffer);
+	cellStartBuffer = renderer->createDeviceBuffer(cellTableSize(), vk::BufferUsageFlagBits::eStorageBuffer);
+	cellEndBuffer = renderer->createDeviceBuffer(cellTableSize(), vk::BufferUsageFlagBits::eStorageBuffer);
+	blockSumBuffer = renderer->createDeviceBuffer(vk::DeviceSize(workgroupSize) * sizeof(uint32_t), vk::BufferUsageFlagBits::eStorageBuffer);
+	scratchBuffer = renderer->createDeviceBuffer(vk::DeviceSize(maxElements) * PARTICLE_FIELD_STRIDE,
+		vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferSrc);
+}
+
+void VkSpatialHash::createDescriptorSetLayout()
+{
+	descriptorSetLayout = renderer->descriptorCache.getSetLayout(vk::DescriptorType::eStorageBuffer, SPATIAL_HASH_BINDING_COUNT,
+		vk::ShaderStageFlagBits::eCompute);
+}
+
+void VkSpatialHash::createPipelines()
+{
+	vk::PushConstantRange pushConstantRange(vk::ShaderStageFlagBits::eCompute, 0, sizeof(SpatialHashParameters));
+	pipelineLayout = renderer->descriptorCache.getPipelineLayout({ descriptorSetLayout }, { pushConstantRange });
+
+	// Same module for every pass, specialization constant 1 selects it and the rest is compiled out
+	for (uint32_t pass = 0; pass < SPATIAL_HASH_NUM_PASSES; ++pass)
+	{
+		pipelines[pass] = hashShader.createPipeline(renderer, pipelineLayout, { workgroupSize, pass });
+	}
+}
+
+vk::DescriptorSet VkSpatialHash::createDescriptorSet(const vk::DescriptorBufferInfo& positions, const vk::DescriptorBufferInfo& field, const RemapList* remapList)
+{
+	vk::DescriptorSet descriptorSet = descriptors.allocateTransient(descriptorSetLayout);
+
+	// Sized for maxElements and numCells, the push constants say how much of them is used
+	std::array<vk::DescriptorBufferInfo, SPATIAL_HASH_BINDING_COUNT> bufferInfos;
+	bufferInfos[SPATIAL_HASH_BINDING_POSITIONS] = positions;
+	bufferInfos[SPATIAL_HASH_BINDING_PARTICLE_CELL] = { particleCellBuffer.buffer, 0, VK_WHOLE_SIZE };
+	bufferInfos[SPATIAL_HASH_BINDING_PARTICLE_RANK] = { particleRankBuffer.buffer, 0, VK_WHOLE_SIZE };
+	bufferInfos[SPATIAL_HASH_BINDING_CELL_COUNT] = { cellCountBuffer.buffer, 0, VK_WHOLE_SIZE };
+	bufferInfos[SPATIAL_HASH_BINDING_CELL_START] = { cellStartBuffer.buffer, 0, VK_WHOLE_SIZE };
+	bufferInfos[SPATIAL_HASH_BINDING_CELL_END] = { cellEndBuffer.buffer, 0, VK_WHOLE_SIZE };
+	bufferInfos[SPATIAL_HASH_BINDING_BLOCK_SUMS] = { blockSumBuffer.buffer, 0, VK_WHOLE_SIZE };
+	bufferInfos[SPATIAL_HASH_BINDING_FIELD_IN] = field;
+	bufferInfos[SPATIAL_HASH_BINDING_FIELD_OUT] = { scratchBuffer.buffer, 0, VK_WHOLE_SIZE };
+	// Sets that aren't used to remap still need valid descriptors there, the cell counts stand in
+	bufferInfos[SPATIAL_HASH_BINDING_REMAP_LIST] = remapList ? remapList->list : vk::DescriptorBufferInfo(cellCountBuffer.buffer, 0, VK_WHOLE_SIZE);
+	bufferInfos[SPATIAL_HASH_BINDING_REMAP_COUNTERS] = remapList ? remapList->counters : vk::DescriptorBufferInfo(cellCountBuffer.buffer, 0, VK_WHOLE_SIZE);
+
+	// Queued, recordCommands sends the writes of every set at once
+	for (uint32_t binding = 0; binding < SPATIAL_HASH_BINDING_COUNT; ++binding)
+	{
+		descriptors.write(descriptorSet, binding, bufferInfos[binding]);
+	}
+	return descriptorSet;
+}
+
+vk::CommandBuffer VkSpatialHash::recordCommands(uint32_t numElements, const vk::DescriptorBufferInfo& positions, const vector<vk::DescriptorBufferInfo>& fields,
+	const vector<RemapList>& remapLists)
+{
+	// Descriptor sets are created here, the passes only record
+	vk::DescriptorSet hashSet = createDescriptorSet(positions, positions);
+	vector<vk::DescriptorSet> remapSets;
+	for (const RemapList& remapList : remapLists)
+	{
+		remapSets.push_back(createDescriptorSet(positions, positions, &remapList));
+	}
+	// Cells and ranks are already known, the positions are reordered like any other field
+	vector<vk::DescriptorBufferInfo> scatteredFields = fields;
+	scatteredFields.push_back(positions);
+	vector<vk::DescriptorSet> scatterSets;
+	for (const vk::DescriptorBufferInfo& field : scatteredFields)
+	{
+		scatterSets.push_back(createDescriptorSet(positions, field));
+	}
+	descriptors.flushWrites();
+
+	SpatialHashParameters parameters{ numElements, numCells, cellSize, 0 };
+	// Every pass reads what the one before wrote. The tables are small, a global barrier is simpler than
+	// listing buffers and doesn't cost more.
+	vk::MemoryBarrier computeToCompute(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+	auto passBarrier = [&](vk::CommandBuffer commandBuffer) {
+		commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader,
+			vk::DependencyFlags(), computeToCompute, {}, {});
+	};
+
+	// Hashing and the scan, then one pass per scattered field recorded in parallel. Barriers order
+	// the secondaries like any other commands of the submission.
+	vector<VkCommandRecorder::RecordFunction> passes;
+	passes.push_back([&](vk::CommandBuffer commandBuffer) {
+		commandBuffer.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(SpatialHashParameters), &parameters);
+		dispatchPass(commandBuffer, SPATIAL_HASH_PASS_CLEAR, hashSet, numCells);
+		passBarrier(commandBuffer);
+		dispatchPass(commandBuffer, SPATIAL_HASH_PASS_COUNT, hashSet, numElements);
+		passBarrier(commandBuffer);
+		dispatchPass(commandBuffer, SPATIAL_HASH_PASS_SCAN_BLOCKS, hashSet, numCells);
+		passBarrier(commandBuffer);
+		dispatchPass(commandBuffer, SPATIAL_HASH_PASS_SCAN_BLOCK_SUMS, hashSet, workgroupSize);
+		passBarrier(commandBuffer);
+		dispatchPass(commandBuffer, SPATIAL_HASH_PASS_FINISH_SCAN, hashSet, numCells);
+		passBarrier(commandBuffer);
+
+		// Index lists only need the new place of every particle, they don't wait for the scatters
+		for (size_t i = 0; i < remapLists.size(); ++i)
+		{
+			SpatialHashParameters remapParameters{ numElements, numCells, cellSize, remapLists[i].countIndex };
+			commandBuffer.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(SpatialHashParameters), &remapParameters);
+			dispatchPass(commandBuffer, SPATIAL_HASH_PASS_REMAP, remapSets[i], numElements);
+		}
+		if (!remapLists.empty())
+		{
+			passBarrier(commandBuffer);
+		}
+	});
+
+	vk::DeviceSize fieldSize = vk::DeviceSize(numElements) * PARTICLE_FIELD_STRIDE;
+	for (size_t i = 0; i < scatteredFields.size(); ++i)
+	{
+		passes.push_back([&, i](vk::CommandBuffer commandBuffer) {
+			const vk::DescriptorBufferInfo& field = scatteredFields[i];
+			commandBuffer.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(SpatialHashParameters), &parameters);
+			dispatchPass(commandBuffer, SPATIAL_HASH_PASS_SCATTER, scatterSets[i], numElements);
+
+			vk::MemoryBarrier scatterToCopy(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eTransferRead);
+			commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eTransfer,
+				vk::DependencyFlags(), scatterToCopy, {}, {});
+			commandBuffer.copyBuffer(scratchBuffer.buffer, field.buffer, vk::BufferCopy(0, field.offset, fieldSize));
+
+			// The next scatter overwrites scratch while this copy reads it, and the next step reads the field
+			vk::MemoryBarrier copyToCompute(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+			commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader,
+				vk::DependencyFlags(), copyToCompute, {}, {});
+		});
+	}
+	VkProfiler::GpuScope gpuScope = renderer->profiler.beginGpuScope("spatial hash sort", renderer->queueFamilyIndices.computeFamily,
+		vk::PipelineStageFlagBits::eComputeShader);
+	return recorder.record(passes, nullptr, gpuScope);
+}
+
+void VkSpatialHash::dispatchPass(vk::CommandBuffer commandBuffer, uint32_t pass, vk::DescriptorSet descriptorSet, uint32_t numInvocations)
+{
+	commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, pipelines[pass]);
+	commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipelineLayout, 0, descriptorSet, {});
+	// Out of range invocations are masked in the shader, the block sum scan is always a single group
+	vk::Extent2D groupCount = pass == SPATIAL_HASH_PASS_SCAN_BLOCK_SUMS ? vk::Extent2D(1, 1)
+		: renderer->getGroupCount((numInvocations + workgroupSize - 1) / workgroupSize);
+	commandBuffer.dispatch(groupCount.width, groupCount.height, 1);
+}
+
@@ -0,0 +1,80 @@
+#pragma once
+#include "VkRenderer.h"
+#include "VkComputeShader.h"
+#include "VkCommandRecorder.h"
+#include "VkDescriptorAllocator.h"
+#include "shaders/ParticleLayout.h"
+#include "shaders/SpatialHashLayout.h"
+#include <array>
+
+// Sorts particles by the cell of a uniform grid they fall in, hashed into a fixed number of buckets,
+// so neighbour searches only visit the 27 cells around a particle instead of every other particle.
+// A counting sort: count per cell, scan the counts into cell start/end tables, scatter every field.
+// Runs on the compute queue and signals its own timeline semaphore.
+class VkSpatialHash
+{
+public:
+	VkSpatialHash();
+	VkSpatialHash(VkRenderer* pRenderer, const char* pFileName);
+	~VkSpatialHash();
+
+	// numCells has to fit in two scan levels, workgroupSize squared
+	void init(uint32_t pMaxElements, uint32_t pNumCells, float pCellSize, uint32_t pWorkgroupSize);
+	// A list of particle indices rewritten to where the sort moved them, as long as word countIndex of counters
+	struct RemapList
+	{
+		vk::DescriptorBufferInfo list;
+		vk::DescriptorBufferInfo counters;
+		uint32_t countIndex;
+	};
+
+	// Hashes the positions and reorders them together with fields, all in place, then remaps the index
+	// lists. Non-blocking, returns the value the timeline reaches once the buffers and the cell tables are ready.
+	uint64_t submit(uint32_t numElements, const vk::DescriptorBufferInfo& positions, const vector<vk::DescriptorBufferInfo>& fields,
+		const vector<RemapList>& remapLists, const vector<TimelineWait>& waits = {});
+	void wait(uint64_t value);
+	vk::Semaphore getTimeline() const { return timeline; }
+	// First particle of every cell and one past its last, in the order of the last sort
+	vk::DescriptorBufferInfo getCellStartBuffer() const { return { cellStartBuffer.buffer, 0, cellTableSize() }; }
+	vk::DescriptorBufferInfo getCellEndBuffer() const { return { cellEndBuffer.buffer, 0, cellTableSize() }; }
+	uint32_t getNumCells() const { return numCells; }
+	void clean();
+
+private:
+	VkRenderer* renderer;
+	const char* shaderFileName;
+	VkComputeShader hashShader{ shaderFileName };
+
+	uint32_t maxElements = 0;
+	uint32_t numCells = 0;
+	float cellSize = 1.0f;
+	uint32_t workgroupSize = 0;
+
+	vk::DescriptorSetLayout descriptorSetLayout;
+	vk::PipelineLayout pipelineLayout;
+	std::array<vk::Pipeline, SPATIAL_HASH_NUM_PASSES> pipelines;
+	VkDescriptorAllocator descriptors{ renderer }; // transient sets, every sort writes its own
+	VkCommandRecorder recorder{ renderer };
+	vk::Semaphore timeline;
+	uint64_t timelineValue = 0;
+
+	// Per particle: hashed cell and slot within it. Per cell: count, start, end. Per scan block: sum.
+	// Fields are scattered into scratch and copied back, so callers keep their buffers and descriptors.
+	DeviceBuffer particleCellBuffer;
+	DeviceBuffer particleRankBuffer;
+	DeviceBuffer cellCountBuffer;
+	DeviceBuffer cellStartBuffer;
+	DeviceBuffer cellEndBuffer;
+	DeviceBuffer blockSumBuffer;
+	DeviceBuffer scratchBuffer;
+
+	vk::DeviceSize cellTableSize() const { return vk::DeviceSize(numCells) * sizeof(uint32_t); }
+	void createBuffers();
+	void createDescriptorSetLayout();
+	void createPipelines();
+	vk::DescriptorSet createDescriptorSet(const vk::DescriptorBufferInfo& positions, const vk::DescriptorBufferInfo& field, const RemapList* remapList = nullptr);
+
+	vk::CommandBuffer recordCommands(uint32_t numElements, const vk::DescriptorBufferInfo& positions, const vector<vk::DescriptorBufferInfo>& fields,
+		const vector<RemapList>& remapLists);
+	void dispatchPass(vk::CommandBuffer commandBuffer, uint32_t pass, vk::DescriptorSet descriptorSet, uint32_t numInvocations);
+};
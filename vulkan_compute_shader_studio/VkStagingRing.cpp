@@ -0,0 +1,173 @@
+#include "VkStagingRing.h"
+#include <cstring>
+
+VkStagingRing::VkStagingRing(VkRenderer* pRenderer): renderer{pRenderer}
+{
+}
+
+VkStagingRing::~VkStagingRing()
+{
+}
+
+void VkStagingRing::init(vk::DeviceSize pSize)
+{
+	size = pSize;
+
+	vk::BufferCreateInfo stagingBufferCreateInfo{
+		vk::BufferCreateFlags(),
+		size,
+		vk::BufferUsageFlagBits::eTransferSrc,
+		vk::SharingMode::eExclusive,
+		1,
+		&renderer->queueFamilyIndices.transferFamily
+	};
+	stagingBuffer = renderer->mainDevices.device.createBuffer(stagingBufferCreateInfo);
+	stagingAllocation = renderer->allocator.allocateBuffer(stagingBuffer, MemoryUsage::eUpload);
+
+	vk::CommandPoolCreateInfo commandPoolInfo(vk::CommandPoolCreateFlagBits::eResetCommandBuffer, renderer->queueFamilyIndices.transferFamily);
+	commandPool = renderer->mainDevices.device.createCommandPool(commandPoolInfo);
+	timeline = renderer->createTimelineSemaphore();
+}
+
+void VkStagingRing::upload(vk::Buffer dstBuffer, vk::DeviceSize dstOffset, const void* data, vk::DeviceSize dataSize)
+{
+	const char* source = static_cast<const char*>(data);
+	vk::DeviceSize chunkSize = size / 2;
+	while (dataSize > 0)
+	{
+		vk::DeviceSize copySize = std::min(dataSize, chunkSize);
+		vk::DeviceSize ringOffset = reserve(copySize);
+		memcpy(stagingAllocation.as<char>().data() + ringOffset, source, copySize);
+		renderer->allocator.flush(stagingAllocation, ringOffset, copySize);
+
+		vk::BufferCopy copyRegion(ringOffset, dstOffset, copySize);
+		getRecordingCommandBuffer().copyBuffer(stagingBuffer, dstBuffer, copyRegion);
+
+		source += copySize;
+		dstOffset += copySize;
+		dataSize -= copySize;
+	}
+}
+
+uint64_t VkStagingRing::flush()
+{
+	if (!recordingCommandBuffer)
+	{
+		return timelineValue;
+	}
+	recordingCommandBuffer.end();
+
+	uint64_t signalValue = ++timelineValue;
+	vk::TimelineSemaphoreSubmitInfo timelineSubmitInfo{};
+	timelineSubmitInfo.signalSemaphoreValueCount = 1;
+	timelineSubmitInfo.pSignalSemaphoreValues = &signalValue;
+
+	vk::SubmitInfo submitInfo(0, nullptr, nullptr, 1, &recordingCommandBuffer);
+	submitInfo.pNext = &timelineSubmitInfo;
+	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.pSignalSemaphores = &timeline;
+	renderer->transferQueue.submit(submitInfo, nullptr);
+
+	pendingBatches.push_back({ recordingCommandBuffer, head, signalValue });
+	recordingCommandBuffer = nullptr;
+	retireBatches(false);
+	return signalValue;
+}
+
+void VkStagingRing::wait(uint64_t value)
+{
+	renderer->waitTimelineSemaphore(timeline, value);
+}
+
+void VkStagingRing::clean()
+{
+	if (recordingCommandBuffer)
+	{
+		flush();
+	}
+	wait(timelineValue);
+	renderer->mainDevices.device.destroySemaphore(timeline);
+	renderer->mainDevices.device.destroyCommandPool(commandPool);
+	renderer->mainDevices.device.destroyBuffer(stagingBuffer);
+	renderer->allocator.free(stagingAllocation);
+}
+
+vk::DeviceSize VkStagingRing::reserve(vk::DeviceSize reserveSize)
+{
+	const vk::DeviceSize alignment = 16;
+	reserveSize = (reserveSize + alignment - 1) / alignment * alignment;
+
+	for (;;)
+	{
+		bool empty = pendingBatches.empty() && !recordingCommandBuffer;
+		if (empty)
+		{
+			head = 0;
+			tail = 0;
+		}
+
+		// Past the wrap point the free space is [head, tail), before it [head, size) then [0, tail)
+		bool wrapped = tail > head || (tail == head && !empty);
+		if (wrapped)
+		{
+			if (head + reserveSize <= tail)
+			{
+				head += reserveSize;
+				return head - reserveSize;
+			}
+		}
+		else if (head + reserveSize <= size)
+		{
+			head += reserveSize;
+			return head - reserveSize;
+		}
+		else if (reserveSize < tail)
+		{
+			head = reserveSize;
+			return 0;
+		}
+
+		// Full: hand what's recorded to the GPU and wait for the oldest copy to be done with its data
+		if (recordingCommandBuffer)
+		{
+			flush();
+		}
+		retireBatches(true);
+	}
+}
+
+void VkStagingRing::retireBatches(bool waitForOldest)
+{
+	if (waitForOldest && !pendingBatches.empty())
+	{
+		wait(pendingBatches.front().value);
+	}
+
+	uint64_t completedValue = renderer->mainDevices.device.getSemaphoreCounterValue(timeline);
+	while (!pendingBatches.empty() && pendingBatches.front().value <= completedValue)
+	{
+		tail = pendingBatches.front().end;
+		freeCommandBuffers.push_back(pendingBatches.front().commandBuffer);
+		pendingBatches.pop_front();
+	}
+}
+
+vk::CommandBuffer VkStagingRing::getRecordingCommandBuffer()
+{
+	if (recordingCommandBuffer)
+	{
+		return recordingCommandBuffer;
+	}
+
+	if (freeCommandBuffers.empty())
+	{
+		vk::CommandBufferAllocateInfo commandBufferAllocateInfo(commandPool, vk::CommandBufferLevel::ePrimary, 1);
+		freeCommandBuffers.push_back(renderer->mainDevices.device.allocateCommandBuffers(commandBufferAllocateInfo).front());
+	}
+	recordingCommandBuffer = freeCommandBuffers.back();
+	freeCommandBuffers.pop_back();
+
+	vk::CommandBufferBeginInfo commandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+	recordingCommandBuffer.begin(commandBufferBeginInfo);
+	return recordingCommandBuffer;
+}
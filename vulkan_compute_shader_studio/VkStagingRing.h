@@ -0,0 +1,49 @@
+#pragma once
+#include "VkRenderer.h"
+#include <deque>
+
+// Persistently mapped host buffer used as a ring: data is copied in on the CPU, and a copyBuffer
+// into the device-local destination is recorded and submitted on the transfer queue.
+// Submissions signal a timeline semaphore, so GPU work that needs the data waits on it
+// instead of the host, and uploads overlap with whatever compute is doing.
+class VkStagingRing
+{
+public:
+	VkStagingRing(VkRenderer* pRenderer);
+	~VkStagingRing();
+
+	void init(vk::DeviceSize pSize = 16 * 1024 * 1024);
+	// Uploads bigger than half the ring are split, waiting for older copies to free space when needed
+	void upload(vk::Buffer dstBuffer, vk::DeviceSize dstOffset, const void* data, vk::DeviceSize dataSize);
+	// Submits the copies recorded since the last flush, returns the timeline value they signal
+	uint64_t flush();
+	void wait(uint64_t value);
+	vk::Semaphore getTimeline() const { return timeline; }
+	void clean();
+
+private:
+	struct Batch
+	{
+		vk::CommandBuffer commandBuffer;
+		vk::DeviceSize end; // ring offset right after the batch's data
+		uint64_t value;
+	};
+
+	VkRenderer* renderer;
+	vk::Buffer stagingBuffer;
+	Allocation stagingAllocation;
+	vk::DeviceSize size = 0;
+	vk::DeviceSize head = 0; // next free byte
+	vk::DeviceSize tail = 0; // oldest byte still read by a pending copy
+
+	vk::CommandPool commandPool;
+	vk::CommandBuffer recordingCommandBuffer;
+	vector<vk::CommandBuffer> freeCommandBuffers;
+	std::deque<Batch> pendingBatches;
+	vk::Semaphore timeline;
+	uint64_t timelineValue = 0;
+
+	vk::DeviceSize reserve(vk::DeviceSize reserveSize);
+	void retireBatches(bool waitForOldest);
+	vk::CommandBuffer getRecordingCommandBuffer();
+};
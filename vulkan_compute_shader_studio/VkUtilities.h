@@ -11,6 +11,8 @@
 using std::string;
 using std::vector;
 
+const int MAX_FRAME_DRAWS = 2;
+
 const vector<const char*> deviceExtensions
 {
     VK_KHR_SWAPCHAIN_EXTENSION_NAME
@@ -22,6 +24,14 @@ struct SwapchainDetails
     vector<vk::PresentModeKHR> presentationModes;
 };
 
+// GPU-side wait on a timeline semaphore reaching value before stage runs
+struct TimelineWait
+{
+    vk::Semaphore semaphore;
+    uint64_t value;
+    vk::PipelineStageFlags stage;
+};
+
 struct SwapchainImage
 {
     VkImage image;
@@ -6,6 +6,11 @@
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <cctype>
+#include <chrono>
+#include <limits>
+#include <algorithm>
+#include <memory>
 
 using std::string;
 
@@ -27,14 +32,146 @@ void clean()
     glfwTerminate();
 }
 
-int main() {
+int main(int argc, char** argv) {
 
-    initWindow();
+    // --headless [steps]: compute only, no window or swapchain, for display-less machines
+    // --trace [file]: GPU timestamps and CPU spans written as a chrome://tracing JSON on exit
+    // --elements N: number of bodies, the initial triangle is repeated to fill them
+    // --sort-interval N: reorder the bodies by spatial hash cell every N steps
+    // --alive N: only the first N of the elements start alive, the others wait to be emitted
+    // --emit N, --lifetime S: bring N dead elements back every step, each living S seconds (0 forever)
+    // --particle-size S: half the side of the quad every element is drawn as, in normalized device coordinates
+    // --cpu-threshold N: up to N elements the steps run on the CPU, 0 (the default) always uses the GPU
+    // --snapshots [file] [--snapshot-interval N]: stream the state to a particle file every N steps (default 100)
+    // --load file [--load-frame N]: start from frame N (default 0) of a particle file, its element count replaces --elements
+    bool headless = false;
+    uint32_t numSteps = 1000;
+    uint32_t numElements = 3;
+    uint32_t sortInterval = 0;
+    uint32_t initialAlive = std::numeric_limits<uint32_t>::max();
+    uint32_t emitPerStep = 0;
+    float lifetime = 0.0f;
+    float particleSize = 0.01f;
+    uint32_t cpuThreshold = 0;
+    const char* traceFileName = nullptr;
+    const char* snapshotFileName = nullptr;
+    uint32_t snapshotInterval = 100;
+    const char* loadFileName = nullptr;
+    uint64_t loadFrame = 0;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (string(argv[i]) == "--headless")
+        {
+            headless = true;
+            if (i + 1 < argc && isdigit(argv[i + 1][0]))
+            {
+                numSteps = static_cast<uint32_t>(std::stoul(argv[++i]));
+            }
+        }
+        else if (string(argv[i]) == "--elements" && i + 1 < argc)
+        {
+            numElements = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if (string(argv[i]) == "--sort-interval" && i + 1 < argc)
+        {
+            sortInterval = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if (string(argv[i]) == "--alive" && i + 1 < argc)
+        {
+            initialAlive = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if (string(argv[i]) == "--emit" && i + 1 < argc)
+        {
+            emitPerStep = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if (string(argv[i]) == "--lifetime" && i + 1 < argc)
+        {
+            lifetime = std::stof(argv[++i]);
+        }
+        else if (string(argv[i]) == "--particle-size" && i + 1 < argc)
+        {
+            particleSize = std::stof(argv[++i]);
+        }
+        else if (string(argv[i]) == "--cpu-threshold" && i + 1 < argc)
+        {
+            cpuThreshold = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if (string(argv[i]) == "--snapshots")
+        {
+            snapshotFileName = (i + 1 < argc && argv[i + 1][0] != '-') ? argv[++i] : "snapshots.ptcl";
+        }
+        else if (string(argv[i]) == "--snapshot-interval" && i + 1 < argc)
+        {
+            snapshotInterval = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if (string(argv[i]) == "--load" && i + 1 < argc)
+        {
+            loadFileName = argv[++i];
+        }
+        else if (string(argv[i]) == "--load-frame" && i + 1 < argc)
+        {
+            loadFrame = std::stoull(argv[++i]);
+        }
+        else if (string(argv[i]) == "--trace")
+        {
+            traceFileName = (i + 1 < argc && argv[i + 1][0] != '-') ? argv[++i] : "trace.json";
+        }
+    }
+
+    if (!headless)
+    {
+        initWindow();
+    }
+    if (traceFileName)
+    {
+        renderer.profiler.enable(traceFileName);
+    }
+    auto startupBegin = std::chrono::high_resolution_clock::now();
     if (renderer.init(window) == EXIT_FAILURE) return EXIT_FAILURE;
 
+    // Only mapped while the simulation uploads it
+    std::unique_ptr<ParticleFileMapping> initialState;
+    if (loadFileName)
+    {
+        initialState = std::make_unique<ParticleFileMapping>(loadFileName);
+        numElements = initialState->getElementCount();
+    }
+
     const char* computeShaderFile = "shaders/comp.spv";
-    Simulation simulation = Simulation{ &renderer,computeShaderFile };
+    Simulation simulation = Simulation{ &renderer,computeShaderFile, numElements };
+    simulation.setSortInterval(sortInterval);
+    simulation.setPopulation(std::min(initialAlive, numElements), emitPerStep, lifetime);
+    simulation.setParticleSize(particleSize);
+    simulation.setCpuThreshold(cpuThreshold);
+    if (snapshotFileName)
+    {
+        simulation.setSnapshots(snapshotFileName, snapshotInterval);
+    }
+    if (initialState)
+    {
+        simulation.setInitialState(initialState.get(), loadFrame);
+    }
     simulation.init();
+    initialState.reset();
+    auto startupEnd = std::chrono::high_resolution_clock::now();
+    std::cout << "Startup took " << std::chrono::duration<double, std::milli>(startupEnd - startupBegin).count()
+        << "ms with a " << (renderer.pipelineCacheWarm ? "warm" : "cold") << " pipeline cache" << std::endl;
+
+    if (headless)
+    {
+        Simulation::HeadlessTimings timings = simulation.runHeadless(numSteps);
+        // Only alive slots are stepped. Without emission the generated particles never die and the count
+        // holds, otherwise it moves every step and only its bound is known: the slot count when emitting,
+        // the loaded alive count when loaded particles can run out of lifetime.
+        double alive = emitPerStep > 0 ? double(simulation.numElements) : double(simulation.getInitialAlive());
+        double interactions = alive * alive * timings.steps;
+        bool exact = emitPerStep == 0 && !loadFileName;
+        std::cout << (exact ? "" : "at most ") << interactions / timings.seconds << " body-body interactions/s ("
+            << (exact ? "" : "up to ") << alive << " alive)" << std::endl;
+        simulation.close();
+        renderer.cleanUp();
+        return 0;
+    }
 
     while (!glfwWindowShouldClose(window))
     {
@@ -44,6 +181,7 @@ int main() {
 
     clean();
     simulation.close();
+    renderer.cleanUp();
 
     return 0;
 }
@@ -0,0 +1,71 @@
+// Particle storage shared by the host and the shaders, included from both C++ and GLSL.
+// One array per field (structure of arrays) so a kernel only streams the fields it uses,
+// and every element is a vec4 so the std430 array stride is the C++ one.
+#ifndef PARTICLE_LAYOUT_H
+#define PARTICLE_LAYOUT_H
+
+// Fields
+#define PARTICLE_FIELD_POSITION 0	// xyz, w is the mass
+#define PARTICLE_FIELD_COLOR 1		// rgba, static, only read by the vertex stage (see ParticleRender.h)
+#define PARTICLE_FIELD_VELOCITY 2	// xyz, w is the remaining lifetime in seconds, 0 never dies. Compute only.
+#define PARTICLE_FIELD_COUNT 3
+
+// Bindings of the simulation step, set 0. Positions ping-pong between states, every invocation
+// only touches its own velocity so that one is updated in place.
+#define PARTICLE_BINDING_POSITION_IN 0
+#define PARTICLE_BINDING_POSITION_OUT 1
+#define PARTICLE_BINDING_VELOCITY 2
+// Population, see ParticlePopulation.h. Particles keep their slot for life, every state lists the
+// slots alive in it, and dead slots wait in the free list until they're emitted again.
+#define PARTICLE_BINDING_ALIVE_IN 3
+#define PARTICLE_BINDING_ALIVE_OUT 4
+#define PARTICLE_BINDING_FREE_LIST 5
+#define PARTICLE_BINDING_COUNTERS 6
+#define PARTICLE_BINDING_COUNT 7
+
+#ifdef __cplusplus
+#include <glm/glm.hpp>
+#include <cstdint>
+
+using ParticleField = glm::vec4;
+const uint32_t PARTICLE_FIELD_STRIDE = sizeof(ParticleField);
+
+// A vec3 member would be 12 bytes here and padded to 16 in std430, a vec4 is 16 on both sides
+static_assert(sizeof(ParticleField) == 16, "std430 vec4 arrays have a 16 byte stride");
+static_assert(alignof(ParticleField) <= 16, "std430 aligns vec4 on 16 bytes");
+
+// Pushed with every step, mirrors the push constant block below
+struct StepParameters
+{
+	uint32_t numElements;
+	float timestep;
+	float softeningSquared;	// added to every squared distance, keeps close encounters finite
+	float gravity;
+};
+static_assert(sizeof(StepParameters) == 16, "push constant block has four 4 byte members");
+
+// Pushed right after StepParameters, both are one block on the GLSL side
+struct PopulationParameters
+{
+	uint32_t stateIndex;	// the state read, its counters are states[stateIndex] and the written ones the next
+	uint32_t numStates;
+	uint32_t emitPerStep;	// dead slots brought back every step, as many as the free list has
+	float emitLifetime;		// of the emitted particles, 0 never dies
+	glm::vec4 emitter;		// xyz centre, w radius of the cube they appear in
+};
+static_assert(sizeof(PopulationParameters) == 32, "std430 puts the vec4 at offset 16");
+#else
+layout(push_constant) uniform StepParameters{
+    uint numElements; // slots, the alive count is in the counters buffer
+    float timestep;
+    float softeningSquared;
+    float gravity;
+    uint stateIndex;
+    uint numStates;
+    uint emitPerStep;
+    float emitLifetime;
+    vec4 emitter;
+} parameters;
+#endif
+
+#endif
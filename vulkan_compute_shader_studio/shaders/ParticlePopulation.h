@@ -0,0 +1,143 @@
+// Live particle count kept on the GPU, included from both C++ and GLSL after ParticleLayout.h.
+// Each step lists the slots that survive into the state it writes and hands the dead ones to the
+// free list, an emit pass brings free slots back, and a single invocation then writes the indirect
+// dispatch and draw arguments of the new state. The host never reads the count back.
+#ifndef PARTICLE_POPULATION_H
+#define PARTICLE_POPULATION_H
+
+// Kernels of particlePopulation.comp.glsl, specialization constant 1
+#define PARTICLE_POPULATION_EMIT 0
+#define PARTICLE_POPULATION_FINISH 1
+
+// Every particle is drawn as one instance of a quad, see shader.vert
+#define PARTICLE_POPULATION_VERTICES_PER_PARTICLE 4u
+
+// The indirect dispatches spill over into y past this many groups, the smallest
+// maxComputeWorkGroupCount[0] a device may report
+#define PARTICLE_POPULATION_MAX_GROUPS_X 65535u
+
+#ifdef __cplusplus
+#include <cstdint>
+
+// Per state. The first three words are a VkDispatchIndirectCommand for the step reading the state and
+// the next four a VkDrawIndirectCommand drawing one instance per slot of its alive list.
+struct ParticleCounters
+{
+	uint32_t dispatchX;
+	uint32_t dispatchY;
+	uint32_t dispatchZ;
+	uint32_t vertexCount;
+	uint32_t aliveCount;	// the draw's instance count
+	uint32_t firstVertex;
+	uint32_t firstInstance;
+	uint32_t padding;
+};
+static_assert(sizeof(ParticleCounters) == 32, "std430 struct of eight 4 byte members");
+
+// The counters buffer starts with the free list size and the number of particles emitted so far,
+// padded to 16 bytes, then one ParticleCounters per state
+struct ParticleCountersHeader
+{
+	uint32_t freeCount;
+	uint32_t emittedCount;	// seeds the emitted positions
+	uint32_t padding[2];
+};
+static_assert(sizeof(ParticleCountersHeader) == 16, "the states array starts at 16 bytes");
+
+inline uint32_t getParticleCountersOffset(uint32_t stateIndex)
+{
+	return sizeof(ParticleCountersHeader) + stateIndex * sizeof(ParticleCounters);
+}
+
+// Same as makeParticleCounters in GLSL, for the initial state
+inline ParticleCounters makeParticleCounters(uint32_t aliveCount, uint32_t workgroupSize)
+{
+	uint32_t groupCount = (aliveCount + workgroupSize - 1) / workgroupSize;
+	uint32_t groupCountX = groupCount < PARTICLE_POPULATION_MAX_GROUPS_X ? groupCount : PARTICLE_POPULATION_MAX_GROUPS_X;
+	uint32_t groupCountY = groupCountX > 0 ? (groupCount + groupCountX - 1) / groupCountX : 0;
+	return { groupCountX, groupCountY, 1, PARTICLE_POPULATION_VERTICES_PER_PARTICLE, aliveCount, 0, 0, 0 };
+}
+#else
+struct ParticleCounters
+{
+    uint dispatchX;
+    uint dispatchY;
+    uint dispatchZ;
+    uint vertexCount;
+    uint aliveCount;
+    uint firstVertex;
+    uint firstInstance;
+    uint padding;
+};
+
+layout(set = 0, binding = PARTICLE_BINDING_ALIVE_IN) readonly buffer aliveInBuffer{
+    uint slots[];
+} aliveIn;
+
+layout(set = 0, binding = PARTICLE_BINDING_ALIVE_OUT) buffer aliveOutBuffer{
+    uint slots[];
+} aliveOut;
+
+layout(set = 0, binding = PARTICLE_BINDING_FREE_LIST) buffer freeListBuffer{
+    uint slots[];
+} freeList;
+
+layout(set = 0, binding = PARTICLE_BINDING_COUNTERS) buffer countersBuffer{
+    uint freeCount;
+    uint emittedCount;
+    uint padding[2];
+    ParticleCounters states[];
+} counters;
+
+shared uint keptCount;
+shared uint keptBase;
+
+ParticleCounters makeParticleCounters(uint aliveCount)
+{
+    uint groupCount = (aliveCount + gl_WorkGroupSize.x - 1) / gl_WorkGroupSize.x;
+    uint groupCountX = min(groupCount, PARTICLE_POPULATION_MAX_GROUPS_X);
+    uint groupCountY = groupCountX > 0 ? (groupCount + groupCountX - 1) / groupCountX : 0;
+    return ParticleCounters(groupCountX, groupCountY, 1u, PARTICLE_POPULATION_VERTICES_PER_PARTICLE, aliveCount, 0u, 0u, 0u);
+}
+
+uint aliveInCount()
+{
+    return counters.states[parameters.stateIndex].aliveCount;
+}
+
+uint outStateIndex()
+{
+    return (parameters.stateIndex + 1) % parameters.numStates;
+}
+
+// Appends the slot to the written state's alive list when keep is set. Every invocation of the
+// workgroup has to call it: the slots are counted in shared memory first, so the workgroup takes
+// its range of the list with a single global atomic instead of one per survivor.
+void keepAlive(bool keep, uint slot)
+{
+    if (gl_LocalInvocationIndex == 0)
+    {
+        keptCount = 0;
+    }
+    barrier();
+    uint rank = keep ? atomicAdd(keptCount, 1) : 0;
+    barrier();
+    if (gl_LocalInvocationIndex == 0)
+    {
+        keptBase = atomicAdd(counters.states[outStateIndex()].aliveCount, keptCount);
+    }
+    barrier();
+    if (keep)
+    {
+        aliveOut.slots[keptBase + rank] = slot;
+    }
+}
+
+// The slot is dead from the written state on, emit may reuse it
+void release(uint slot)
+{
+    freeList.slots[atomicAdd(counters.freeCount, 1)] = slot;
+}
+#endif
+
+#endif
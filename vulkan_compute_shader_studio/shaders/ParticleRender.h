@@ -0,0 +1,32 @@
+// Particle renderer interface shared by VkGraphics and the vertex shader, included from both.
+// There is no vertex input: every particle is an instance of a 4 vertex triangle strip, and the
+// vertex shader looks its slot up in the alive list, then reads the slot's position and color.
+// A particle costs one index and two vec4 reads per vertex, and the quad is expanded on the GPU.
+#ifndef PARTICLE_RENDER_H
+#define PARTICLE_RENDER_H
+
+// Bindings of the graphics pipeline, set 0, one set per simulation state
+#define PARTICLE_RENDER_BINDING_POSITIONS 0
+#define PARTICLE_RENDER_BINDING_COLORS 1
+#define PARTICLE_RENDER_BINDING_ALIVE 2
+#define PARTICLE_RENDER_BINDING_COUNT 3
+
+#ifdef __cplusplus
+#include <cstdint>
+
+struct RenderParameters
+{
+	float particleSize;	// half the side of a quad, in normalized device coordinates along y
+	float aspectRatio;	// framebuffer height over width, keeps the quads square
+	float padding[2];
+};
+static_assert(sizeof(RenderParameters) == 16, "push constant block has four 4 byte members");
+#else
+layout(push_constant) uniform RenderParameters{
+    float particleSize;
+    float aspectRatio;
+    float padding[2];
+} renderParameters;
+#endif
+
+#endif
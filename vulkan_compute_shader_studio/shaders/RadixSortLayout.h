@@ -0,0 +1,49 @@
+// LSD radix sort of uint32 keys carrying a uint32 payload, shared by the host (VkRadixSort) and
+// radixSort.comp.glsl. Each pass sorts on RADIX_SORT_BITS bits: blocks count their digits, the counts
+// are scanned digit-major so every (digit, block) pair gets its output offset, and blocks scatter stably.
+#ifndef RADIX_SORT_LAYOUT_H
+#define RADIX_SORT_LAYOUT_H
+
+#define RADIX_SORT_BITS 4
+#define RADIX_SORT_DIGITS 16		// 1 << RADIX_SORT_BITS
+#define RADIX_SORT_PASSES 8			// 32 / RADIX_SORT_BITS, even so the result lands back in the input buffers
+#define RADIX_SORT_ITEMS_PER_INVOCATION 16 // a block is workgroup size * this many keys or scan entries
+
+// Kernels, specialization constant 1 of radixSort.comp.glsl
+#define RADIX_SORT_KERNEL_HISTOGRAM 0		// digit counts of every block, histograms[digit * numBlocks + block]
+#define RADIX_SORT_KERNEL_SCAN_BLOCKS 1		// exclusive scan of the histograms per block of entries, blockSums
+#define RADIX_SORT_KERNEL_SCAN_BLOCK_SUMS 2	// exclusive scan of blockSums, one workgroup
+#define RADIX_SORT_KERNEL_ADD_BLOCK_SUMS 3	// histograms += blockSums, now the output offsets
+#define RADIX_SORT_KERNEL_SCATTER 4			// stable scatter of keys and payloads to their offsets
+#define RADIX_SORT_NUM_KERNELS 5
+
+// Bindings, set 0
+#define RADIX_SORT_BINDING_KEYS_IN 0
+#define RADIX_SORT_BINDING_PAYLOADS_IN 1
+#define RADIX_SORT_BINDING_KEYS_OUT 2
+#define RADIX_SORT_BINDING_PAYLOADS_OUT 3
+#define RADIX_SORT_BINDING_HISTOGRAMS 4
+#define RADIX_SORT_BINDING_BLOCK_SUMS 5
+#define RADIX_SORT_BINDING_COUNT 6
+
+#ifdef __cplusplus
+#include <cstdint>
+
+struct RadixSortParameters
+{
+	uint32_t numElements;
+	uint32_t shift;		// first bit of the digit sorted on in this pass
+	uint32_t numBlocks;	// of keys, the histograms hold RADIX_SORT_DIGITS * numBlocks entries
+	uint32_t padding;
+};
+static_assert(sizeof(RadixSortParameters) == 16, "push constant block has four 4 byte members");
+#else
+layout(push_constant) uniform RadixSortParameters{
+    uint numElements;
+    uint shift;
+    uint numBlocks;
+    uint padding;
+} sortParameters;
+#endif
+
+#endif
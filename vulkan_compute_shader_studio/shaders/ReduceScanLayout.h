@@ -0,0 +1,49 @@
+// Reductions and prefix scans shared by the host (VkReduceScan) and reduceScan.comp.glsl. Values are
+// int, uint or float, stored as 32 bit words and reinterpreted by the shader. A tile is workgroup
+// size * REDUCE_SCAN_ITEMS_PER_INVOCATION values; longer inputs go through one level per tile factor.
+#ifndef REDUCE_SCAN_LAYOUT_H
+#define REDUCE_SCAN_LAYOUT_H
+
+#define REDUCE_SCAN_ITEMS_PER_INVOCATION 8
+
+// Kernels, specialization constant 1
+#define REDUCE_SCAN_KERNEL_REDUCE 0				// one value per tile into out[tile]
+#define REDUCE_SCAN_KERNEL_SCAN_BLOCKS 1		// scan of every tile into out, the tile's total into blockSums
+#define REDUCE_SCAN_KERNEL_ADD_BLOCK_PREFIX 2	// out = blockSums[tile] combined with out, blockSums scanned exclusively
+#define REDUCE_SCAN_NUM_KERNELS 3
+
+// Element types, specialization constant 2
+#define REDUCE_SCAN_TYPE_INT 0
+#define REDUCE_SCAN_TYPE_UINT 1
+#define REDUCE_SCAN_TYPE_FLOAT 2
+
+// Operations, specialization constant 3
+#define REDUCE_SCAN_OP_SUM 0
+#define REDUCE_SCAN_OP_MIN 1
+#define REDUCE_SCAN_OP_MAX 2
+
+// Bindings, set 0. In and out may be the same buffer, the block sums scan runs in place.
+#define REDUCE_SCAN_BINDING_IN 0
+#define REDUCE_SCAN_BINDING_OUT 1
+#define REDUCE_SCAN_BINDING_BLOCK_SUMS 2
+#define REDUCE_SCAN_BINDING_COUNT 3
+
+#ifdef __cplusplus
+#include <cstdint>
+
+struct ReduceScanParameters
+{
+	uint32_t numElements;
+	uint32_t inclusive;	// scans only, 0 for exclusive
+	uint32_t padding[2];
+};
+static_assert(sizeof(ReduceScanParameters) == 16, "push constant block has four 4 byte members");
+#else
+layout(push_constant) uniform ReduceScanParameters{
+    uint numElements;
+    uint inclusive;
+    uint padding[2];
+} reduceScanParameters;
+#endif
+
+#endif
@@ -0,0 +1,65 @@
+// Uniform grid spatial hash shared by the host (VkSpatialHash) and the shaders, included from both.
+// Particles are hashed into numCells buckets, counting-sorted by bucket and reordered, after which
+// the particles of bucket c are [cellStart[c], cellEnd[c]) in every reordered field.
+#ifndef SPATIAL_HASH_LAYOUT_H
+#define SPATIAL_HASH_LAYOUT_H
+
+// Passes, specialization constant 1 of spatialHash.comp.glsl
+#define SPATIAL_HASH_PASS_CLEAR 0			// cellCount = 0
+#define SPATIAL_HASH_PASS_COUNT 1			// cell and rank of every particle, cellCount
+#define SPATIAL_HASH_PASS_SCAN_BLOCKS 2		// exclusive scan of cellCount per workgroup, blockSums
+#define SPATIAL_HASH_PASS_SCAN_BLOCK_SUMS 3	// exclusive scan of blockSums, one workgroup
+#define SPATIAL_HASH_PASS_FINISH_SCAN 4		// cellStart += blockSums, cellEnd
+#define SPATIAL_HASH_PASS_SCATTER 5			// fieldOut[cellStart[cell] + rank] = fieldIn, once per field
+#define SPATIAL_HASH_PASS_REMAP 6			// remapList[i] = cellStart[cell[remapList[i]]] + rank[...], once per index list
+#define SPATIAL_HASH_NUM_PASSES 7
+
+// Bindings, set 0
+#define SPATIAL_HASH_BINDING_POSITIONS 0
+#define SPATIAL_HASH_BINDING_PARTICLE_CELL 1
+#define SPATIAL_HASH_BINDING_PARTICLE_RANK 2
+#define SPATIAL_HASH_BINDING_CELL_COUNT 3
+#define SPATIAL_HASH_BINDING_CELL_START 4
+#define SPATIAL_HASH_BINDING_CELL_END 5
+#define SPATIAL_HASH_BINDING_BLOCK_SUMS 6
+#define SPATIAL_HASH_BINDING_FIELD_IN 7
+#define SPATIAL_HASH_BINDING_FIELD_OUT 8
+// Lists of particle indices that follow the particles to their new place, their length is word
+// remapCountIndex of the counters buffer
+#define SPATIAL_HASH_BINDING_REMAP_LIST 9
+#define SPATIAL_HASH_BINDING_REMAP_COUNTERS 10
+#define SPATIAL_HASH_BINDING_COUNT 11
+
+#ifdef __cplusplus
+#include <cstdint>
+
+struct SpatialHashParameters
+{
+	uint32_t numElements;
+	uint32_t numCells;
+	float cellSize;
+	uint32_t remapCountIndex;
+};
+static_assert(sizeof(SpatialHashParameters) == 16, "push constant block has four 4 byte members");
+#else
+layout(push_constant) uniform SpatialHashParameters{
+    uint numElements;
+    uint numCells;
+    float cellSize;
+    uint remapCountIndex;
+} hashParameters;
+
+ivec3 cellCoordinates(vec3 position)
+{
+    return ivec3(floor(position / hashParameters.cellSize));
+}
+
+// Neighbour searches hash cellCoordinates(p) + (-1..1, -1..1, -1..1) with this too
+uint cellHash(ivec3 cell)
+{
+    uint hash = (uint(cell.x) * 73856093u) ^ (uint(cell.y) * 19349663u) ^ (uint(cell.z) * 83492791u);
+    return hash % hashParameters.numCells;
+}
+#endif
+
+#endif
@@ -1,3 +1,10 @@
 C:/VulkanSDK/1.2.198.1/Bin/glslangValidator.exe -V shader.vert
 C:/VulkanSDK/1.2.198.1/Bin/glslangValidator.exe -V shader.frag
+C:/VulkanSDK/1.2.198.1/Bin/glslangValidator.exe -V computeShader.comp.glsl -S comp -o comp.spv
+C:/VulkanSDK/1.2.198.1/Bin/glslangValidator.exe -V copy.comp.glsl -S comp -o copy.spv
+C:/VulkanSDK/1.2.198.1/Bin/glslangValidator.exe -V spatialHash.comp.glsl -S comp -o spatialHash.spv
+C:/VulkanSDK/1.2.198.1/Bin/glslangValidator.exe -V particlePopulation.comp.glsl -S comp -o particlePopulation.spv
+C:/VulkanSDK/1.2.198.1/Bin/glslangValidator.exe -V radixSort.comp.glsl -S comp -o radixSort.spv
+C:/VulkanSDK/1.2.198.1/Bin/glslangValidator.exe -V reduceScan.comp.glsl -S comp -o reduceScan.spv
+C:/VulkanSDK/1.2.198.1/Bin/glslangValidator.exe -V reduceScan.comp.glsl -S comp -DUSE_SUBGROUP_ARITHMETIC --target-env vulkan1.1 -o reduceScanSubgroup.spv
 pause
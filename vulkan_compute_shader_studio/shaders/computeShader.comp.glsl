@@ -1,26 +1,81 @@
 #version 450 core
+#extension GL_GOOGLE_include_directive : require
+#include "ParticleLayout.h"
+#include "ParticlePopulation.h"
 
-layout (local_size_x = 256) in;
+// All-pairs N-body gravity with a semi-implicit Euler step. Every workgroup walks the bodies one
+// tile at a time: each invocation loads one position into shared memory, then all of them read
+// the whole tile from there, so every position is fetched from global memory once per workgroup
+// instead of once per invocation.
+// Only the slots in the alive list are stepped, one per invocation of an indirect dispatch. The
+// ones whose lifetime runs out go to the free list, the others are compacted into the next list.
 
-struct Vertex{
-    vec3 pos;
-    vec3 col;
-};
+// Workgroup size is picked per device by VkCompute through specialization constant 0
+layout (local_size_x_id = 0) in;
 
-layout(set = 0, binding=0) buffer inBuffer{
-    Vertex vertices[];
+layout(set = 0, binding = PARTICLE_BINDING_POSITION_IN) readonly buffer inBuffer{
+    vec4 positions[];
 } inData;
 
 
-layout(set = 0, binding=1) buffer outBuffer{
+layout(set = 0, binding = PARTICLE_BINDING_POSITION_OUT) writeonly buffer outBuffer{
 
-    Vertex vertices[];
+    vec4 positions[];
 
 }outData;
 
+layout(set = 0, binding = PARTICLE_BINDING_VELOCITY) buffer velocityBuffer{
+    vec4 velocities[];
+} velocityData;
+
+shared vec4 tile[gl_WorkGroupSize.x];
 
 void main(void) {
-    int global_id = int(gl_GlobalInvocationID.x);
+    // Large dispatches spill over into y, see makeParticleCounters
+    uint global_id = gl_GlobalInvocationID.x + gl_GlobalInvocationID.y * gl_NumWorkGroups.x * gl_WorkGroupSize.x;
+    uint aliveCount = aliveInCount();
+
+    // Invocations past the end still help loading tiles, they can't leave before the barriers
+    bool active = global_id < aliveCount;
+    uint slot = active ? aliveIn.slots[global_id] : 0;
+    vec4 position = active ? inData.positions[slot] : vec4(0.0);
+    vec3 acceleration = vec3(0.0);
+
+    for (uint tileStart = 0; tileStart < aliveCount; tileStart += gl_WorkGroupSize.x)
+    {
+        uint loadIndex = tileStart + gl_LocalInvocationIndex;
+        // Zero mass past the end, those bodies don't pull anything
+        tile[gl_LocalInvocationIndex] = loadIndex < aliveCount ? inData.positions[aliveIn.slots[loadIndex]] : vec4(0.0);
+        barrier();
+
+        for (uint i = 0; i < gl_WorkGroupSize.x; ++i)
+        {
+            vec4 body = tile[i];
+            vec3 delta = body.xyz - position.xyz;
+            // Softening also makes the body's pull on itself zero instead of a division by zero
+            float inverseDistance = inversesqrt(dot(delta, delta) + parameters.softeningSquared);
+            acceleration += body.w * inverseDistance * inverseDistance * inverseDistance * delta;
+        }
+        barrier();
+    }
 
-    outData.vertices[global_id].pos = inData.vertices[global_id].pos;
+    bool survives = false;
+    if (active)
+    {
+        vec4 velocity = velocityData.velocities[slot];
+        velocity.xyz += parameters.gravity * parameters.timestep * acceleration;
+        survives = true;
+        if (velocity.w > 0.0)
+        {
+            velocity.w -= parameters.timestep;
+            survives = velocity.w > 0.0;
+        }
+        velocityData.velocities[slot] = velocity;
+        outData.positions[slot] = vec4(position.xyz + parameters.timestep * velocity.xyz, position.w);
+        if (!survives)
+        {
+            release(slot);
+        }
+    }
+    keepAlive(survives, slot);
 }
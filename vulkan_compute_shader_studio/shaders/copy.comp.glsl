@@ -0,0 +1,35 @@
+#version 450 core
+#extension GL_GOOGLE_include_directive : require
+#include "ParticleLayout.h"
+#include "ParticlePopulation.h"
+
+// Copies the positions from one state to the next, a pure bandwidth test for the benchmark. The
+// alive list is carried over as is, nothing dies here.
+
+// Workgroup size is picked per device by VkCompute through specialization constant 0
+layout (local_size_x_id = 0) in;
+
+layout(set = 0, binding = PARTICLE_BINDING_POSITION_IN) readonly buffer inBuffer{
+    vec4 positions[];
+} inData;
+
+
+layout(set = 0, binding = PARTICLE_BINDING_POSITION_OUT) writeonly buffer outBuffer{
+
+    vec4 positions[];
+
+}outData;
+
+
+void main(void) {
+    // Large dispatches spill over into y, see makeParticleCounters
+    uint global_id = gl_GlobalInvocationID.x + gl_GlobalInvocationID.y * gl_NumWorkGroups.x * gl_WorkGroupSize.x;
+    // Every invocation reaches keepAlive, it has barriers
+    bool active = global_id < aliveInCount();
+    uint slot = active ? aliveIn.slots[global_id] : 0;
+    if (active)
+    {
+        outData.positions[slot] = inData.positions[slot];
+    }
+    keepAlive(active, slot);
+}
@@ -0,0 +1,69 @@
+#version 450 core
+#extension GL_GOOGLE_include_directive : require
+#include "ParticleLayout.h"
+#include "ParticlePopulation.h"
+
+// Runs after the step, on the same descriptor set. EMIT takes slots off the end of the free list
+// and appends them to the written state's alive list, FINISH then updates the counters and writes
+// the indirect arguments of that state. Picked by specialization constant 1.
+
+// Workgroup size is picked per device by VkCompute through specialization constant 0
+layout (local_size_x_id = 0) in;
+layout (constant_id = 1) const uint KERNEL = PARTICLE_POPULATION_EMIT;
+
+layout(set = 0, binding = PARTICLE_BINDING_POSITION_OUT) writeonly buffer outBuffer{
+    vec4 positions[];
+} outData;
+
+layout(set = 0, binding = PARTICLE_BINDING_VELOCITY) writeonly buffer velocityBuffer{
+    vec4 velocities[];
+} velocityData;
+
+uint hash(uint x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// In [-1, 1)
+float signedUnit(uint x)
+{
+    return float(hash(x) >> 8) / float(1u << 23) - 1.0;
+}
+
+void main(void) {
+    uint id = gl_GlobalInvocationID.x + gl_GlobalInvocationID.y * gl_NumWorkGroups.x * gl_WorkGroupSize.x;
+    // Neither pass changes freeCount or the written state's count while it runs, FINISH does it after EMIT
+    uint emitCount = min(parameters.emitPerStep, counters.freeCount);
+
+    if (KERNEL == PARTICLE_POPULATION_EMIT)
+    {
+        if (id >= emitCount)
+        {
+            return;
+        }
+        uint slot = freeList.slots[counters.freeCount - 1 - id];
+        uint seed = hash(counters.emittedCount + id);
+        vec3 offset = vec3(signedUnit(seed), signedUnit(seed + 1u), signedUnit(seed + 2u));
+        // Same unit mass as the initial particles
+        outData.positions[slot] = vec4(parameters.emitter.xyz + parameters.emitter.w * offset, 1.0);
+        velocityData.velocities[slot] = vec4(0.0, 0.0, 0.0, parameters.emitLifetime);
+        aliveOut.slots[counters.states[outStateIndex()].aliveCount + id] = slot;
+    }
+    else if (KERNEL == PARTICLE_POPULATION_FINISH)
+    {
+        // A single invocation
+        if (id != 0)
+        {
+            return;
+        }
+        counters.freeCount -= emitCount;
+        counters.emittedCount += emitCount;
+        uint outState = outStateIndex();
+        counters.states[outState] = makeParticleCounters(counters.states[outState].aliveCount + emitCount);
+    }
+}
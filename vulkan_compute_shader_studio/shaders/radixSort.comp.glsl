@@ -0,0 +1,238 @@
+#version 450 core
+#extension GL_GOOGLE_include_directive : require
+#include "RadixSortLayout.h"
+
+// Every kernel of one radix sort pass, picked by specialization constant 1 so they share one module
+// and one descriptor set layout. See RadixSortLayout.h for what each kernel does.
+
+// Workgroup size is picked by VkRadixSort through specialization constant 0
+layout (local_size_x_id = 0) in;
+layout (constant_id = 1) const uint KERNEL = RADIX_SORT_KERNEL_HISTOGRAM;
+
+layout(set = 0, binding = RADIX_SORT_BINDING_KEYS_IN) readonly buffer keyInBuffer{
+    uint keysIn[];
+};
+layout(set = 0, binding = RADIX_SORT_BINDING_PAYLOADS_IN) readonly buffer payloadInBuffer{
+    uint payloadsIn[];
+};
+layout(set = 0, binding = RADIX_SORT_BINDING_KEYS_OUT) writeonly buffer keyOutBuffer{
+    uint keysOut[];
+};
+layout(set = 0, binding = RADIX_SORT_BINDING_PAYLOADS_OUT) writeonly buffer payloadOutBuffer{
+    uint payloadsOut[];
+};
+layout(set = 0, binding = RADIX_SORT_BINDING_HISTOGRAMS) buffer histogramBuffer{
+    uint histograms[];
+};
+layout(set = 0, binding = RADIX_SORT_BINDING_BLOCK_SUMS) buffer blockSumBuffer{
+    uint blockSums[];
+};
+
+const uint TILE = gl_WorkGroupSize.x * RADIX_SORT_ITEMS_PER_INVOCATION;
+
+shared uint digitCounts[RADIX_SORT_DIGITS];
+shared uint scanScratch[gl_WorkGroupSize.x];
+// One 16 bit counter per digit, digits 0-7 in the low half and 8-15 in the high one, so the ranks of
+// all digits come out of a single scan. 16 bits hold up to 65535 invocations, VkRadixSort uses at most 256.
+shared uvec4 rankScratchLow[gl_WorkGroupSize.x];
+shared uvec4 rankScratchHigh[gl_WorkGroupSize.x];
+
+uint blockIndex()
+{
+    // Large dispatches spill over into y, see VkRenderer::getGroupCount
+    return gl_WorkGroupID.x + gl_WorkGroupID.y * gl_NumWorkGroups.x;
+}
+
+uint digitOf(uint key)
+{
+    return (key >> sortParameters.shift) & (RADIX_SORT_DIGITS - 1);
+}
+
+// Exclusive scan of one value per invocation across the workgroup (Hillis-Steele), returns the total
+uint workgroupExclusiveScan(uint value, out uint total)
+{
+    uint local = gl_LocalInvocationIndex;
+    scanScratch[local] = value;
+    barrier();
+    for (uint offset = 1; offset < gl_WorkGroupSize.x; offset *= 2)
+    {
+        uint other = local >= offset ? scanScratch[local - offset] : 0;
+        barrier();
+        scanScratch[local] += other;
+        barrier();
+    }
+    total = scanScratch[gl_WorkGroupSize.x - 1];
+    uint exclusive = scanScratch[local] - value;
+    barrier(); // the scratch is reused by the next call
+    return exclusive;
+}
+
+void histogram()
+{
+    uint local = gl_LocalInvocationIndex;
+    uint block = blockIndex();
+    if (block >= sortParameters.numBlocks)
+    {
+        return;
+    }
+    if (local < RADIX_SORT_DIGITS)
+    {
+        digitCounts[local] = 0;
+    }
+    barrier();
+    for (uint item = 0; item < RADIX_SORT_ITEMS_PER_INVOCATION; ++item)
+    {
+        uint id = block * TILE + item * gl_WorkGroupSize.x + local;
+        if (id < sortParameters.numElements)
+        {
+            atomicAdd(digitCounts[digitOf(keysIn[id])], 1);
+        }
+    }
+    barrier();
+    // Digit-major, so one scan over everything orders by digit first and block second
+    if (local < RADIX_SORT_DIGITS)
+    {
+        histograms[local * sortParameters.numBlocks + block] = digitCounts[local];
+    }
+}
+
+// Exclusive scan of the tile of entries starting at first, each invocation owns a contiguous run of them
+void scanTile(bool scanBlockSums, uint first, uint count, out uint total)
+{
+    uint base = first + gl_LocalInvocationIndex * RADIX_SORT_ITEMS_PER_INVOCATION;
+    uint values[RADIX_SORT_ITEMS_PER_INVOCATION];
+    uint sum = 0;
+    for (uint item = 0; item < RADIX_SORT_ITEMS_PER_INVOCATION; ++item)
+    {
+        uint id = base + item;
+        values[item] = id < count ? (scanBlockSums ? blockSums[id] : histograms[id]) : 0;
+        sum += values[item];
+    }
+    uint running = workgroupExclusiveScan(sum, total);
+    for (uint item = 0; item < RADIX_SORT_ITEMS_PER_INVOCATION; ++item)
+    {
+        uint id = base + item;
+        if (id < count)
+        {
+            if (scanBlockSums)
+            {
+                blockSums[id] = running;
+            }
+            else
+            {
+                histograms[id] = running;
+            }
+        }
+        running += values[item];
+    }
+}
+
+void scatter()
+{
+    uint local = gl_LocalInvocationIndex;
+    uint block = blockIndex();
+    if (block >= sortParameters.numBlocks)
+    {
+        return;
+    }
+    // Where the next key of each digit goes, starting from the scanned histograms
+    if (local < RADIX_SORT_DIGITS)
+    {
+        digitCounts[local] = histograms[local * sortParameters.numBlocks + block];
+    }
+    barrier();
+
+    // Keys are taken a workgroup at a time in order, and ranked by invocation within each round,
+    // which keeps equal digits in their input order: that's what makes the passes add up to a sort
+    for (uint item = 0; item < RADIX_SORT_ITEMS_PER_INVOCATION; ++item)
+    {
+        uint id = block * TILE + item * gl_WorkGroupSize.x + local;
+        bool active = id < sortParameters.numElements;
+        uint key = active ? keysIn[id] : 0;
+        uint digit = digitOf(key);
+        uvec4 flagLow = uvec4(0);
+        uvec4 flagHigh = uvec4(0);
+        if (active)
+        {
+            uint counter = 1u << (16 * (digit & 1));
+            if (digit < 8)
+            {
+                flagLow[(digit >> 1) & 3] = counter;
+            }
+            else
+            {
+                flagHigh[(digit >> 1) & 3] = counter;
+            }
+        }
+
+        rankScratchLow[local] = flagLow;
+        rankScratchHigh[local] = flagHigh;
+        barrier();
+        for (uint offset = 1; offset < gl_WorkGroupSize.x; offset *= 2)
+        {
+            uvec4 otherLow = local >= offset ? rankScratchLow[local - offset] : uvec4(0);
+            uvec4 otherHigh = local >= offset ? rankScratchHigh[local - offset] : uvec4(0);
+            barrier();
+            rankScratchLow[local] += otherLow;
+            rankScratchHigh[local] += otherHigh;
+            barrier();
+        }
+
+        if (active)
+        {
+            uvec4 ranks = digit < 8 ? rankScratchLow[local] - flagLow : rankScratchHigh[local] - flagHigh;
+            uint rank = (ranks[(digit >> 1) & 3] >> (16 * (digit & 1))) & 0xFFFFu;
+            uint destination = digitCounts[digit] + rank;
+            keysOut[destination] = key;
+            payloadsOut[destination] = payloadsIn[id];
+        }
+        barrier();
+
+        // The last invocation's inclusive scan holds how many keys of each digit this round had
+        if (local < RADIX_SORT_DIGITS)
+        {
+            uvec4 totals = local < 8 ? rankScratchLow[gl_WorkGroupSize.x - 1] : rankScratchHigh[gl_WorkGroupSize.x - 1];
+            digitCounts[local] += (totals[(local >> 1) & 3] >> (16 * (local & 1))) & 0xFFFFu;
+        }
+        barrier();
+    }
+}
+
+void main(void) {
+    uint entries = RADIX_SORT_DIGITS * sortParameters.numBlocks;
+    uint total;
+    if (KERNEL == RADIX_SORT_KERNEL_HISTOGRAM)
+    {
+        histogram();
+    }
+    else if (KERNEL == RADIX_SORT_KERNEL_SCAN_BLOCKS)
+    {
+        uint block = blockIndex();
+        uint numScanBlocks = (entries + TILE - 1) / TILE;
+        if (block < numScanBlocks)
+        {
+            scanTile(false, block * TILE, entries, total);
+            if (gl_LocalInvocationIndex == 0)
+            {
+                blockSums[block] = total;
+            }
+        }
+    }
+    else if (KERNEL == RADIX_SORT_KERNEL_SCAN_BLOCK_SUMS)
+    {
+        // Dispatched as a single workgroup, VkRadixSort keeps the number of scan blocks within a tile
+        scanTile(true, 0, (entries + TILE - 1) / TILE, total);
+    }
+    else if (KERNEL == RADIX_SORT_KERNEL_ADD_BLOCK_SUMS)
+    {
+        uint id = gl_GlobalInvocationID.x + gl_GlobalInvocationID.y * gl_NumWorkGroups.x * gl_WorkGroupSize.x;
+        if (id < entries)
+        {
+            histograms[id] += blockSums[id / TILE];
+        }
+    }
+    else if (KERNEL == RADIX_SORT_KERNEL_SCATTER)
+    {
+        scatter();
+    }
+}
@@ -0,0 +1,261 @@
+#version 450 core
+#extension GL_GOOGLE_include_directive : require
+#include "ReduceScanLayout.h"
+
+// Reductions and prefix scans for every element type and operation, picked by specialization constants.
+// Built twice by compile_shaders.bat: with USE_SUBGROUP_ARITHMETIC defined the workgroup level goes
+// through subgroup operations, without it through shared memory trees, for devices whose subgroups
+// can't do arithmetic in compute shaders. VkReduceScan picks the module.
+#ifdef USE_SUBGROUP_ARITHMETIC
+#extension GL_KHR_shader_subgroup_basic : require
+#extension GL_KHR_shader_subgroup_arithmetic : require
+#endif
+
+layout (local_size_x_id = 0) in;
+layout (constant_id = 1) const uint KERNEL = REDUCE_SCAN_KERNEL_REDUCE;
+layout (constant_id = 2) const uint TYPE = REDUCE_SCAN_TYPE_UINT;
+layout (constant_id = 3) const uint OP = REDUCE_SCAN_OP_SUM;
+
+layout(set = 0, binding = REDUCE_SCAN_BINDING_IN) buffer inBuffer{
+    uint valuesIn[];
+};
+layout(set = 0, binding = REDUCE_SCAN_BINDING_OUT) buffer outBuffer{
+    uint valuesOut[];
+};
+layout(set = 0, binding = REDUCE_SCAN_BINDING_BLOCK_SUMS) buffer blockSumBuffer{
+    uint blockSums[];
+};
+
+const uint TILE = gl_WorkGroupSize.x * REDUCE_SCAN_ITEMS_PER_INVOCATION;
+
+shared uint scratch[gl_WorkGroupSize.x];
+
+uint identity()
+{
+    if (OP == REDUCE_SCAN_OP_SUM)
+    {
+        return 0; // the same bits for all three types
+    }
+    if (TYPE == REDUCE_SCAN_TYPE_FLOAT)
+    {
+        return OP == REDUCE_SCAN_OP_MIN ? 0x7F800000u : 0xFF800000u; // +inf, -inf
+    }
+    if (TYPE == REDUCE_SCAN_TYPE_INT)
+    {
+        return OP == REDUCE_SCAN_OP_MIN ? 0x7FFFFFFFu : 0x80000000u;
+    }
+    return OP == REDUCE_SCAN_OP_MIN ? 0xFFFFFFFFu : 0u;
+}
+
+uint combine(uint a, uint b)
+{
+    if (TYPE == REDUCE_SCAN_TYPE_FLOAT)
+    {
+        float x = uintBitsToFloat(a);
+        float y = uintBitsToFloat(b);
+        return floatBitsToUint(OP == REDUCE_SCAN_OP_SUM ? x + y : OP == REDUCE_SCAN_OP_MIN ? min(x, y) : max(x, y));
+    }
+    if (TYPE == REDUCE_SCAN_TYPE_INT)
+    {
+        int x = int(a);
+        int y = int(b);
+        return uint(OP == REDUCE_SCAN_OP_SUM ? x + y : OP == REDUCE_SCAN_OP_MIN ? min(x, y) : max(x, y));
+    }
+    return OP == REDUCE_SCAN_OP_SUM ? a + b : OP == REDUCE_SCAN_OP_MIN ? min(a, b) : max(a, b);
+}
+
+#ifdef USE_SUBGROUP_ARITHMETIC
+uint subgroupCombine(uint value)
+{
+    if (TYPE == REDUCE_SCAN_TYPE_FLOAT)
+    {
+        float x = uintBitsToFloat(value);
+        return floatBitsToUint(OP == REDUCE_SCAN_OP_SUM ? subgroupAdd(x) : OP == REDUCE_SCAN_OP_MIN ? subgroupMin(x) : subgroupMax(x));
+    }
+    if (TYPE == REDUCE_SCAN_TYPE_INT)
+    {
+        int x = int(value);
+        return uint(OP == REDUCE_SCAN_OP_SUM ? subgroupAdd(x) : OP == REDUCE_SCAN_OP_MIN ? subgroupMin(x) : subgroupMax(x));
+    }
+    return OP == REDUCE_SCAN_OP_SUM ? subgroupAdd(value) : OP == REDUCE_SCAN_OP_MIN ? subgroupMin(value) : subgroupMax(value);
+}
+
+uint subgroupExclusiveCombine(uint value)
+{
+    // Lane 0 gets the identity of the operation, which for floats and ints is what identity() returns too
+    if (TYPE == REDUCE_SCAN_TYPE_FLOAT)
+    {
+        float x = uintBitsToFloat(value);
+        return floatBitsToUint(OP == REDUCE_SCAN_OP_SUM ? subgroupExclusiveAdd(x) : OP == REDUCE_SCAN_OP_MIN ? subgroupExclusiveMin(x) : subgroupExclusiveMax(x));
+    }
+    if (TYPE == REDUCE_SCAN_TYPE_INT)
+    {
+        int x = int(value);
+        return uint(OP == REDUCE_SCAN_OP_SUM ? subgroupExclusiveAdd(x) : OP == REDUCE_SCAN_OP_MIN ? subgroupExclusiveMin(x) : subgroupExclusiveMax(x));
+    }
+    return OP == REDUCE_SCAN_OP_SUM ? subgroupExclusiveAdd(value) : OP == REDUCE_SCAN_OP_MIN ? subgroupExclusiveMin(value) : subgroupExclusiveMax(value);
+}
+#endif
+
+// Exclusive scan of one value per invocation across the workgroup, also returns the total
+uint workgroupExclusiveScan(uint value, out uint total)
+{
+    uint local = gl_LocalInvocationIndex;
+    uint exclusive;
+#ifdef USE_SUBGROUP_ARITHMETIC
+    // Scan within subgroups, then across the subgroup totals. There are few of those, one invocation
+    // walks them rather than assuming they fit in a single subgroup.
+    exclusive = subgroupExclusiveCombine(value);
+    uint subgroupTotal = subgroupCombine(value);
+    if (subgroupElect())
+    {
+        scratch[gl_SubgroupID] = subgroupTotal;
+    }
+    barrier();
+    if (local == 0)
+    {
+        uint running = identity();
+        for (uint subgroup = 0; subgroup < gl_NumSubgroups; ++subgroup)
+        {
+            uint subgroupSum = scratch[subgroup];
+            scratch[subgroup] = running;
+            running = combine(running, subgroupSum);
+        }
+        scratch[gl_NumSubgroups] = running;
+    }
+    barrier();
+    exclusive = combine(scratch[gl_SubgroupID], exclusive);
+    total = scratch[gl_NumSubgroups];
+#else
+    // Hillis-Steele in shared memory
+    scratch[local] = value;
+    barrier();
+    for (uint offset = 1; offset < gl_WorkGroupSize.x; offset *= 2)
+    {
+        uint other = local >= offset ? scratch[local - offset] : identity();
+        barrier();
+        scratch[local] = combine(other, scratch[local]);
+        barrier();
+    }
+    exclusive = local > 0 ? scratch[local - 1] : identity();
+    total = scratch[gl_WorkGroupSize.x - 1];
+#endif
+    barrier(); // the scratch is reused by the next call
+    return exclusive;
+}
+
+uint workgroupReduce(uint value)
+{
+    uint local = gl_LocalInvocationIndex;
+#ifdef USE_SUBGROUP_ARITHMETIC
+    uint subgroupTotal = subgroupCombine(value);
+    if (subgroupElect())
+    {
+        scratch[gl_SubgroupID] = subgroupTotal;
+    }
+    barrier();
+    uint total = identity();
+    for (uint subgroup = 0; subgroup < gl_NumSubgroups; ++subgroup)
+    {
+        total = combine(total, scratch[subgroup]);
+    }
+#else
+    // Tree in shared memory, halving the active invocations every step
+    scratch[local] = value;
+    barrier();
+    for (uint active = gl_WorkGroupSize.x; active > 1; active = (active + 1) / 2)
+    {
+        uint half = (active + 1) / 2;
+        if (local < active - half)
+        {
+            scratch[local] = combine(scratch[local], scratch[local + half]);
+        }
+        barrier();
+    }
+    uint total = scratch[0];
+#endif
+    barrier();
+    return total;
+}
+
+uint tileIndex()
+{
+    // Large dispatches spill over into y, see VkRenderer::getGroupCount
+    return gl_WorkGroupID.x + gl_WorkGroupID.y * gl_NumWorkGroups.x;
+}
+
+bool tileInRange()
+{
+    // Tile 0 always runs, so an empty input still reduces to the identity
+    return tileIndex() == 0 || tileIndex() * TILE < reduceScanParameters.numElements;
+}
+
+void reduceTile()
+{
+    // Strided, so every load of the workgroup is contiguous
+    uint tile = tileIndex();
+    uint value = identity();
+    for (uint item = 0; item < REDUCE_SCAN_ITEMS_PER_INVOCATION; ++item)
+    {
+        uint id = tile * TILE + item * gl_WorkGroupSize.x + gl_LocalInvocationIndex;
+        if (id < reduceScanParameters.numElements)
+        {
+            value = combine(value, valuesIn[id]);
+        }
+    }
+    uint total = workgroupReduce(value);
+    if (gl_LocalInvocationIndex == 0)
+    {
+        valuesOut[tile] = total;
+    }
+}
+
+void scanTile()
+{
+    // Each invocation owns a contiguous run, scanned sequentially around one workgroup scan of the run totals
+    uint base = tileIndex() * TILE + gl_LocalInvocationIndex * REDUCE_SCAN_ITEMS_PER_INVOCATION;
+    uint values[REDUCE_SCAN_ITEMS_PER_INVOCATION];
+    uint runTotal = identity();
+    for (uint item = 0; item < REDUCE_SCAN_ITEMS_PER_INVOCATION; ++item)
+    {
+        uint id = base + item;
+        values[item] = id < reduceScanParameters.numElements ? valuesIn[id] : identity();
+        runTotal = combine(runTotal, values[item]);
+    }
+    uint tileTotal;
+    uint running = workgroupExclusiveScan(runTotal, tileTotal);
+    for (uint item = 0; item < REDUCE_SCAN_ITEMS_PER_INVOCATION; ++item)
+    {
+        uint id = base + item;
+        uint inclusive = combine(running, values[item]);
+        if (id < reduceScanParameters.numElements)
+        {
+            valuesOut[id] = reduceScanParameters.inclusive != 0 ? inclusive : running;
+        }
+        running = inclusive;
+    }
+    if (gl_LocalInvocationIndex == 0)
+    {
+        blockSums[tileIndex()] = tileTotal;
+    }
+}
+
+void main(void) {
+    // Whole workgroups leave together, the barriers inside stay uniform
+    if (KERNEL == REDUCE_SCAN_KERNEL_REDUCE && tileInRange())
+    {
+        reduceTile();
+    }
+    else if (KERNEL == REDUCE_SCAN_KERNEL_SCAN_BLOCKS && tileInRange())
+    {
+        scanTile();
+    }
+    else if (KERNEL == REDUCE_SCAN_KERNEL_ADD_BLOCK_PREFIX)
+    {
+        uint id = gl_GlobalInvocationID.x + gl_GlobalInvocationID.y * gl_NumWorkGroups.x * gl_WorkGroupSize.x;
+        if (id < reduceScanParameters.numElements)
+        {
+            valuesOut[id] = combine(blockSums[id / TILE], valuesOut[id]);
+        }
+    }
+}
@@ -1,10 +1,16 @@
 #version 450
 
 layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec2 fragCorner;
 
 
 layout(location = 0) out vec4 outColor;
 
 void main() {
+    // Round sprites out of the quads
+    if (dot(fragCorner, fragCorner) > 1.0)
+    {
+        discard;
+    }
     outColor = vec4(fragColor, 1.0);
-}
\ No newline at end of file
+}
@@ -1,13 +1,30 @@
 #version 450
+#extension GL_GOOGLE_include_directive : require
+#include "ParticleRender.h"
+
+// One instance per alive particle, expanded into a quad from the vertex index
 
 // Output colors for vertex shader
 layout(location = 0) out vec3 fragColor;
+// Position in the quad, -1 to 1 on both axes
+layout(location = 1) out vec2 fragCorner;
 
-
-layout(location = 0) in vec3 inPosition;
-layout(location = 1) in vec3 inColor;
+layout(set = 0, binding = PARTICLE_RENDER_BINDING_POSITIONS) readonly buffer positionBuffer{
+    vec4 positions[];
+};
+layout(set = 0, binding = PARTICLE_RENDER_BINDING_COLORS) readonly buffer colorBuffer{
+    vec4 colors[];
+};
+layout(set = 0, binding = PARTICLE_RENDER_BINDING_ALIVE) readonly buffer aliveBuffer{
+    uint aliveSlots[];
+};
 
 void main() {
-    gl_Position = vec4(inPosition, 1.0);
-    fragColor = inColor;
+    uint slot = aliveSlots[gl_InstanceIndex];
+    // Triangle strip order: (-1,-1), (1,-1), (-1,1), (1,1)
+    vec2 corner = vec2(float(gl_VertexIndex & 1), float(gl_VertexIndex >> 1)) * 2.0 - 1.0;
+    vec2 offset = corner * renderParameters.particleSize * vec2(renderParameters.aspectRatio, 1.0);
+    gl_Position = vec4(positions[slot].xyz, 1.0) + vec4(offset, 0.0, 0.0);
+    fragColor = colors[slot].rgb;
+    fragCorner = corner;
 }
@@ -0,0 +1,138 @@
+#version 450 core
+#extension GL_GOOGLE_include_directive : require
+#include "SpatialHashLayout.h"
+
+// Every pass of the spatial hash counting sort, picked by specialization constant 1 so they share
+// one module and one descriptor set layout. See SpatialHashLayout.h for what each pass does.
+
+// Workgroup size is picked by VkSpatialHash through specialization constant 0
+layout (local_size_x_id = 0) in;
+layout (constant_id = 1) const uint PASS = SPATIAL_HASH_PASS_CLEAR;
+
+layout(set = 0, binding = SPATIAL_HASH_BINDING_POSITIONS) readonly buffer positionBuffer{
+    vec4 positions[];
+};
+layout(set = 0, binding = SPATIAL_HASH_BINDING_PARTICLE_CELL) buffer particleCellBuffer{
+    uint particleCell[];
+};
+layout(set = 0, binding = SPATIAL_HASH_BINDING_PARTICLE_RANK) buffer particleRankBuffer{
+    uint particleRank[];
+};
+layout(set = 0, binding = SPATIAL_HASH_BINDING_CELL_COUNT) buffer cellCountBuffer{
+    uint cellCount[];
+};
+layout(set = 0, binding = SPATIAL_HASH_BINDING_CELL_START) buffer cellStartBuffer{
+    uint cellStart[];
+};
+layout(set = 0, binding = SPATIAL_HASH_BINDING_CELL_END) buffer cellEndBuffer{
+    uint cellEnd[];
+};
+layout(set = 0, binding = SPATIAL_HASH_BINDING_BLOCK_SUMS) buffer blockSumBuffer{
+    uint blockSums[];
+};
+layout(set = 0, binding = SPATIAL_HASH_BINDING_FIELD_IN) readonly buffer fieldInBuffer{
+    vec4 fieldIn[];
+};
+layout(set = 0, binding = SPATIAL_HASH_BINDING_FIELD_OUT) writeonly buffer fieldOutBuffer{
+    vec4 fieldOut[];
+};
+layout(set = 0, binding = SPATIAL_HASH_BINDING_REMAP_LIST) buffer remapListBuffer{
+    uint remapList[];
+};
+layout(set = 0, binding = SPATIAL_HASH_BINDING_REMAP_COUNTERS) readonly buffer remapCountersBuffer{
+    uint remapCounters[];
+};
+
+shared uint scratch[gl_WorkGroupSize.x];
+
+// Exclusive scan of one value per invocation across the workgroup (Hillis-Steele), returns the total
+uint workgroupExclusiveScan(uint value, out uint total)
+{
+    uint local = gl_LocalInvocationIndex;
+    scratch[local] = value;
+    barrier();
+    for (uint offset = 1; offset < gl_WorkGroupSize.x; offset *= 2)
+    {
+        uint other = local >= offset ? scratch[local - offset] : 0;
+        barrier();
+        scratch[local] += other;
+        barrier();
+    }
+    total = scratch[gl_WorkGroupSize.x - 1];
+    return scratch[local] - value;
+}
+
+void main(void) {
+    // Large dispatches spill over into y, see VkRenderer::getGroupCount
+    uint id = gl_GlobalInvocationID.x + gl_GlobalInvocationID.y * gl_NumWorkGroups.x * gl_WorkGroupSize.x;
+
+    if (PASS == SPATIAL_HASH_PASS_CLEAR)
+    {
+        if (id < hashParameters.numCells)
+        {
+            cellCount[id] = 0;
+        }
+    }
+    else if (PASS == SPATIAL_HASH_PASS_COUNT)
+    {
+        if (id < hashParameters.numElements)
+        {
+            uint cell = cellHash(cellCoordinates(positions[id].xyz));
+            particleCell[id] = cell;
+            // The slot taken in the bucket, the scatter needs no second atomic
+            particleRank[id] = atomicAdd(cellCount[cell], 1);
+        }
+    }
+    else if (PASS == SPATIAL_HASH_PASS_SCAN_BLOCKS)
+    {
+        // Every invocation reaches the barriers, out of range ones scan zeros
+        uint count = id < hashParameters.numCells ? cellCount[id] : 0;
+        uint total;
+        uint start = workgroupExclusiveScan(count, total);
+        if (id < hashParameters.numCells)
+        {
+            cellStart[id] = start;
+        }
+        if (gl_LocalInvocationIndex == 0)
+        {
+            blockSums[gl_WorkGroupID.x + gl_WorkGroupID.y * gl_NumWorkGroups.x] = total;
+        }
+    }
+    else if (PASS == SPATIAL_HASH_PASS_SCAN_BLOCK_SUMS)
+    {
+        // Dispatched as a single workgroup, VkSpatialHash keeps numCells <= workgroup size squared
+        uint numBlocks = (hashParameters.numCells + gl_WorkGroupSize.x - 1) / gl_WorkGroupSize.x;
+        uint sum = gl_LocalInvocationIndex < numBlocks ? blockSums[gl_LocalInvocationIndex] : 0;
+        uint total;
+        uint start = workgroupExclusiveScan(sum, total);
+        if (gl_LocalInvocationIndex < numBlocks)
+        {
+            blockSums[gl_LocalInvocationIndex] = start;
+        }
+    }
+    else if (PASS == SPATIAL_HASH_PASS_FINISH_SCAN)
+    {
+        if (id < hashParameters.numCells)
+        {
+            uint start = cellStart[id] + blockSums[id / gl_WorkGroupSize.x];
+            cellStart[id] = start;
+            cellEnd[id] = start + cellCount[id];
+        }
+    }
+    else if (PASS == SPATIAL_HASH_PASS_SCATTER)
+    {
+        if (id < hashParameters.numElements)
+        {
+            fieldOut[cellStart[particleCell[id]] + particleRank[id]] = fieldIn[id];
+        }
+    }
+    else if (PASS == SPATIAL_HASH_PASS_REMAP)
+    {
+        // Dispatched for numElements, the list length is only known on the GPU
+        if (id < remapCounters[hashParameters.remapCountIndex])
+        {
+            uint index = remapList[id];
+            remapList[id] = cellStart[particleCell[index]] + particleRank[index];
+        }
+    }
+}